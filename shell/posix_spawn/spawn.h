@@ -35,7 +35,13 @@ typedef struct
   struct sched_param __sp;
   int __policy;
   int __tcpgrp;
-  int __pad[15];
+  int __cgroup;
+  const void *__affinity;
+  size_t __affinity_size;
+  int __mempolicy;
+  const unsigned long *__nodemask;
+  unsigned long __maxnode;
+  int __pad[4];
 } posix_spawnattr_t;
 
 
@@ -50,6 +56,25 @@ typedef struct
 } posix_spawn_file_actions_t;
 
 
+#ifdef __USE_GNU
+/* Description of one stage of a pipeline spawned with
+   `posix_spawn_pipeline_np'.  */
+struct posix_spawn_stage
+{
+  const char *file;		/* File to execute, searched for in PATH.
+				   If NULL, argv[0] is used.  */
+  char *const *argv;		/* NULL-terminated argument vector.  */
+  const posix_spawn_file_actions_t *file_actions;
+				/* Actions performed after the stage is
+				   connected to its neighbours, or NULL.  */
+  int error;			/* If nonzero, the caller already knows the
+				   stage cannot run (e.g. its file was not
+				   found): it is not spawned and fails with
+				   this error number.  */
+};
+#endif
+
+
 /* Flags to be set in the `posix_spawnattr_t'.  */
 #define POSIX_SPAWN_RESETIDS		0x01
 #define POSIX_SPAWN_SETPGROUP		0x02
@@ -61,6 +86,9 @@ typedef struct
 # define POSIX_SPAWN_USEVFORK		0x40
 # define POSIX_SPAWN_SETSID		0x80
 # define POSIX_SPAWN_TCSETPGROUP	0x100
+# define POSIX_SPAWN_SETCGROUP		0x200
+# define POSIX_SPAWN_SETAFFINITY	0x400
+# define POSIX_SPAWN_SETMEMPOLICY	0x800
 #endif
 
 
@@ -91,6 +119,102 @@ extern int posix_spawnp (pid_t *__pid, const char *__file,
     __nonnull ((2, 5));
 
 
+#ifdef __USE_GNU
+/* Similar to `posix_spawnp' but also store in *PIDFD a pidfd referring
+   to the new process, or -1 if the kernel does not support pidfds.  The
+   pidfd has the close-on-exec flag set.  Unlike the process ID, it cannot
+   come to refer to a different process once the child has been reaped,
+   so it can be used to signal and wait for the child without races.
+
+   This function is a possible cancellation point and therefore not
+   marked with __THROW.  */
+extern int posix_spawnp_pidfd_np (pid_t *__pid, int *__pidfd,
+				  const char *__file,
+				  const posix_spawn_file_actions_t *__file_actions,
+				  const posix_spawnattr_t *__attrp,
+				  char *const __argv[], char *const __envp[])
+    __nonnull ((2, 3, 6));
+
+/* Spawn the NSTAGES commands described by STAGES as one pipeline, with
+   the standard output of each stage connected through a pipe to the
+   standard input of the next, and store their process IDs in PIDS.
+   Files are searched for in PATH as with `posix_spawnp'.
+
+   ATTRP applies to every stage.  If it requests POSIX_SPAWN_SETPGROUP
+   with a process group of 0, the first stage becomes the group leader and
+   the following stages join its group.  Stages that cannot be spawned
+   have their PIDS entry set to -1 and do not stop the remaining stages;
+   the error of the first such stage is returned.
+
+   If PIDFDS is not NULL, a pidfd for each stage is stored there as with
+   `posix_spawnp_pidfd_np', or -1 for the stages that were not spawned.
+
+   This function is a possible cancellation point and therefore not
+   marked with __THROW.  */
+extern int posix_spawn_pipeline_np (pid_t *__pids, int *__pidfds,
+				    const struct posix_spawn_stage *__stages,
+				    size_t __nstages,
+				    const posix_spawnattr_t *__attrp,
+				    char *const __envp[])
+    __nonnull ((1, 3));
+
+/* A pipeline whose stages are spawned one at a time, possibly
+   concurrently from several threads.  */
+typedef struct __spawn_pipeline posix_spawn_pipeline_t;
+
+/* Prepare spawning the pipeline described by the arguments, which are
+   as for `posix_spawn_pipeline_np' and must remain valid until
+   `posix_spawn_pipeline_finish_np' is called.  All pipes are created
+   here, so that the stages can then be spawned in any order.  The
+   children start with the signal mask of the calling thread.  */
+extern int posix_spawn_pipeline_init_np (posix_spawn_pipeline_t **__plp,
+					 pid_t *__pids, int *__pidfds,
+					 const struct posix_spawn_stage *__stages,
+					 size_t __nstages,
+					 const posix_spawnattr_t *__attrp,
+					 char *const __envp[])
+    __nonnull ((1, 2, 4));
+
+/* Spawn stage number STAGE of PL and store its pid (and pidfd) as
+   prepared.  Different stages may be spawned concurrently by different
+   threads.  With POSIX_SPAWN_SETPGROUP and a process group of 0, every
+   stage joins the group of the first stage to be spawned, waiting for it
+   to be created if necessary: that stage must be started before, or
+   concurrently with, the others, and no child of the pipeline may be
+   waited for until `posix_spawn_pipeline_finish_np' has returned.  If the
+   first stage fails before creating its group, the stages that were to
+   join it fail as well.
+
+   This function is a possible cancellation point and therefore not
+   marked with __THROW.  */
+extern int posix_spawn_pipeline_stage_np (posix_spawn_pipeline_t *__pl,
+					  size_t __stage)
+    __nonnull ((1));
+
+/* Release PL after all of its stages have been spawned.  Returns the
+   error of the first stage that could not be spawned, if any.  */
+extern int posix_spawn_pipeline_finish_np (posix_spawn_pipeline_t *__pl)
+    __nonnull ((1));
+#endif
+
+
+#ifdef __USE_GNU
+struct sigaction;
+
+/* Examine and change the action for SIG like `sigaction', and record
+   whether SIG now has a handler installed.  Once a program has called this
+   function, spawned children reset only the recorded signals to SIG_DFL
+   instead of checking every signal, so all later handlers must be
+   installed through it.  Handlers installed before the first call are
+   picked up by that call.  Returns 0 on success and -1 with errno set on
+   failure.  */
+extern int posix_spawn_sigaction_np (int __sig,
+				     const struct sigaction *__restrict __act,
+				     struct sigaction *__restrict __oact)
+     __THROW;
+#endif
+
+
 /* Initialize data structure with attributes for `spawn' to default values.  */
 extern int posix_spawnattr_init (posix_spawnattr_t *__attr)
     __THROW __nonnull ((1));
@@ -179,6 +303,36 @@ extern int posix_spawnattr_tcsetpgrp_np (posix_spawnattr_t *__attr, int fd)
 extern int posix_spawnattr_tcgetpgrp_np (const posix_spawnattr_t *
 					 __restrict __attr, int *fd)
      __THROW __nonnull ((1, 2));
+
+/* Start the spawned process in the cgroup v2 directory open as FD, if
+   POSIX_SPAWN_SETCGROUP is set.  It is created there directly with
+   clone3 and CLONE_INTO_CGROUP where available (Linux 5.7), and
+   otherwise moves itself there before anything else is done.  */
+extern int posix_spawnattr_setcgroup_np (posix_spawnattr_t *__attr, int fd)
+     __THROW __nonnull ((1));
+
+/* Return the cgroup FD in the attribute structure.  */
+extern int posix_spawnattr_getcgroup_np (const posix_spawnattr_t *
+					 __restrict __attr, int *fd)
+     __THROW __nonnull ((1, 2));
+
+/* Restrict the spawned process to the CPUs in CPUSET, as with
+   sched_setaffinity, if POSIX_SPAWN_SETAFFINITY is set.  CPUSET is not
+   copied and must remain valid until the process has been spawned.  */
+extern int posix_spawnattr_setaffinity_np (posix_spawnattr_t *__attr,
+					   size_t __cpusetsize,
+					   const cpu_set_t *__cpuset)
+     __THROW __nonnull ((1, 3));
+
+/* Give the spawned process the NUMA memory policy MODE for the nodes in
+   NODEMASK, as with set_mempolicy, if POSIX_SPAWN_SETMEMPOLICY is set.
+   NODEMASK is not copied and must remain valid until the process has
+   been spawned.  */
+extern int posix_spawnattr_setmempolicy_np (posix_spawnattr_t *__attr,
+					    int __mode,
+					    const unsigned long *__nodemask,
+					    unsigned long __maxnode)
+     __THROW __nonnull ((1));
 #endif
 
 /* Initialize data structure for file attribute for `spawn' call.  */
@@ -227,6 +381,12 @@ extern int posix_spawn_file_actions_addchdir_np (posix_spawn_file_actions_t *
 extern int posix_spawn_file_actions_addfchdir_np (posix_spawn_file_actions_t *,
 						  int __fd)
      __THROW __nonnull ((1));
+
+/* Add an action to close all file descriptors greater than or equal
+   to FROM during spawn.  This affects the subsequent file actions.  */
+extern int posix_spawn_file_actions_addclosefrom_np (posix_spawn_file_actions_t *,
+						    int __from)
+     __THROW __nonnull ((1));
 #endif
 
 __END_DECLS
@@ -0,0 +1,44 @@
+#define _GNU_SOURCE
+#include <spawn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "spawn_int.h"
+
+/* Grow the action array the same way glibc does, since actions added by
+ * glibc's posix_spawn_file_actions_add* functions share the array. */
+int __posix_spawn_file_actions_realloc(posix_spawn_file_actions_t *file_actions)
+{
+    int newalloc = file_actions->__allocated + 8;
+    void *newmem = realloc(file_actions->__actions,
+                newalloc * sizeof(struct __spawn_action));
+    if (newmem == NULL)
+        return ENOMEM;
+
+    file_actions->__actions = newmem;
+    file_actions->__allocated = newalloc;
+    return 0;
+}
+
+bool __spawn_valid_fd(int fd)
+{
+    long maxfd = sysconf(_SC_OPEN_MAX);
+    return fd >= 0 && (maxfd < 0 || fd < maxfd);
+}
+
+int posix_spawn_file_actions_addclosefrom_np(posix_spawn_file_actions_t *file_actions,
+                int from)
+{
+    if (!__spawn_valid_fd(from))
+        return EBADF;
+
+    if (file_actions->__used == file_actions->__allocated
+        && __posix_spawn_file_actions_realloc(file_actions) != 0)
+        return ENOMEM;
+
+    struct __spawn_action *rec = &file_actions->__actions[file_actions->__used];
+    rec->tag = spawn_do_closefrom;
+    rec->action.closefrom_action.from = from;
+    file_actions->__used++;
+    return 0;
+}
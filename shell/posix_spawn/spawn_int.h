@@ -20,6 +20,7 @@
 #define _SPAWN_INT_H
 
 #include <spawn.h>
+#include <signal.h>
 #include <stdbool.h>
 
 /* Data structure to contain the action information.  */
@@ -32,6 +33,7 @@ struct __spawn_action
     spawn_do_open,
     spawn_do_chdir,
     spawn_do_fchdir,
+    spawn_do_closefrom,
   } tag;
 
   union
@@ -60,20 +62,56 @@ struct __spawn_action
     {
       int fd;
     } fchdir_action;
+    struct
+    {
+      int from;
+    } closefrom_action;
   } action;
 };
 
+/* Registry of the signals that have a handler installed, maintained by
+   posix_spawn_sigaction_np.  The bitmap is only meaningful once
+   __spawn_sighandlers_valid is set.  */
+#define __SPAWN_SIGBITS		(8 * sizeof (unsigned long))
+#define __SPAWN_SIGWORDS	((_NSIG + __SPAWN_SIGBITS - 1) / __SPAWN_SIGBITS)
+extern unsigned long __spawn_sighandlers[__SPAWN_SIGWORDS];
+extern bool __spawn_sighandlers_valid;
+
+static inline bool
+__spawn_sighandler_isset (int sig)
+{
+  return (__atomic_load_n (&__spawn_sighandlers[sig / __SPAWN_SIGBITS],
+			   __ATOMIC_RELAXED)
+	  & (1UL << (sig % __SPAWN_SIGBITS))) != 0;
+}
+
 #define SPAWN_XFLAGS_USE_PATH	0x1
 #define SPAWN_XFLAGS_TRY_SHELL	0x2
 
 extern int __posix_spawn_file_actions_realloc (posix_spawn_file_actions_t *
 					       file_actions);
 
-extern int __spawni (pid_t *pid, const char *path,
+extern int __spawni (pid_t *pid, int *pidfd, const char *path,
 		     const posix_spawn_file_actions_t *file_actions,
 		     const posix_spawnattr_t *attrp, char *const argv[],
 		     char *const envp[], int xflags);
 
+extern int __spawni_pipeline (pid_t *pids, int *pidfds,
+			      const struct posix_spawn_stage *stages,
+			      size_t nstages, const posix_spawnattr_t *attrp,
+			      char *const envp[], int xflags);
+
+extern int __spawni_pipeline_init (struct __spawn_pipeline **plp,
+				   pid_t *pids, int *pidfds,
+				   const struct posix_spawn_stage *stages,
+				   size_t nstages,
+				   const posix_spawnattr_t *attrp,
+				   char *const envp[], int xflags);
+
+extern int __spawni_pipeline_stage (struct __spawn_pipeline *pl, size_t i);
+
+extern int __spawni_pipeline_finish (struct __spawn_pipeline *pl);
+
 /* Return true if FD falls into the range valid for file descriptors.
    The check in this form is mandated by POSIX.  */
 bool __spawn_valid_fd (int fd);
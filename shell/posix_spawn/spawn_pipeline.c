@@ -0,0 +1,29 @@
+#define _GNU_SOURCE
+#include <spawn.h>
+#include "spawn_int.h"
+
+int posix_spawn_pipeline_np(pid_t *pids, int *pidfds, const struct posix_spawn_stage *stages,
+                size_t nstages, const posix_spawnattr_t *attrp,
+                char *const envp[])
+{
+    return __spawni_pipeline(pids, pidfds, stages, nstages, attrp, envp, SPAWN_XFLAGS_USE_PATH);
+}
+
+int posix_spawn_pipeline_init_np(posix_spawn_pipeline_t **plp, pid_t *pids,
+                int *pidfds, const struct posix_spawn_stage *stages,
+                size_t nstages, const posix_spawnattr_t *attrp,
+                char *const envp[])
+{
+    return __spawni_pipeline_init(plp, pids, pidfds, stages, nstages, attrp, envp,
+                                  SPAWN_XFLAGS_USE_PATH);
+}
+
+int posix_spawn_pipeline_stage_np(posix_spawn_pipeline_t *pl, size_t stage)
+{
+    return __spawni_pipeline_stage(pl, stage);
+}
+
+int posix_spawn_pipeline_finish_np(posix_spawn_pipeline_t *pl)
+{
+    return __spawni_pipeline_finish(pl);
+}
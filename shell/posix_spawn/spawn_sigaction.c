@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+#include <spawn.h>
+#include <signal.h>
+#include <stdbool.h>
+#include "spawn_int.h"
+
+unsigned long __spawn_sighandlers[__SPAWN_SIGWORDS];
+bool __spawn_sighandlers_valid;
+
+static bool
+has_handler(const struct sigaction *sa)
+{
+    return sa->sa_handler != SIG_DFL && sa->sa_handler != SIG_IGN;
+}
+
+static void
+note_handler(int sig, bool handled)
+{
+    unsigned long bit = 1UL << (sig % __SPAWN_SIGBITS);
+    if (handled)
+        __atomic_fetch_or(&__spawn_sighandlers[sig / __SPAWN_SIGBITS], bit, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&__spawn_sighandlers[sig / __SPAWN_SIGBITS], ~bit, __ATOMIC_RELAXED);
+}
+
+/* Record the handlers that were installed before the registry was used */
+static void
+seed_registry(void)
+{
+    struct sigaction sa;
+    for (int sig = 1; sig < _NSIG; sig++)
+        if (sigaction(sig, NULL, &sa) == 0 && has_handler(&sa))
+            note_handler(sig, true);
+    __atomic_store_n(&__spawn_sighandlers_valid, true, __ATOMIC_RELEASE);
+}
+
+int posix_spawn_sigaction_np(int sig, const struct sigaction *act,
+                struct sigaction *oact)
+{
+    if (!__atomic_load_n(&__spawn_sighandlers_valid, __ATOMIC_ACQUIRE))
+        seed_registry();
+
+    if (sig <= 0 || sig >= _NSIG)
+        return sigaction(sig, act, oact);
+
+    // a signal is marked before its handler is installed and unmarked only
+    // after it is removed, so a concurrent spawn never misses a handler
+    if (act != NULL && has_handler(act))
+        note_handler(sig, true);
+    if (sigaction(sig, act, oact) != 0)
+        return -1;
+    if (act != NULL && !has_handler(act))
+        note_handler(sig, false);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/* Set the CPU affinity and NUMA memory policy options.
+   Copyright (C) 2021 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+#define _GNU_SOURCE 1
+#include <spawn.h>
+
+int
+posix_spawnattr_setaffinity_np (posix_spawnattr_t *attr, size_t cpusetsize,
+				const cpu_set_t *cpuset)
+{
+  attr->__affinity = cpuset;
+  attr->__affinity_size = cpusetsize;
+  return 0;
+}
+
+int
+posix_spawnattr_setmempolicy_np (posix_spawnattr_t *attr, int mode,
+				 const unsigned long *nodemask,
+				 unsigned long maxnode)
+{
+  attr->__mempolicy = mode;
+  attr->__nodemask = nodemask;
+  attr->__maxnode = maxnode;
+  return 0;
+}
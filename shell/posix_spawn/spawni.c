@@ -21,11 +21,17 @@
 #include "spawn.h"
 #include <fcntl.h>
 #include <paths.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/param.h>
 #include <sys/mman.h>
+#include <dirent.h>
+#include <sys/pidfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 //#include <not-cancel.h>
 //#include <local-setxid.h>
 //#include <shlib-compat.h>
@@ -34,6 +40,7 @@
 #include <libc-pointer-arith.h>
 //#include <ldsodefs.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <sched.h>
@@ -68,12 +75,18 @@
 #define local_setegid setegid
 #define __execvpex execvpe
 #define __execve execve
+#define __close_range close_range
+#define __open64_nocancel open
+#define __getdents64 getdents64
+#define __pidfd_open pidfd_open
+#define __getpagesize getpagesize
+#define __getpid getpid
 
 // in lieu of <stackinfo.h>
 #define _STACK_GROWS_DOWN	1
 #include <elf.h>
 static int _dl_stack_flags = (PF_R|PF_W|PF_X);
-static const int _dl_pagesize = _SC_PAGESIZE;
+#define _dl_pagesize __getpagesize ()
 #define GL(name) _##name
 #define GLRO(name) _##name
 
@@ -134,11 +147,11 @@ _Static_assert (sizeof (posix_spawnattr_t) == 336,
 #define SPAWN_ERROR	127
 
 #ifdef __ia64__
-# define CLONE(__fn, __stackbase, __stacksize, __flags, __args) \
-  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, 0, 0, 0)
+# define CLONE(__fn, __stackbase, __stacksize, __flags, __args, __ptid) \
+  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, __ptid, 0, 0)
 #else
-# define CLONE(__fn, __stack, __stacksize, __flags, __args) \
-  __clone (__fn, __stack, __flags, __args)
+# define CLONE(__fn, __stack, __stacksize, __flags, __args, __ptid) \
+  __clone (__fn, __stack, __flags, __args, __ptid)
 #endif
 
 /* Since ia64 wants the stackbase w/clone2, re-use the grows-up macro.  */
@@ -160,9 +173,71 @@ struct posix_spawn_args
   ptrdiff_t argc;
   char *const *envp;
   int xflags;
+  int pipe_in;
+  int pipe_out;
+  const sigset_t *sigreset;
+  struct __spawn_pgrp_sync *pgrp_sync;
+  bool pgrp_leader;
+  bool cgroup_joined;		/* Created in the cgroup by clone3.  */
   int err;
 };
 
+/* When the stages of a pipeline are spawned concurrently, the stages
+   after the first one cannot be told the process group to join in
+   advance.  Instead, the first stage publishes its group here once it
+   has created it, and the other stages wait for it before joining.  */
+enum
+{
+  PGRP_PENDING,
+  PGRP_READY,
+  PGRP_FAILED
+};
+
+struct __spawn_pgrp_sync
+{
+  int state;			/* One of the PGRP_* values.  */
+  pid_t pgrp;			/* The group, once PGRP_READY.  */
+  int err;			/* The leader's error, once PGRP_FAILED.  */
+  pid_t failed_leader;		/* A leader that failed after creating the
+				   group.  It is reaped only once all stages
+				   have been spawned, so the group exists
+				   until they have joined it.  */
+};
+
+/* Publish the outcome of creating the process group and wake the stages
+   waiting for it.  Only the first call has an effect.  Only the leader
+   publishes, first its child and then, once the child has exec'ed or
+   exited, the parent, so there are no concurrent calls.  */
+static void
+__spawni_pgrp_publish (struct __spawn_pgrp_sync *sync, int state,
+		       pid_t pgrp, int err)
+{
+  if (__atomic_load_n (&sync->state, __ATOMIC_RELAXED) != PGRP_PENDING)
+    return;
+  sync->pgrp = pgrp;
+  sync->err = err;
+  __atomic_store_n (&sync->state, state, __ATOMIC_RELEASE);
+  syscall (SYS_futex, &sync->state, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/* Wait until the process group has been created and return it, or
+   return -1 with errno set to the leader's error if it failed.  */
+static pid_t
+__spawni_pgrp_wait (struct __spawn_pgrp_sync *sync)
+{
+  int state;
+  while ((state = __atomic_load_n (&sync->state, __ATOMIC_ACQUIRE))
+	 == PGRP_PENDING)
+    syscall (SYS_futex, &sync->state, FUTEX_WAIT, PGRP_PENDING, NULL);
+
+  if (state == PGRP_FAILED)
+    {
+      errno = sync->err;
+      return -1;
+    }
+  return sync->pgrp;
+}
+
 /* Older version requires that shell script without shebang definition
    to be called explicitly using /bin/sh (_PATH_BSHELL).  */
 static void
@@ -188,6 +263,67 @@ maybe_script_execute (struct posix_spawn_args *args)
     }
 }
 
+/* Close all file descriptors from LOWFD up for kernels without close_range,
+   by reading /proc/self/fd.  It runs in the child, so it must not allocate
+   memory.  Return false if the descriptors could not be listed.  */
+static bool
+__closefrom_fallback (int lowfd)
+{
+  int dirfd = __open64_nocancel ("/proc/self/fd",
+				 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd == -1)
+    return false;
+
+  char buffer[1024];
+  bool closed_any;
+  do
+    {
+      /* Closing entries while reading the directory may skip some of
+	 them, so read it again until nothing is left to close.  */
+      closed_any = false;
+      lseek (dirfd, 0, SEEK_SET);
+      ssize_t ret;
+      while ((ret = __getdents64 (dirfd, buffer, sizeof buffer)) > 0)
+	for (ssize_t pos = 0; pos < ret;)
+	  {
+	    struct dirent64 *dirp = (struct dirent64 *) (buffer + pos);
+	    pos += dirp->d_reclen;
+
+	    if (dirp->d_name[0] < '0' || dirp->d_name[0] > '9')
+	      continue;
+	    int fd = 0;
+	    for (const char *s = dirp->d_name; *s != '\0'; s++)
+	      fd = fd * 10 + (*s - '0');
+	    if (fd >= lowfd && fd != dirfd)
+	      {
+		__close_nocancel (fd);
+		closed_any = true;
+	      }
+	  }
+      if (ret < 0)
+	{
+	  __close_nocancel (dirfd);
+	  return false;
+	}
+    }
+  while (closed_any);
+
+  __close_nocancel (dirfd);
+  return true;
+}
+
+/* Move the calling process to the cgroup v2 directory open as CGROUP.  */
+static int
+__spawni_join_cgroup (int cgroup)
+{
+  int fd = openat (cgroup, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  int ret = write (fd, "0", 1) == 1 ? 0 : -1;
+  __close_nocancel (fd);
+  return ret;
+}
+
 /* Function used in the clone call to setup the signals mask, posix_spawn
    attributes, and file actions.  It run on its own stack (provided by the
    posix_spawn call).  */
@@ -207,6 +343,19 @@ __spawni_child (void *arguments)
   struct sigaction sa;
   memset (&sa, '\0', sizeof (sa));
 
+  if (args->sigreset != NULL)
+    {
+      /* The parent already determined which signals need to be reset
+	 (see __spawni_sigreset_set), either from the handler registry or
+	 once for all children of a pipeline, so avoid querying every
+	 disposition again.  */
+      sa.sa_handler = SIG_DFL;
+      for (int sig = 1; sig < _NSIG; ++sig)
+	if (__sigismember (args->sigreset, sig))
+	  __libc_sigaction (sig, &sa, 0);
+      goto sigreset_done;
+    }
+
   sigset_t hset;
   __sigprocmask (SIG_BLOCK, 0, &hset);
   for (int sig = 1; sig < _NSIG; ++sig)
@@ -234,6 +383,13 @@ __spawni_child (void *arguments)
       __libc_sigaction (sig, &sa, 0);
     }
 
+sigreset_done:
+  /* Move to the cgroup first, so that everything the child does is
+     accounted there, unless clone3 has created it there.  */
+  if ((attr->__flags & POSIX_SPAWN_SETCGROUP) != 0 && !args->cgroup_joined
+      && __spawni_join_cgroup (attr->__cgroup) != 0)
+    goto fail;
+
 #ifdef _POSIX_PRIORITY_SCHEDULING
   /* Set the scheduling algorithm and parameters.  */
   if ((attr->__flags & (POSIX_SPAWN_SETSCHEDPARAM | POSIX_SPAWN_SETSCHEDULER))
@@ -249,15 +405,36 @@ __spawni_child (void *arguments)
     }
 #endif
 
+  /* Set the CPU affinity and NUMA memory policy; both belong to the
+     task, so the parent, which shares the memory, is not affected.  */
+  if ((attr->__flags & POSIX_SPAWN_SETAFFINITY) != 0
+      && sched_setaffinity (0, attr->__affinity_size, attr->__affinity) != 0)
+    goto fail;
+  if ((attr->__flags & POSIX_SPAWN_SETMEMPOLICY) != 0
+      && syscall (SYS_set_mempolicy, attr->__mempolicy, attr->__nodemask,
+		  attr->__maxnode) != 0)
+    goto fail;
+
   if ((attr->__flags & POSIX_SPAWN_SETSID) != 0
       && __setsid () < 0)
     goto fail;
 
   /* Set the process group ID.  */
-  if ((attr->__flags & POSIX_SPAWN_SETPGROUP) != 0
-      && __setpgid (0, attr->__pgrp) != 0)
+  if (args->pgrp_sync != NULL && !args->pgrp_leader)
+    {
+      /* A concurrently spawned pipeline stage joins the group of the
+	 first stage, which might not have been created yet.  */
+      pid_t pgrp = __spawni_pgrp_wait (args->pgrp_sync);
+      if (pgrp == -1 || __setpgid (0, pgrp) != 0)
+	goto fail;
+    }
+  else if ((attr->__flags & POSIX_SPAWN_SETPGROUP) != 0
+	   && __setpgid (0, attr->__pgrp) != 0)
     goto fail;
 
+  if (args->pgrp_sync != NULL && args->pgrp_leader)
+    __spawni_pgrp_publish (args->pgrp_sync, PGRP_READY, __getpid (), 0);
+
   /* Set the controlling terminal.  */
   if ((attr->__flags & POSIX_SPAWN_TCSETPGROUP) != 0)
     {
@@ -275,6 +452,16 @@ __spawni_child (void *arguments)
 	  || local_setegid (__getgid ()) != 0))
     goto fail;
 
+  /* Connect the pipes to the neighbouring pipeline stages.  This happens
+     before the file actions so that redirections of the stage take
+     precedence.  Both descriptors are close-on-exec in the parent.  */
+  if (args->pipe_in != -1
+      && __dup2 (args->pipe_in, STDIN_FILENO) != STDIN_FILENO)
+    goto fail;
+  if (args->pipe_out != -1
+      && __dup2 (args->pipe_out, STDOUT_FILENO) != STDOUT_FILENO)
+    goto fail;
+
   /* Execute the file actions.  */
   if (file_actions != 0)
     {
@@ -365,6 +552,15 @@ __spawni_child (void *arguments)
 	      if (__fchdir (action->action.fchdir_action.fd) != 0)
 		goto fail;
 	      break;
+
+	    case spawn_do_closefrom:
+	      {
+		int lowfd = action->action.closefrom_action.from;
+		if (__close_range (lowfd, ~0U, 0) != 0
+		    && !__closefrom_fallback (lowfd))
+		  goto fail;
+	      }
+	      break;
 	    }
 	}
     }
@@ -388,25 +584,15 @@ fail:
      be to set args->err to some negative sentinel and have the parent
      abort(), but that seems needlessly harsh.  */
   args->err = errno ? : ECHILD;
+  if (args->pgrp_sync != NULL && args->pgrp_leader)
+    __spawni_pgrp_publish (args->pgrp_sync, PGRP_FAILED, 0, args->err);
   _exit (SPAWN_ERROR);
 }
 
-/* Spawn a new process executing PATH with the attributes describes in *ATTRP.
-   Before running the process perform the actions described in FILE-ACTIONS. */
+/* Count the arguments in ARGV, failing with E2BIG past the limit.  */
 static int
-__spawnix (pid_t * pid, const char *file,
-	   const posix_spawn_file_actions_t * file_actions,
-	   const posix_spawnattr_t * attrp, char *const argv[],
-	   char *const envp[], int xflags,
-	   int (*exec) (const char *, char *const *, char *const *))
+__spawni_count_args (char *const argv[], ptrdiff_t *argcp)
 {
-  pid_t new_pid;
-  struct posix_spawn_args args;
-  int ec;
-
-  /* To avoid imposing hard limits on posix_spawn{p} the total number of
-     arguments is first calculated to allocate a mmap to hold all possible
-     values.  */
   ptrdiff_t argc = 0;
   /* Linux allows at most max (0x7FFFFFFF, 1/4 stack size) arguments
      to be used in a execve call.  We limit to INT_MAX minus one due the
@@ -416,11 +602,19 @@ __spawnix (pid_t * pid, const char *file,
   ptrdiff_t limit = INT_MAX - 1;
   while (argv[argc++] != NULL)
     if (argc == limit)
-      {
-	errno = E2BIG;
-	return errno;
-      }
+      return E2BIG;
+
+  *argcp = argc;
+  return 0;
+}
 
+/* Allocate NSTACKS adjacent stacks for children to run on until they
+   call execve, each of the size stored in *STACK_SIZEP.  MAPFLAGS are
+   added to the mmap flags.  */
+static void *
+__spawni_alloc_stack (ptrdiff_t argc, size_t nstacks, size_t *stack_sizep,
+		      int mapflags)
+{
   int prot = (PROT_READ | PROT_WRITE
 	     | ((GL (dl_stack_flags) & PF_X) ? PROT_EXEC : 0));
 
@@ -432,28 +626,112 @@ __spawnix (pid_t * pid, const char *file,
      extra pages won't actually be allocated unless they get used.  */
   argv_size += (32 * 1024);
   size_t stack_size = ALIGN_UP (argv_size, GLRO(dl_pagesize));
-  void *stack = __mmap (NULL, stack_size, prot,
-			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-  if (__glibc_unlikely (stack == MAP_FAILED))
-    return errno;
+  void *stack = __mmap (NULL, stack_size * nstacks, prot,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | mapflags,
+			-1, 0);
+  *stack_sizep = stack_size;
+  return stack;
+}
 
-  /* Disable asynchronous cancellation.  */
-  int state;
-  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+/* Cleared once the kernel is found not to support CLONE_PIDFD.  */
+static bool __spawn_clone_pidfd = true;
+
+/* Cleared once clone3 is found not to support CLONE_INTO_CGROUP.  */
+static bool __spawn_clone3_cgroup = true;
+
+#ifndef CLONE_INTO_CGROUP
+# define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/* The argument of clone3, as of Linux 5.7.  */
+struct __spawn_clone_args
+{
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+  uint64_t set_tid;
+  uint64_t set_tid_size;
+  uint64_t cgroup;
+};
+
+/* Run __spawni_child for ARGS on STACK in a new process created in the
+   cgroup open as CGROUP, with the same flags as the clone in
+   __spawni_clone.  glibc has no clone3 wrapper that takes a function to
+   run on the new stack, so the system call is made directly; the child
+   never returns from it.  Return the pid or -1 with errno set; ENOSYS
+   means clone3 cannot be used at all.  */
+static pid_t
+__spawni_clone3 (struct posix_spawn_args *args, void *stack,
+		 size_t stack_size, int cgroup, int *pidfd)
+{
+#if defined __x86_64__
+  struct __spawn_clone_args cl_args =
+    {
+      .flags = CLONE_VM | CLONE_VFORK | CLONE_INTO_CGROUP
+	       | (pidfd != NULL ? CLONE_PIDFD : 0),
+      .pidfd = (uintptr_t) pidfd,
+      .exit_signal = SIGCHLD,
+      .stack = (uintptr_t) stack,
+      /* The child's stack pointer starts 16-byte aligned.  */
+      .stack_size = stack_size & ~(size_t) 15,
+      .cgroup = cgroup,
+    };
+  int (*fn) (void *) = __spawni_child;
+  long ret;
+  __asm__ volatile ("syscall\n\t"
+		    "testq %%rax, %%rax\n\t"
+		    "jnz 1f\n\t"
+		    /* In the child, on the new stack.  */
+		    "xorl %%ebp, %%ebp\n\t"
+		    "movq %[arg], %%rdi\n\t"
+		    "callq *%[fn]\n\t"
+		    "movl %%eax, %%edi\n\t"
+		    "movl %[nr_exit], %%eax\n\t"
+		    "syscall\n\t"
+		    "hlt\n"
+		    "1:"
+		    : "=a" (ret)
+		    : "0" ((long) SYS_clone3), "D" (&cl_args),
+		      "S" (sizeof cl_args), [fn] "r" (fn), [arg] "r" (args),
+		      [nr_exit] "i" (SYS_exit)
+		    : "rcx", "r11", "memory");
+  if (ret < 0)
+    {
+      errno = -ret;
+      return -1;
+    }
+  return ret;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Run __spawni_child for ARGS on STACK and wait until it has either
+   exec'ed or failed.  Return 0 and store the new pid in *PID on success,
+   otherwise return an error number.  All signals must be blocked.
+
+   If PIDFD is not NULL, a pidfd referring to the new process is stored
+   there on success, or -1 if the kernel does not support pidfds.  It is
+   obtained atomically with CLONE_PIDFD where available (Linux 5.2), and
+   with pidfd_open otherwise; since the child cannot have been reaped yet,
+   neither can refer to a different process.  */
+static int
+__spawni_clone (pid_t *pid, int *pidfd, struct posix_spawn_args *args,
+		void *stack, size_t stack_size)
+{
+  pid_t new_pid;
+  int new_pidfd = -1;
+  int ec;
 
   /* Child must set args.err to something non-negative - we rely on
      the parent and child sharing VM.  */
-  args.err = 0;
-  args.file = file;
-  args.exec = exec;
-  args.fa = file_actions;
-  args.attr = attrp ? attrp : &(const posix_spawnattr_t) { 0 };
-  args.argv = argv;
-  args.argc = argc;
-  args.envp = envp;
-  args.xflags = xflags;
-
-  __libc_signal_block_all (&args.oldmask);
+  args->err = 0;
 
   /* The clone flags used will create a new child that will run in the same
      memory space (CLONE_VM) and the execution of calling thread will be
@@ -463,8 +741,38 @@ __spawnix (pid_t * pid, const char *file,
      need for CLONE_SETTLS.  Although parent and child share the same TLS
      namespace, there will be no concurrent access for TLS variables (errno
      for instance).  */
-  new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
-		   CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+  bool cloned = false;
+  args->cgroup_joined = false;
+  if ((args->attr->__flags & POSIX_SPAWN_SETCGROUP) != 0
+      && __spawn_clone3_cgroup)
+    {
+      /* With clone3, the child is created in its cgroup, so it is never
+	 accounted to or limited by the parent's.  Kernels without clone3
+	 fail with ENOSYS, those without CLONE_INTO_CGROUP with E2BIG;
+	 then the child joins the cgroup itself.  */
+      args->cgroup_joined = true;
+      new_pid = __spawni_clone3 (args, stack, stack_size,
+				 args->attr->__cgroup,
+				 pidfd != NULL ? &new_pidfd : NULL);
+      cloned = new_pid != -1 || (errno != ENOSYS && errno != E2BIG);
+      if (!cloned)
+	{
+	  __spawn_clone3_cgroup = false;
+	  args->cgroup_joined = false;
+	}
+    }
+  if (!cloned && pidfd != NULL && __spawn_clone_pidfd)
+    {
+      new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
+		       flags | CLONE_PIDFD, args, &new_pidfd);
+      /* Kernels without CLONE_PIDFD reject it, and nothing was created.  */
+      if (new_pid == -1 && errno == EINVAL)
+	__spawn_clone_pidfd = false;
+    }
+  if (!cloned && (pidfd == NULL || !__spawn_clone_pidfd))
+    new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
+		     flags, args, NULL);
 
   /* It needs to collect the case where the auxiliary process was created
      but failed to execute the file (due either any preparation step or
@@ -477,23 +785,138 @@ __spawnix (pid_t * pid, const char *file,
 	 only in case of failure, so in case of premature termination
 	 due a signal args.err will remain zeroed and it will be up to
 	 caller to actually collect it.  */
-      ec = args.err;
+      ec = args->err;
       if (ec > 0)
-	/* There still an unlikely case where the child is cancelled after
-	   setting args.err, due to a positive error value.  Also there is
-	   possible pid reuse race (where the kernel allocated the same pid
-	   to an unrelated process).  Unfortunately due synchronization
-	   issues where the kernel might not have the process collected
-	   the waitpid below can not use WNOHANG.  */
-	__waitpid (new_pid, NULL, 0);
+	{
+	  /* There still an unlikely case where the child is cancelled after
+	     setting args.err, due to a positive error value.  Also there is
+	     possible pid reuse race (where the kernel allocated the same pid
+	     to an unrelated process).  Unfortunately due synchronization
+	     issues where the kernel might not have the process collected
+	     the waitpid below can not use WNOHANG.
+
+	     A pipeline leader that fails may already have created the
+	     process group the other stages are joining; it is reaped
+	     once they are all spawned.  */
+	  if (args->pgrp_sync != NULL && args->pgrp_leader)
+	    args->pgrp_sync->failed_leader = new_pid;
+	  else
+	    __waitpid (new_pid, NULL, 0);
+	  if (new_pidfd != -1)
+	    __close_nocancel (new_pidfd);
+	}
+      else if (pidfd != NULL && new_pidfd == -1)
+	new_pidfd = __pidfd_open (new_pid, 0);
     }
   else
-    ec = -new_pid;
+    ec = errno;
 
-  __munmap (stack, stack_size);
+  /* The child has exec'ed or exited by now; if it did not create the
+     process group, it never will.  */
+  if (args->pgrp_sync != NULL && args->pgrp_leader)
+    __spawni_pgrp_publish (args->pgrp_sync, PGRP_FAILED, 0, ec ? : ECHILD);
 
   if ((ec == 0) && (pid != NULL))
     *pid = new_pid;
+  if ((ec == 0) && (pidfd != NULL))
+    *pidfd = new_pidfd;
+
+  return ec;
+}
+
+/* Store in *SET the signals a child must reset to SIG_DFL before exec:
+   those listed in the POSIX_SPAWN_SETSIGDEF set of ATTR and those for
+   which a handler is installed.  Signals that are ignored or already
+   have the default disposition need no work in the child.
+
+   If the program installs its handlers through posix_spawn_sigaction_np,
+   the handled signals are taken from that registry without any system
+   call.  Otherwise, the dispositions are queried if SCAN is true; if it
+   is false, return false so the child falls back to checking every
+   signal itself.  */
+static bool
+__spawni_sigreset_set (const posix_spawnattr_t *attr, sigset_t *set,
+		       bool scan)
+{
+  struct sigaction sa;
+  bool registry = __atomic_load_n (&__spawn_sighandlers_valid,
+				   __ATOMIC_ACQUIRE);
+
+  if (!registry && !scan)
+    return false;
+
+  sigemptyset (set);
+  for (int sig = 1; sig < _NSIG; ++sig)
+    {
+      if ((attr->__flags & POSIX_SPAWN_SETSIGDEF)
+	  && __sigismember (&attr->__sd, sig))
+	sigaddset (set, sig);
+      else if (registry)
+	{
+	  if (__spawn_sighandler_isset (sig))
+	    sigaddset (set, sig);
+	}
+      else if (__libc_sigaction (sig, 0, &sa) == 0
+	       && sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL)
+	sigaddset (set, sig);
+    }
+  return true;
+}
+
+/* Spawn a new process executing PATH with the attributes describes in *ATTRP.
+   Before running the process perform the actions described in FILE-ACTIONS. */
+static int
+__spawnix (pid_t * pid, int *pidfd, const char *file,
+	   const posix_spawn_file_actions_t * file_actions,
+	   const posix_spawnattr_t * attrp, char *const argv[],
+	   char *const envp[], int xflags,
+	   int (*exec) (const char *, char *const *, char *const *))
+{
+  struct posix_spawn_args args;
+  int ec;
+
+  /* To avoid imposing hard limits on posix_spawn{p} the total number of
+     arguments is first calculated to allocate a mmap to hold all possible
+     values.  */
+  ptrdiff_t argc;
+  ec = __spawni_count_args (argv, &argc);
+  if (ec != 0)
+    {
+      errno = ec;
+      return ec;
+    }
+
+  size_t stack_size;
+  void *stack = __spawni_alloc_stack (argc, 1, &stack_size, 0);
+  if (__glibc_unlikely (stack == MAP_FAILED))
+    return errno;
+
+  /* Disable asynchronous cancellation.  */
+  int state;
+  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+
+  args.file = file;
+  args.exec = exec;
+  args.fa = file_actions;
+  args.attr = attrp ? attrp : &(const posix_spawnattr_t) { 0 };
+  args.argv = argv;
+  args.argc = argc;
+  args.envp = envp;
+  args.xflags = xflags;
+  args.pipe_in = -1;
+  args.pipe_out = -1;
+  args.pgrp_sync = NULL;
+  args.pgrp_leader = false;
+
+  __libc_signal_block_all (&args.oldmask);
+
+  sigset_t sigreset;
+  args.sigreset = (__spawni_sigreset_set (args.attr, &sigreset, false)
+		   ? &sigreset : NULL);
+
+  ec = __spawni_clone (pid, pidfd, &args, stack, stack_size);
+
+  __munmap (stack, stack_size);
 
   __libc_signal_restore_set (&args.oldmask);
 
@@ -503,15 +926,352 @@ __spawnix (pid_t * pid, const char *file,
 }
 
 /* Spawn a new process executing PATH with the attributes describes in *ATTRP.
-   Before running the process perform the actions described in FILE-ACTIONS. */
+   Before running the process perform the actions described in FILE-ACTIONS.
+   If PIDFD is not NULL, also store a pidfd for the new process there.  */
 int
-__spawni (pid_t * pid, const char *file,
+__spawni (pid_t * pid, int *pidfd, const char *file,
 	  const posix_spawn_file_actions_t * acts,
 	  const posix_spawnattr_t * attrp, char *const argv[],
 	  char *const envp[], int xflags)
 {
   /* It uses __execvpex to avoid run ENOEXEC in non compatibility mode (it
      will be handled by maybe_script_execute).  */
-  return __spawnix (pid, file, acts, attrp, argv, envp, xflags,
+  return __spawnix (pid, pidfd, file, acts, attrp, argv, envp, xflags,
 		    xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex :__execve);
 }
+
+/* Spawn the NSTAGES processes described by STAGES, connecting the standard
+   output of each stage to the standard input of the next one.
+
+   Compared to calling __spawni once per stage, the child stack is mapped
+   (and pre-faulted) once and reused for every clone, since CLONE_VFORK
+   guarantees the previous child no longer runs on it.  Signals are
+   blocked and restored once, and the set of signals the children must
+   reset is computed once by the parent instead of being rediscovered by
+   every child.
+
+   If POSIX_SPAWN_SETPGROUP is set with a process group of 0, the first
+   stage that is spawned successfully becomes the process group leader and
+   all later stages join its group; POSIX_SPAWN_TCSETPGROUP is applied only
+   by that first stage.  A stage that cannot be spawned, or whose error
+   member is set, does not prevent the remaining stages from running: its
+   entry in PIDS is set to -1 and the error of the first failing stage is
+   returned.
+
+   If PIDFDS is not NULL, a pidfd for each stage is stored there as well,
+   or -1 if the stage was not spawned or pidfds are not supported.  */
+int
+__spawni_pipeline (pid_t *pids, int *pidfds, const struct posix_spawn_stage *stages,
+		   size_t nstages, const posix_spawnattr_t *attrp,
+		   char *const envp[], int xflags)
+{
+  struct posix_spawn_args args;
+  posix_spawnattr_t stage_attr;
+  sigset_t sigreset;
+  ptrdiff_t maxargc = 0;
+  int ec;
+
+  if (nstages == 0)
+    return EINVAL;
+
+  for (size_t i = 0; i < nstages; i++)
+    {
+      pids[i] = -1;
+      if (pidfds != NULL)
+	pidfds[i] = -1;
+    }
+
+  for (size_t i = 0; i < nstages; i++)
+    {
+      ptrdiff_t argc;
+      ec = __spawni_count_args (stages[i].argv, &argc);
+      if (ec != 0)
+	return ec;
+      if (argc > maxargc)
+	maxargc = argc;
+    }
+
+  size_t stack_size;
+  void *stack = __spawni_alloc_stack (maxargc, 1, &stack_size,
+				      MAP_POPULATE);
+  if (__glibc_unlikely (stack == MAP_FAILED))
+    return errno;
+
+  /* Disable asynchronous cancellation.  */
+  int state;
+  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+
+  /* Each stage may update the process group, so work on a copy.  */
+  if (attrp != NULL)
+    stage_attr = *attrp;
+  else
+    memset (&stage_attr, '\0', sizeof (stage_attr));
+
+  args.exec = xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex : __execve;
+  args.attr = &stage_attr;
+  args.envp = envp;
+  args.xflags = xflags;
+  args.sigreset = &sigreset;
+  args.pgrp_sync = NULL;
+  args.pgrp_leader = false;
+
+  __libc_signal_block_all (&args.oldmask);
+
+  __spawni_sigreset_set (&stage_attr, &sigreset, true);
+
+  int prev_read = -1;
+  ec = 0;
+  for (size_t i = 0; i < nstages; i++)
+    {
+      int pipefd[2] = { -1, -1 };
+      if (i + 1 < nstages && pipe2 (pipefd, O_CLOEXEC) != 0)
+	{
+	  /* Without a pipe there is nothing to connect the remaining
+	     stages to.  */
+	  if (ec == 0)
+	    ec = errno;
+	  break;
+	}
+
+      args.file = stages[i].file ? stages[i].file : stages[i].argv[0];
+      args.fa = stages[i].file_actions;
+      args.argv = stages[i].argv;
+      __spawni_count_args (stages[i].argv, &args.argc);
+      args.pipe_in = prev_read;
+      args.pipe_out = pipefd[1];
+
+      int stage_ec = stages[i].error;
+      if (stage_ec == 0)
+	stage_ec = __spawni_clone (&pids[i], pidfds ? &pidfds[i] : NULL,
+				    &args, stack, stack_size);
+      if (stage_ec != 0)
+	{
+	  if (ec == 0)
+	    ec = stage_ec;
+	}
+      else if ((stage_attr.__flags & POSIX_SPAWN_SETPGROUP) != 0
+	       && stage_attr.__pgrp == 0)
+	{
+	  /* Later stages join the group of the first one, which now also
+	     owns the terminal if requested.  */
+	  stage_attr.__pgrp = pids[i];
+	  stage_attr.__flags &= ~POSIX_SPAWN_TCSETPGROUP;
+	}
+
+      if (prev_read != -1)
+	__close_nocancel (prev_read);
+      if (pipefd[1] != -1)
+	__close_nocancel (pipefd[1]);
+      prev_read = pipefd[0];
+    }
+
+  if (prev_read != -1)
+    __close_nocancel (prev_read);
+
+  __munmap (stack, stack_size);
+
+  __libc_signal_restore_set (&args.oldmask);
+
+  __pthread_setcancelstate (state, NULL);
+
+  return ec;
+}
+
+/* A pipeline whose stages are spawned separately, possibly concurrently
+   from several threads.  Unlike __spawni_pipeline, every stage needs a
+   stack of its own and all pipes are created up front.  */
+struct __spawn_pipeline
+{
+  pid_t *pids;
+  int *pidfds;
+  const struct posix_spawn_stage *stages;
+  size_t nstages;
+  size_t leader;		/* First stage that is to be spawned.  */
+  posix_spawnattr_t leader_attr;
+  posix_spawnattr_t follower_attr;	/* Without POSIX_SPAWN_TCSETPGROUP.  */
+  bool sync_pgrp;		/* True if all stages join the leader's group.  */
+  struct __spawn_pgrp_sync pgrp;
+  char *const *envp;
+  int xflags;
+  sigset_t mask;		/* Signal mask the children start with.  */
+  sigset_t sigreset;
+  int *pipes;			/* Read and write ends of the NSTAGES - 1
+				   pipes.  */
+  void *stacks;
+  size_t stack_size;
+  int *errors;			/* Error of every stage.  */
+};
+
+static void
+__spawni_pipeline_free (struct __spawn_pipeline *pl)
+{
+  free (pl->pipes);
+  free (pl->errors);
+  free (pl);
+}
+
+/* Prepare the concurrent spawning of the NSTAGES processes described by
+   STAGES: create the pipes between them and a stack for each.  The
+   signal mask of the calling thread is the one the children start with,
+   so the stages may be spawned by threads that block all signals.  */
+int
+__spawni_pipeline_init (struct __spawn_pipeline **plp, pid_t *pids,
+			int *pidfds, const struct posix_spawn_stage *stages,
+			size_t nstages, const posix_spawnattr_t *attrp,
+			char *const envp[], int xflags)
+{
+  ptrdiff_t maxargc = 0;
+  int ec;
+
+  if (nstages == 0)
+    return EINVAL;
+
+  for (size_t i = 0; i < nstages; i++)
+    {
+      ptrdiff_t argc;
+      ec = __spawni_count_args (stages[i].argv, &argc);
+      if (ec != 0)
+	return ec;
+      if (argc > maxargc)
+	maxargc = argc;
+    }
+
+  struct __spawn_pipeline *pl = calloc (1, sizeof (*pl));
+  if (pl == NULL)
+    return errno;
+  pl->pipes = malloc ((nstages - 1) * 2 * sizeof (int) + 1);
+  pl->errors = calloc (nstages, sizeof (int));
+  if (pl->pipes == NULL || pl->errors == NULL)
+    {
+      __spawni_pipeline_free (pl);
+      return ENOMEM;
+    }
+
+  pl->stacks = __spawni_alloc_stack (maxargc, nstages, &pl->stack_size, 0);
+  if (__glibc_unlikely (pl->stacks == MAP_FAILED))
+    {
+      ec = errno;
+      __spawni_pipeline_free (pl);
+      return ec;
+    }
+
+  for (size_t i = 0; i + 1 < nstages; i++)
+    if (pipe2 (&pl->pipes[2 * i], O_CLOEXEC) != 0)
+      {
+	ec = errno;
+	while (i-- > 0)
+	  {
+	    __close_nocancel (pl->pipes[2 * i]);
+	    __close_nocancel (pl->pipes[2 * i + 1]);
+	  }
+	__munmap (pl->stacks, pl->stack_size * nstages);
+	__spawni_pipeline_free (pl);
+	return ec;
+      }
+
+  for (size_t i = 0; i < nstages; i++)
+    {
+      pids[i] = -1;
+      if (pidfds != NULL)
+	pidfds[i] = -1;
+    }
+
+  pl->pids = pids;
+  pl->pidfds = pidfds;
+  pl->stages = stages;
+  pl->nstages = nstages;
+  pl->envp = envp;
+  pl->xflags = xflags;
+
+  if (attrp != NULL)
+    pl->leader_attr = *attrp;
+  pl->follower_attr = pl->leader_attr;
+  pl->follower_attr.__flags &= ~POSIX_SPAWN_TCSETPGROUP;
+  pl->sync_pgrp = ((pl->leader_attr.__flags & POSIX_SPAWN_SETPGROUP) != 0
+		   && pl->leader_attr.__pgrp == 0);
+  pl->pgrp.state = PGRP_PENDING;
+  pl->pgrp.failed_leader = -1;
+
+  /* Stages that are known to fail are not spawned, so they cannot lead.  */
+  pl->leader = 0;
+  while (pl->leader < nstages && stages[pl->leader].error != 0)
+    pl->leader++;
+
+  __sigprocmask (SIG_BLOCK, NULL, &pl->mask);
+  __spawni_sigreset_set (&pl->leader_attr, &pl->sigreset, true);
+
+  *plp = pl;
+  return 0;
+}
+
+/* Spawn stage I of PL.  May be called concurrently for different stages;
+   stages that join the first stage's process group wait for it to be
+   created, so the first stage must not be queued behind later ones.  */
+int
+__spawni_pipeline_stage (struct __spawn_pipeline *pl, size_t i)
+{
+  const struct posix_spawn_stage *stage = &pl->stages[i];
+  struct posix_spawn_args args;
+  sigset_t thread_mask;
+  int ec = stage->error;
+
+  if (ec == 0)
+    {
+      /* Disable asynchronous cancellation.  */
+      int state;
+      __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+
+      args.file = stage->file ? stage->file : stage->argv[0];
+      args.exec = pl->xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex : __execve;
+      args.fa = stage->file_actions;
+      args.attr = i == pl->leader ? &pl->leader_attr : &pl->follower_attr;
+      args.argv = stage->argv;
+      __spawni_count_args (stage->argv, &args.argc);
+      args.envp = pl->envp;
+      args.xflags = pl->xflags;
+      args.pipe_in = i > 0 ? pl->pipes[2 * (i - 1)] : -1;
+      args.pipe_out = i + 1 < pl->nstages ? pl->pipes[2 * i + 1] : -1;
+      args.sigreset = &pl->sigreset;
+      args.pgrp_sync = pl->sync_pgrp ? &pl->pgrp : NULL;
+      args.pgrp_leader = i == pl->leader;
+
+      __libc_signal_block_all (&thread_mask);
+      args.oldmask = pl->mask;
+
+      ec = __spawni_clone (&pl->pids[i],
+			   pl->pidfds ? &pl->pidfds[i] : NULL, &args,
+			   (char *) pl->stacks + i * pl->stack_size,
+			   pl->stack_size);
+
+      __libc_signal_restore_set (&thread_mask);
+
+      __pthread_setcancelstate (state, NULL);
+    }
+
+  pl->errors[i] = ec;
+  return ec;
+}
+
+/* Release PL once all of its stages have been spawned, and return the
+   error of the first stage that failed, if any.  */
+int
+__spawni_pipeline_finish (struct __spawn_pipeline *pl)
+{
+  int ec = 0;
+
+  for (size_t i = 0; i + 1 < pl->nstages; i++)
+    {
+      __close_nocancel (pl->pipes[2 * i]);
+      __close_nocancel (pl->pipes[2 * i + 1]);
+    }
+  __munmap (pl->stacks, pl->stack_size * pl->nstages);
+
+  if (pl->pgrp.failed_leader != -1)
+    __waitpid (pl->pgrp.failed_leader, NULL, 0);
+
+  for (size_t i = 0; i < pl->nstages && ec == 0; i++)
+    ec = pl->errors[i];
+
+  __spawni_pipeline_free (pl);
+  return ec;
+}
@@ -0,0 +1,187 @@
+/*
+ * Admission control for background jobs.
+ *
+ * A background job is only started while the number of running
+ * background jobs and of their processes is below the limits, a token
+ * is left in the bucket that limits the spawn rate, and the system is
+ * not under pressure: Linux's pressure stall information (PSI) tells
+ * the share of the last 10 seconds in which some task waited for a CPU
+ * or for memory.  Jobs that cannot start yet are queued by the shell and
+ * admitted later, in order.  By default, only the number of processes is
+ * limited, to half of RLIMIT_NPROC, and jobs wait out heavy memory
+ * pressure.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "admission.h"
+#include "usage.h"
+
+/* Time to wait before checking the pressure again; PSI's averages
+ * are updated every 2 seconds */
+#define PRESSURE_RETRY_MS 500
+
+/* Time to wait for processes to exit before checking the caps again */
+#define CAP_RETRY_MS 1000
+
+/* Longest wait between retries of a spawn that failed with EAGAIN */
+#define MAX_BACKOFF_MS 1000
+#define SPAWN_RETRIES 8
+
+static struct admission_limits limits;
+
+static int running_jobs;        /* Admitted jobs that have not ended */
+static int running_processes;   /* Their processes that have not exited */
+static double tokens;           /* Tokens in the bucket */
+static double last_refill;      /* usage_now() when they were counted */
+
+void
+admission_init(void)
+{
+    memset(&limits, 0, sizeof limits);
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NPROC, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        limits.max_processes = rl.rlim_cur / 2;
+    limits.memory_pressure = 40;
+    last_refill = usage_now();
+}
+
+/* Return the "some avg10" percentage of a PSI file, or 0 if the
+ * kernel does not provide it */
+static double
+read_pressure(const char *path)
+{
+    FILE *f = fopen(path, "re");
+    double avg10 = 0;
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+        avg10 = 0;
+    fclose(f);
+    return avg10;
+}
+
+static void
+refill_tokens(void)
+{
+    double now = usage_now();
+    tokens += (now - last_refill) * limits.rate;
+    if (tokens > limits.burst)
+        tokens = limits.burst;
+    last_refill = now;
+}
+
+bool
+admission_admit(int num_processes, int *retry_ms)
+{
+    /* a job larger than the process limit is let through when it would
+     * be the only one, since it could never start otherwise */
+    if ((limits.max_jobs > 0 && running_jobs >= limits.max_jobs)
+        || (limits.max_processes > 0 && running_jobs > 0
+            && running_processes + num_processes > limits.max_processes)) {
+        *retry_ms = CAP_RETRY_MS;
+        return false;
+    }
+    if ((limits.cpu_pressure > 0 && read_pressure("/proc/pressure/cpu") >= limits.cpu_pressure)
+        || (limits.memory_pressure > 0 && read_pressure("/proc/pressure/memory") >= limits.memory_pressure)) {
+        *retry_ms = PRESSURE_RETRY_MS;
+        return false;
+    }
+    if (limits.rate > 0) {
+        refill_tokens();
+        if (tokens < 1) {
+            *retry_ms = (1 - tokens) / limits.rate * 1000 + 1;
+            return false;
+        }
+        tokens--;
+    }
+    return true;
+}
+
+void
+admission_job_started(int num_processes)
+{
+    running_jobs++;
+    running_processes += num_processes;
+}
+
+void
+admission_process_exited(bool job_ended)
+{
+    running_processes--;
+    if (job_ended)
+        running_jobs--;
+}
+
+int
+admission_backoff_ms(int attempt)
+{
+    if (attempt >= SPAWN_RETRIES)
+        return -1;
+    int ms = 10 << attempt;
+    return ms < MAX_BACKOFF_MS ? ms : MAX_BACKOFF_MS;
+}
+
+void
+admission_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        printf("jobs=%d procs=%d rate=%g burst=%g cpu=%g memory=%g\n",
+               limits.max_jobs, limits.max_processes, limits.rate, limits.burst,
+               limits.cpu_pressure, limits.memory_pressure);
+        printf("running: %d jobs, %d processes; pressure: cpu %.2f, memory %.2f\n",
+               running_jobs, running_processes,
+               read_pressure("/proc/pressure/cpu"), read_pressure("/proc/pressure/memory"));
+        return;
+    }
+
+    struct admission_limits new_limits = limits;
+    bool burst_set = false;
+    for (int k = 1; argv[k] != NULL; k++) {
+        char *value = strchr(argv[k], '=');
+        char *end = NULL;
+        double v = value != NULL ? strtod(value + 1, &end) : -1;
+        if (value == NULL || *end != '\0' || end == value + 1 || v < 0) {
+            printf("admission: %s: expected name=value\n", argv[k]);
+            return;
+        }
+        *value = '\0';
+        if (strcmp(argv[k], "jobs") == 0) {
+            new_limits.max_jobs = v;
+        } else if (strcmp(argv[k], "procs") == 0) {
+            new_limits.max_processes = v;
+        } else if (strcmp(argv[k], "rate") == 0) {
+            new_limits.rate = v;
+        } else if (strcmp(argv[k], "burst") == 0) {
+            new_limits.burst = v;
+            burst_set = true;
+        } else if (strcmp(argv[k], "cpu") == 0) {
+            new_limits.cpu_pressure = v;
+        } else if (strcmp(argv[k], "memory") == 0) {
+            new_limits.memory_pressure = v;
+        } else {
+            printf("admission: unknown limit %s\n", argv[k]);
+            *value = '=';
+            return;
+        }
+        *value = '=';
+    }
+    /* the bucket must hold at least one token */
+    if (!burst_set && new_limits.burst < new_limits.rate)
+        new_limits.burst = new_limits.rate;
+    if (new_limits.burst < 1)
+        new_limits.burst = 1;
+
+    /* a bucket that starts limiting starts full */
+    if (limits.rate == 0)
+        tokens = new_limits.burst;
+    else
+        refill_tokens();
+    limits = new_limits;
+    if (tokens > limits.burst)
+        tokens = limits.burst;
+    last_refill = usage_now();
+}
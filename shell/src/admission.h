@@ -0,0 +1,44 @@
+#ifndef __ADMISSION_H
+#define __ADMISSION_H
+
+#include <stdbool.h>
+
+/* The limits on starting background jobs; 0 means no limit */
+struct admission_limits {
+    int max_jobs;           /* Background jobs running at the same time */
+    int max_processes;      /* Processes of those jobs */
+    double rate;            /* Background jobs started per second */
+    double burst;           /* Background jobs that may be started at once
+                               after a quiet period */
+    double cpu_pressure;    /* Defer while "some avg10" in /proc/pressure/cpu
+                               is at least this percentage */
+    double memory_pressure; /* Likewise for /proc/pressure/memory */
+};
+
+/* Set the default limits. */
+void admission_init(void);
+
+/*
+ * Return true if a background job of 'num_processes' processes may be
+ * started now, and if so, take a token from the bucket.  Otherwise set
+ * *retry_ms to how long to wait before asking again; processes exiting
+ * may make room earlier.
+ */
+bool admission_admit(int num_processes, int *retry_ms);
+
+/* Count an admitted job that started with 'num_processes' processes. */
+void admission_job_started(int num_processes);
+
+/* Count the exit of a process of an admitted job, which has ended if
+ * 'job_ended' is set. */
+void admission_process_exited(bool job_ended);
+
+/* How long to wait before the 'attempt'th retry of a spawn that failed
+ * with EAGAIN.  Returns -1 once it should no longer be retried. */
+int admission_backoff_ms(int attempt);
+
+/* The admission builtin: without arguments, print the limits and the
+ * current load, otherwise set limits, e.g. "admission jobs=4 cpu=90". */
+void admission_builtin(char **argv);
+
+#endif /* __ADMISSION_H */
@@ -0,0 +1,56 @@
+#!/usr/bin/python
+#
+# Tests the admission builtin, which limits the background jobs that run
+#
+
+import proc_check
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# with one background job at a time, the second one is queued
+sendline("admission jobs=1")
+expect_prompt()
+sendline("sleep 1 &")
+expect("\[1\] [0-9]+")
+expect_prompt()
+sendline("sleep 1 &")
+expect_exact("[2] Queued")
+expect_prompt()
+sendline("jobs")
+expect_exact("Queued\t\t(sleep 1)")
+expect_prompt()
+
+# it starts once the first one has ended
+sendline("wait")
+expect_exact("[1]\tDone\t\t(sleep 1)")
+expect("\[2\] [0-9]+")
+expect_exact("[2]\tDone\t\t(sleep 1)")
+expect_prompt()
+
+# a queued job can be taken off the queue
+sendline("sleep 1 &")
+expect_prompt()
+sendline("sleep 1 &")
+expect_exact("[2] Queued")
+expect_prompt()
+sendline("kill 2")
+expect_prompt()
+sendline("wait")
+expect_exact("[1]\tDone\t\t(sleep 1)")
+expect_prompt()
+sendline("jobs")
+expect_prompt()
+assert "sleep" not in console.before, "Shell printed a job that was taken off the queue"
+
+sendline("admission jobs=x")
+expect_exact("admission: jobs=x: expected name=value")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
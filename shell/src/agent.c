@@ -0,0 +1,431 @@
+/*
+ * Executor agents.
+ *
+ * Each agent is a command the shell starts with one end of a socketpair
+ * as its stdin and stdout; the other end is watched by the event loop.
+ * A job sent to an agent is a job like any other, except that its
+ * processes are remote: they are added to the job without a pid the
+ * shell could wait for, and the agent reports how they stop and exit.
+ * Jobs are placed on the agent with the most free slots.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "../posix_spawn/spawn.h"
+
+#include "agent.h"
+#include "jobs.h"
+#include "list.h"
+#include "event_loop.h"
+
+struct agent {
+    struct list_elem elem;  /* Link element for agents */
+    int id;
+    char *name;
+    char *host;             /* As it announced itself, or NULL until then */
+    int fd;                 /* The shell's end of the socket, or -1 */
+    pid_t pid;              /* The process started for it, or 0 once reaped */
+    int slots;              /* Jobs it runs at a time, 0 until announced */
+    int running;            /* Jobs placed on it that have not ended */
+    bool removed;           /* Hung up on by "agent remove" */
+    long next_task_id;
+    char *in;               /* Received, not yet handled */
+    size_t in_len, in_cap;
+    struct list tasks;
+};
+
+struct agent_task {
+    struct list_elem elem;  /* Link element for its agent's tasks */
+    struct agent *agent;    /* NULL once the agent has gone */
+    char *name;             /* The agent's name */
+    long id;
+    struct job *job;
+};
+
+static const struct agent_ops *ops;
+static struct list agents;
+static int next_agent_id = 1;
+
+void
+agent_init(const struct agent_ops *agent_ops)
+{
+    ops = agent_ops;
+    list_init(&agents);
+}
+
+static struct agent *
+find_agent(int id)
+{
+    for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+        struct agent *a = list_entry(e, struct agent, elem);
+        if (a->id == id)
+            return a;
+    }
+    return NULL;
+}
+
+/* Whether jobs can be placed on 'a' */
+static bool
+usable(struct agent *a)
+{
+    return a->fd != -1 && !a->removed;
+}
+
+/* The agent with the most free slots, or NULL if none is free */
+static struct agent *
+choose_agent(void)
+{
+    struct agent *best = NULL;
+    for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+        struct agent *a = list_entry(e, struct agent, elem);
+        if (usable(a) && a->running < a->slots
+            && (best == NULL || a->slots - a->running > best->slots - best->running))
+            best = a;
+    }
+    return best;
+}
+
+bool
+agent_parse(const char *name, int *agent)
+{
+    if (strcmp(name, "any") == 0) {
+        *agent = AGENT_ANY;
+        return true;
+    }
+    for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+        struct agent *a = list_entry(e, struct agent, elem);
+        if (usable(a) && strcmp(a->name, name) == 0) {
+            *agent = a->id;
+            return true;
+        }
+    }
+    printf("on: %s: no such agent\n", name);
+    return false;
+}
+
+bool
+agent_can_start(int agent)
+{
+    if (agent == AGENT_ANY)
+        return choose_agent() != NULL;
+    struct agent *a = find_agent(agent);
+    return a == NULL || !usable(a) || a->running < a->slots;
+}
+
+static bool
+send_all(struct agent *a, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(a->fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+int
+agent_start(struct job *job, struct ast_pipeline *pipe, int agent)
+{
+    struct agent *a = agent == AGENT_ANY ? choose_agent() : find_agent(agent);
+    if (a == NULL || !usable(a))
+        return ENXIO;
+
+    char *payload;
+    size_t len;
+    FILE *out = open_memstream(&payload, &len);
+    fprintf(out, "%s%c%s%c%d%c%zu%c", pipe->iored_input ? pipe->iored_input : "", 0,
+            pipe->iored_output ? pipe->iored_output : "", 0, pipe->append_to_output, 0,
+            list_size(&pipe->commands), 0);
+    for (struct list_elem *e = list_begin(&pipe->commands); e != list_end(&pipe->commands); e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        int words = 0;
+        while (cmd->argv[words] != NULL)
+            words++;
+        fprintf(out, "%d%c%d%c", words, 0, cmd->dup_stderr_to_stdout, 0);
+        for (int w = 0; w < words; w++)
+            fprintf(out, "%s%c", cmd->argv[w], 0);
+    }
+    fclose(out);
+
+    long id = ++a->next_task_id;
+    char header[64];
+    int header_len = snprintf(header, sizeof header, "run %ld %zu\n", id, len);
+    bool sent = send_all(a, header, header_len) && send_all(a, payload, len);
+    free(payload);
+    if (!sent)
+        return errno;
+
+    struct agent_task *task = calloc(1, sizeof *task);
+    task->agent = a;
+    task->name = strdup(a->name);
+    task->id = id;
+    task->job = job;
+    list_push_back(&a->tasks, &task->elem);
+    job->remote = task;
+    a->running++;
+    for (int k = 0; k < (int) list_size(&pipe->commands); k++)
+        job_add_remote_process(job, k);
+    return 0;
+}
+
+int
+agent_signal(struct agent_task *task, int sig)
+{
+    if (task->agent == NULL || task->agent->fd == -1)
+        return -1;
+    char message[64];
+    int len = snprintf(message, sizeof message, "signal %ld %s\n", task->id, sigabbrev_np(sig));
+    return send_all(task->agent, message, len) ? 0 : -1;
+}
+
+const char *
+agent_task_name(struct agent_task *task)
+{
+    return task->name;
+}
+
+void
+agent_task_free(struct agent_task *task)
+{
+    if (task->agent != NULL)
+        list_remove(&task->elem);
+    free(task->name);
+    free(task);
+}
+
+static struct agent_task *
+find_task(struct agent *a, long id)
+{
+    for (struct list_elem *e = list_begin(&a->tasks); e != list_end(&a->tasks); e = list_next(e)) {
+        struct agent_task *task = list_entry(e, struct agent_task, elem);
+        if (task->id == id)
+            return task;
+    }
+    return NULL;
+}
+
+/* Record the status of a remote process; when it was the last of its
+ * job's, the job no longer takes up a slot */
+static void
+process_changed(struct agent_task *task, struct job_process *proc, int status)
+{
+    if (!proc->alive)
+        return;
+    struct agent *a = task->agent;
+    ops->process_changed(proc, status);
+    if (task->job->num_processes_alive == 0) {
+        list_remove(&task->elem);
+        task->agent = NULL;
+        a->running--;
+        ops->slot_freed();
+    }
+}
+
+static void
+free_agent(struct agent *a)
+{
+    list_remove(&a->elem);
+    free(a->name);
+    free(a->host);
+    free(a->in);
+    free(a);
+}
+
+/* The agent has hung up: its jobs are lost, as if they had been hung up
+ * on themselves */
+static void
+agent_lost(struct agent *a)
+{
+    event_loop_remove(a->fd);
+    close(a->fd);
+    a->fd = -1;
+    while (!list_empty(&a->tasks)) {
+        struct agent_task *task = list_entry(list_front(&a->tasks), struct agent_task, elem);
+        for (int k = 0; k < task->job->num_processes; k++)
+            process_changed(task, &task->job->processes[k], SIGHUP);
+    }
+    if (a->pid == 0)
+        free_agent(a);
+}
+
+/* Handle one message at the start of a->in; returns its length, or 0 if
+ * it has not been received completely */
+static size_t
+handle_message(struct agent *a)
+{
+    char *newline = memchr(a->in, '\n', a->in_len);
+    if (newline == NULL)
+        return 0;
+    *newline = '\0';
+    size_t len = newline + 1 - a->in;
+
+    long id;
+    int stage, value, slots;
+    size_t n;
+    char host[256];
+    struct agent_task *task;
+    int fields = sscanf(a->in, "hello %d %255s", &slots, host);
+    if (fields >= 1 && a->slots == 0 && slots > 0) {
+        a->slots = slots;
+        a->host = strdup(fields == 2 ? host : "");
+        ops->slot_freed();
+    } else if (sscanf(a->in, "started %ld %d %d", &id, &stage, &value) == 3) {
+        task = find_task(a, id);
+        if (task != NULL && stage >= 0 && stage < task->job->num_processes)
+            task->job->processes[stage].pid = value;
+    } else if (sscanf(a->in, "status %ld %d %d", &id, &stage, &value) == 3) {
+        task = find_task(a, id);
+        if (task != NULL && stage >= 0 && stage < task->job->num_processes)
+            process_changed(task, &task->job->processes[stage], value);
+    } else if (sscanf(a->in, "out %ld %zu", &id, &n) == 2 || sscanf(a->in, "err %ld %zu", &id, &n) == 2) {
+        if (a->in_len - len < n) {
+            *newline = '\n';
+            return 0;
+        }
+        task = find_task(a, id);
+        if (task != NULL)
+            ops->output(task->job, a->in[0] == 'o' ? 1 : 2, a->in + len, n);
+        len += n;
+    } else {
+        fprintf(stderr, "agent %s: unknown message: %s\n", a->name, a->in);
+    }
+    return len;
+}
+
+static void
+agent_ready(int fd, void *arg)
+{
+    struct agent *a = arg;
+    if (a->in_cap - a->in_len < 65536) {
+        a->in_cap = a->in_cap ? 2 * a->in_cap : 65536;
+        a->in = realloc(a->in, a->in_cap);
+    }
+    ssize_t got = read(fd, a->in + a->in_len, a->in_cap - a->in_len);
+    if (got == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (got <= 0) {
+        agent_lost(a);
+        return;
+    }
+    a->in_len += got;
+    size_t len;
+    while ((len = handle_message(a)) > 0) {
+        memmove(a->in, a->in + len, a->in_len - len);
+        a->in_len -= len;
+    }
+}
+
+bool
+agent_child_changed(int pid, int status)
+{
+    for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+        struct agent *a = list_entry(e, struct agent, elem);
+        if (a->pid != pid)
+            continue;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            a->pid = 0;
+            if (a->fd == -1)
+                free_agent(a);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Start 'argv' as agent 'name' */
+static void
+add_agent(const char *name, char **argv)
+{
+    for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+        if (strcmp(list_entry(e, struct agent, elem)->name, name) == 0) {
+            printf("agent: %s already exists\n", name);
+            return;
+        }
+    }
+    if (strcmp(name, "any") == 0) {
+        printf("agent: any is not a name for an agent\n");
+        return;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        printf("agent: socketpair: %s\n", strerror(errno));
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    /* in a process group of its own, so Ctrl-C does not reach it */
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+
+    extern char **environ;
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(sv[1]);
+    if (error != 0) {
+        printf("agent: %s: %s\n", argv[0], strerror(error));
+        close(sv[0]);
+        return;
+    }
+
+    struct agent *a = calloc(1, sizeof *a);
+    a->id = next_agent_id++;
+    a->name = strdup(name);
+    a->fd = sv[0];
+    a->pid = pid;
+    list_init(&a->tasks);
+    list_push_back(&agents, &a->elem);
+    event_loop_add(a->fd, agent_ready, a);
+}
+
+void
+agent_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+            struct agent *a = list_entry(e, struct agent, elem);
+            if (a->fd == -1)
+                printf("%s\t(gone)\n", a->name);
+            else if (a->slots == 0)
+                printf("%s\t(starting)\n", a->name);
+            else
+                printf("%s\t%s\t%d of %d slots busy%s\n", a->name, a->host, a->running, a->slots,
+                       a->removed ? " (removed)" : "");
+        }
+    } else if (strcmp(argv[1], "add") == 0 && argv[2] != NULL && argv[3] != NULL) {
+        add_agent(argv[2], argv + 3);
+    } else if (strcmp(argv[1], "remove") == 0 && argv[2] != NULL) {
+        for (struct list_elem *e = list_begin(&agents); e != list_end(&agents); e = list_next(e)) {
+            struct agent *a = list_entry(e, struct agent, elem);
+            if (strcmp(a->name, argv[2]) == 0 && usable(a)) {
+                /* it terminates its jobs and reports how they ended */
+                a->removed = true;
+                shutdown(a->fd, SHUT_WR);
+                return;
+            }
+        }
+        printf("agent: %s: no such agent\n", argv[2]);
+    } else {
+        printf("usage: agent [add name command... | remove name]\n");
+    }
+}
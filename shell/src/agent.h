@@ -0,0 +1,87 @@
+#ifndef __AGENT_H
+#define __AGENT_H
+
+/*
+ * Executor agents: processes that run jobs for the shell, on this host or
+ * on others, such as cush-agent.
+ *
+ * The shell talks to an agent over a byte stream, the stdin and stdout of
+ * the command it starts for the agent, which are a socket.  Messages are
+ * lines, some followed by a payload of the given length.  The shell sends
+ *   run <id> <n>           followed by n bytes of NUL-terminated strings:
+ *                          input, output (empty if not redirected),
+ *                          append (0 or 1), the number of stages, then
+ *                          for each stage its number of words, whether
+ *                          its stderr goes to stdout (0 or 1), and its words
+ *   signal <id> <NAME>     send a signal, e.g. TERM, to job id's processes
+ * and the agent sends
+ *   hello <slots> <host>   once, with the number of jobs it runs at a time
+ *   started <id> <stage> <pid>
+ *   out <id> <n>           followed by n bytes the job wrote to stdout
+ *   err <id> <n>           followed by n bytes the job wrote to stderr
+ *   status <id> <stage> <status>   waitpid() status of a stage that
+ *                          stopped or, after the last of the job's
+ *                          output, exited
+ * Job ids are chosen by the shell and unique per agent.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct job;
+struct job_process;
+struct ast_pipeline;
+struct agent_task;
+
+/* Run a job on the agent with the most free slots */
+#define AGENT_ANY (-1)
+
+/* How an agent's news reaches the shell */
+struct agent_ops {
+    /* A remote process stopped or exited with waitpid() status 'status' */
+    void (*process_changed)(struct job_process *proc, int status);
+    /* A remote job wrote to its stdout (fd 1) or stderr (fd 2) */
+    void (*output)(struct job *job, int fd, const char *data, size_t len);
+    /* An agent has announced itself or finished a job, so there may be
+     * a free slot for a job waiting for one */
+    void (*slot_freed)(void);
+};
+
+void agent_init(const struct agent_ops *ops);
+
+/* Set *agent to the agent called 'name', or AGENT_ANY for "any".
+ * Returns false after printing an error if there is none. */
+bool agent_parse(const char *name, int *agent);
+
+/* Whether 'agent' (or any, for AGENT_ANY) has a free slot.  An agent
+ * that has gone counts as free, so the job fails to start. */
+bool agent_can_start(int agent);
+
+/* Send a job's pipeline to 'agent' and add its stages to the job as
+ * remote processes.  Returns 0, or an error if the agent has gone. */
+int agent_start(struct job *job, struct ast_pipeline *pipe, int agent);
+
+/* Send a signal to the processes of a remote job.  Returns 0 on
+ * success, -1 if its agent has gone. */
+int agent_signal(struct agent_task *task, int sig);
+
+/* The name of the agent a remote job runs on */
+const char *agent_task_name(struct agent_task *task);
+
+/* Forget a remote job that is deleted. */
+void agent_task_free(struct agent_task *task);
+
+/* If 'pid' is the process the shell started for an agent, note that its
+ * status changed and return true. */
+bool agent_child_changed(int pid, int status);
+
+/*
+ * The agent builtin:
+ *   agent                      list the agents
+ *   agent add name command...  start command, which speaks the agent
+ *                              protocol on its stdin and stdout
+ *   agent remove name          hang up on an agent; its jobs are terminated
+ */
+void agent_builtin(char **argv);
+
+#endif /* __AGENT_H */
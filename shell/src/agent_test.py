@@ -0,0 +1,83 @@
+#!/usr/bin/python
+#
+# Tests the agent builtin and the 'on' prefix, which run jobs on executor
+# agents such as cush-agent
+#
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# an agent on this host that runs one job at a time
+sendline("agent add here ./cush-agent -n 1")
+expect_prompt()
+sendline("agent")
+expect("here\t\S+\t0 of 1 slots busy")
+expect_prompt()
+
+# a remote job runs in the background; its output is relayed
+sendline("on here echo hello from the agent")
+expect_exact("[1] on here")
+expect_exact("hello from the agent")
+expect_exact("[1]\tDone\t\t(echo hello from the agent)")
+
+# so are its pipelines, its stderr and its exit status
+sendline("on any echo out | tr a-z A-Z")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] on here")
+expect_exact("OUT")
+expect_exact("[%s]\tDone" % jid)
+sendline("on any sh -c \"echo err >&2; exit 3\"")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] on here")
+expect_exact("err")
+expect_exact("[%s]\tExit 3" % jid)
+expect_prompt()
+
+# while it runs, it is listed with its agent, and another job waits
+sendline("on here sleep 10")
+(sleeper,) = parse_regular_expression(console, "\[([0-9]+)\] on here")
+expect_prompt()
+sendline("on here echo second")
+(queued,) = parse_regular_expression(console, "\[([0-9]+)\] Queued")
+expect_prompt()
+sendline("jobs")
+expect_exact("[%s]\tRunning\t\t(sleep 10) on here" % sleeper)
+expect_exact("[%s]\tQueued\t\t(echo second)" % queued)
+expect_prompt()
+
+# it is stopped, continued and killed through its agent
+sendline("stop " + sleeper)
+expect_prompt()
+sendline("jobs")
+expect_exact("[%s]\tStopped\t\t(sleep 10) on here" % sleeper)
+expect_prompt()
+sendline("bg " + sleeper)
+expect_prompt()
+sendline("fg " + sleeper)
+expect_exact("fg: job %s runs on an agent" % sleeper)
+expect_prompt()
+sendline("kill " + sleeper)
+expect_exact("[%s]\tTerminated\t\t(sleep 10)" % sleeper)
+expect_exact("second")
+expect_exact("[%s]\tDone\t\t(echo second)" % queued)
+
+# errors
+sendline("on nowhere true")
+expect_exact("on: nowhere: no such agent")
+expect_prompt()
+sendline("on here jobs")
+expect_exact("on: jobs: built-in commands run in the shell")
+expect_prompt()
+
+# the jobs of a removed agent are terminated
+sendline("on here sleep 10")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] on here")
+expect_prompt()
+sendline("agent remove here")
+expect_exact("[%s]\tTerminated\t\t(sleep 10)" % jid)
+
+sendline("exit")
+expect_exact("exit")
+test_success()
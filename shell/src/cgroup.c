@@ -0,0 +1,454 @@
+/*
+ * Per-job cgroups.
+ *
+ * Once enabled, the shell creates a directory "cush-<pid>" in a cgroup v2
+ * subtree it may write to, and in it one cgroup per job, in which libspawn
+ * creates the job's processes directly (clone3 with CLONE_INTO_CGROUP).
+ * Unlike its process group, a process cannot leave its cgroup, so
+ * everything a job starts can be limited (cpu.max, memory.max, io.max),
+ * accounted for (cpu.stat, memory.peak), and killed at once with
+ * cgroup.kill, which is how a job's leftover processes are torn down
+ * when it is deleted.  The cpu, memory and io controllers are enabled
+ * as far as the kernel allows; without them, the limits cannot be set.
+ * Without a usable subtree, jobs run in the shell's own cgroup as before.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <mntent.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "cgroup.h"
+#include "jobs.h"
+
+enum { CPU_MAX, MEMORY_MAX, IO_MAX, NUM_LIMITS };
+static const char *const limit_names[NUM_LIMITS] = { "cpu", "memory", "io" };
+static const char *const limit_files[NUM_LIMITS] = { "cpu.max", "memory.max", "io.max" };
+
+/* Period of cpu.max, in microseconds */
+#define CPU_PERIOD 100000
+
+struct job_cgroup {
+    int fd;             /* Its directory */
+    char name[32];      /* Its name in jobs_path */
+};
+
+static char *jobs_path;     /* Directory of the jobs' cgroups, or NULL */
+static int jobs_fd = -1;
+static bool enabled;        /* New jobs get a cgroup */
+static unsigned long next_id;
+static char *limits[NUM_LIMITS];    /* Contents of the limit files of new
+                                       jobs' cgroups, or NULL */
+
+/* Job cgroups that could not be removed yet because their killed
+ * processes had not been reaped */
+static char **pending;
+static int num_pending;
+
+/* Write 'text' to 'file' in the cgroup directory 'dirfd' */
+static bool
+write_file(int dirfd, const char *file, const char *text)
+{
+    int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool ok = write(fd, text, strlen(text)) == (ssize_t) strlen(text);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return ok;
+}
+
+static FILE *
+open_file(int dirfd, const char *file)
+{
+    int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+    FILE *f = fd != -1 ? fdopen(fd, "r") : NULL;
+    if (f == NULL && fd != -1)
+        close(fd);
+    return f;
+}
+
+/* The directory of the shell's own cgroup, from /proc/self/cgroup and
+ * the mount point of the cgroup2 file system */
+static char *
+own_cgroup_path(void)
+{
+    char *mount = NULL, *group = NULL, *path = NULL;
+    FILE *f = setmntent("/proc/self/mounts", "re");
+    struct mntent *m;
+    while (f != NULL && (m = getmntent(f)) != NULL) {
+        if (strcmp(m->mnt_type, "cgroup2") == 0) {
+            mount = strdup(m->mnt_dir);
+            break;
+        }
+    }
+    if (f != NULL)
+        endmntent(f);
+
+    f = fopen("/proc/self/cgroup", "re");
+    char *line = NULL;
+    size_t cap = 0;
+    while (f != NULL && getline(&line, &cap, f) != -1) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            group = strdup(line + 3);
+            break;
+        }
+    }
+    free(line);
+    if (f != NULL)
+        fclose(f);
+
+    if (mount != NULL && group != NULL && asprintf(&path, "%s%s", mount, group) == -1)
+        path = NULL;
+    free(mount);
+    free(group);
+    return path;
+}
+
+/* Remove the cgroups of the deleted jobs whose processes are gone now */
+static void
+remove_pending(void)
+{
+    for (int i = 0; i < num_pending; ) {
+        if (unlinkat(jobs_fd, pending[i], AT_REMOVEDIR) == 0 || errno == ENOENT) {
+            free(pending[i]);
+            pending[i] = pending[--num_pending];
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Remove the job cgroups in 'dirfd' that no process runs in; the others
+ * are left alone, as are their jobs */
+static void
+remove_empty_groups(int dirfd)
+{
+    DIR *dir = fdopendir(dup(dirfd));
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+        if (strncmp(entry->d_name, "job", 3) == 0)
+            unlinkat(dirfd, entry->d_name, AT_REMOVEDIR);
+    if (dir != NULL)
+        closedir(dir);
+}
+
+static void
+remove_jobs_dir(void)
+{
+    remove_empty_groups(jobs_fd);
+    rmdir(jobs_path);
+}
+
+/* Remove what shells that were killed before they could clean up left
+ * behind in 'base' */
+static void
+remove_stale_dirs(int base_fd)
+{
+    DIR *dir = fdopendir(dup(base_fd));
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        int pid;
+        if (sscanf(entry->d_name, "cush-%d", &pid) != 1 || kill(pid, 0) == 0 || errno != ESRCH)
+            continue;
+        int fd = openat(base_fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1) {
+            remove_empty_groups(fd);
+            close(fd);
+        }
+        unlinkat(base_fd, entry->d_name, AT_REMOVEDIR);
+    }
+    if (dir != NULL)
+        closedir(dir);
+}
+
+/* Create the directory for the jobs' cgroups in 'base' */
+static bool
+enable_cgroups(const char *base)
+{
+    struct statfs fs;
+    if (statfs(base, &fs) != 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        printf("cgroup: %s is not a cgroup v2 directory\n", base);
+        return false;
+    }
+    char *path;
+    if (asprintf(&path, "%s/cush-%d", base, getpid()) == -1)
+        return false;
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        printf("cgroup: cannot create %s: %s\n", path, strerror(errno));
+        free(path);
+        return false;
+    }
+    jobs_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (jobs_fd == -1) {
+        printf("cgroup: cannot open %s: %s\n", path, strerror(errno));
+        rmdir(path);
+        free(path);
+        return false;
+    }
+    jobs_path = path;
+    atexit(remove_jobs_dir);
+
+    /* the controllers must be enabled all the way down; 'base' cannot
+     * enable them for its children if it has processes of its own,
+     * unless it is the root */
+    int base_fd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd != -1)
+        remove_stale_dirs(base_fd);
+    for (int i = 0; i < NUM_LIMITS; i++) {
+        char op[16];
+        snprintf(op, sizeof op, "+%s", limit_names[i]);
+        write_file(base_fd, "cgroup.subtree_control", op);
+        write_file(jobs_fd, "cgroup.subtree_control", op);
+    }
+    if (base_fd != -1)
+        close(base_fd);
+    return true;
+}
+
+void
+cgroup_init(void)
+{
+    const char *base = getenv("CUSH_CGROUP");
+    if (base != NULL)
+        enabled = enable_cgroups(base);
+}
+
+struct job_cgroup *
+cgroup_create(void)
+{
+    if (!enabled)
+        return NULL;
+    remove_pending();
+
+    struct job_cgroup *cg = malloc(sizeof *cg);
+    snprintf(cg->name, sizeof cg->name, "job%lu", next_id++);
+    if (mkdirat(jobs_fd, cg->name, 0755) != 0
+        || (cg->fd = openat(jobs_fd, cg->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        printf("cgroup: cannot create %s/%s: %s\n", jobs_path, cg->name, strerror(errno));
+        unlinkat(jobs_fd, cg->name, AT_REMOVEDIR);
+        free(cg);
+        return NULL;
+    }
+    for (int i = 0; i < NUM_LIMITS; i++)
+        if (limits[i] != NULL && !write_file(cg->fd, limit_files[i], limits[i]))
+            printf("cgroup: cannot set %s: %s\n", limit_files[i], strerror(errno));
+    return cg;
+}
+
+int
+cgroup_fd(struct job_cgroup *cg)
+{
+    return cg->fd;
+}
+
+int
+cgroup_signal(struct job_cgroup *cg, int sig)
+{
+    if (sig == SIGKILL)
+        return write_file(cg->fd, "cgroup.kill", "1") ? 0 : -1;
+
+    FILE *f = open_file(cg->fd, "cgroup.procs");
+    if (f == NULL)
+        return -1;
+    int rc = 0;
+    pid_t pid;
+    while (fscanf(f, "%d", &pid) == 1)
+        if (kill(pid, sig) != 0 && errno != ESRCH)
+            rc = -1;
+    fclose(f);
+    return rc;
+}
+
+bool
+cgroup_read_usage(struct job_cgroup *cg, struct usage *u)
+{
+    memset(u, 0, sizeof *u);
+    FILE *f = open_file(cg->fd, "cpu.stat");
+    if (f == NULL)
+        return false;
+    char key[64];
+    unsigned long long value;
+    while (fscanf(f, "%63s %llu", key, &value) == 2) {
+        if (strcmp(key, "user_usec") == 0)
+            u->utime = value / 1e6;
+        else if (strcmp(key, "system_usec") == 0)
+            u->stime = value / 1e6;
+    }
+    fclose(f);
+
+    f = open_file(cg->fd, "memory.peak");
+    if (f != NULL) {
+        if (fscanf(f, "%llu", &value) == 1)
+            u->rss_kb = value >> 10;
+        fclose(f);
+    }
+    return true;
+}
+
+bool
+cgroup_set_idle(struct job_cgroup *cg, bool idle)
+{
+    return write_file(cg->fd, "cpu.idle", idle ? "1" : "0");
+}
+
+void
+cgroup_destroy(struct job_cgroup *cg)
+{
+    /* processes the job left behind are killed with it */
+    FILE *f = open_file(cg->fd, "cgroup.events");
+    char key[64];
+    int value;
+    while (f != NULL && fscanf(f, "%63s %d", key, &value) == 2) {
+        if (strcmp(key, "populated") == 0 && value == 1)
+            write_file(cg->fd, "cgroup.kill", "1");
+    }
+    if (f != NULL)
+        fclose(f);
+
+    close(cg->fd);
+    if (unlinkat(jobs_fd, cg->name, AT_REMOVEDIR) != 0 && errno == EBUSY) {
+        pending = realloc(pending, (num_pending + 1) * sizeof *pending);
+        pending[num_pending++] = strdup(cg->name);
+    }
+    free(cg);
+}
+
+/* Parse a limit "name=value" of the cgroup builtin into the contents of
+ * its file, or NULL for "name=" */
+static bool
+parse_limit(char *arg, int *which, char **contents)
+{
+    char *value = strchr(arg, '=');
+    if (value == NULL)
+        return false;
+    *which = -1;
+    for (int i = 0; i < NUM_LIMITS; i++)
+        if (strncmp(arg, limit_names[i], value - arg) == 0 && limit_names[i][value - arg] == '\0')
+            *which = i;
+    value++;
+    *contents = NULL;
+    if (*which == -1)
+        return false;
+    if (*value == '\0')
+        return true;
+
+    char *end;
+    switch (*which) {
+    case CPU_MAX:
+        if (strcmp(value, "max") == 0)
+            return asprintf(contents, "max %d", CPU_PERIOD) != -1;
+        double percent = strtod(value, &end);
+        /* the kernel takes at least 1ms per period */
+        if (end == value || (*end != '\0' && strcmp(end, "%") != 0) || percent < 1)
+            return false;
+        return asprintf(contents, "%.0f %d", percent * CPU_PERIOD / 100, CPU_PERIOD) != -1;
+    case MEMORY_MAX:
+        if (strcmp(value, "max") == 0) {
+            *contents = strdup(value);
+            return true;
+        }
+        unsigned long long bytes = strtoull(value, &end, 10);
+        int shift = *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+        if (end == value || end[shift != 0] != '\0')
+            return false;
+        return asprintf(contents, "%llu", bytes << shift) != -1;
+    default:
+        /* "8:0,wbps=1048576" becomes "8:0 wbps=1048576" */
+        if (strchr(value, ':') == NULL)
+            return false;
+        *contents = strdup(value);
+        for (char *p = *contents; *p != '\0'; p++)
+            if (*p == ',')
+                *p = ' ';
+        return true;
+    }
+}
+
+static void
+print_state(void)
+{
+    if (jobs_path == NULL) {
+        printf("cgroup: off\n");
+        return;
+    }
+    printf("cgroup: %s, jobs run in %s\n", enabled ? "on" : "off", jobs_path);
+    FILE *f = open_file(jobs_fd, "cgroup.subtree_control");
+    char *line = NULL;
+    size_t cap = 0;
+    bool any = f != NULL && getline(&line, &cap, f) != -1 && line[0] != '\n';
+    printf("cgroup: controllers: %s", any ? line : "none\n");
+    free(line);
+    if (f != NULL)
+        fclose(f);
+    for (int i = 0; i < NUM_LIMITS; i++)
+        if (limits[i] != NULL)
+            printf("cgroup: %s %s\n", limit_files[i], limits[i]);
+}
+
+void
+cgroup_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        print_state();
+        return;
+    }
+    if (strcmp(argv[1], "on") == 0) {
+        if (jobs_path != NULL && argv[2] != NULL) {
+            printf("cgroup: jobs already run in %s\n", jobs_path);
+        } else if (jobs_path != NULL) {
+            enabled = true;
+        } else {
+            char *base = argv[2] != NULL ? strdup(argv[2]) : own_cgroup_path();
+            if (base == NULL)
+                printf("cgroup: cgroup v2 is not mounted\n");
+            else
+                enabled = enable_cgroups(base);
+            free(base);
+        }
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0) {
+        enabled = false;
+        return;
+    }
+
+    /* the limits of a running job, or of new jobs */
+    struct job *job = NULL;
+    int k = 1;
+    if (strspn(argv[1], "0123456789") == strlen(argv[1])) {
+        job = get_job_from_jid(atoi(argv[1]));
+        if (job == NULL || job->cgroup == NULL) {
+            printf("cgroup: %s: no such job in a cgroup\n", argv[1]);
+            return;
+        }
+        k = 2;
+    }
+    for (; argv[k] != NULL; k++) {
+        int which;
+        char *contents;
+        if (!parse_limit(argv[k], &which, &contents) || (job != NULL && contents == NULL)) {
+            printf("cgroup: %s: expected cpu=N%%, memory=SIZE[KMG] or io=MAJ:MIN,KEY=VALUE...\n", argv[k]);
+            free(contents);
+            return;
+        }
+        if (job != NULL) {
+            if (!write_file(cgroup_fd(job->cgroup), limit_files[which], contents))
+                printf("cgroup: cannot set %s: %s\n", limit_files[which], strerror(errno));
+            free(contents);
+        } else {
+            free(limits[which]);
+            limits[which] = contents;
+        }
+    }
+}
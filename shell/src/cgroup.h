@@ -0,0 +1,57 @@
+#ifndef __CGROUP_H
+#define __CGROUP_H
+
+#include <stdbool.h>
+#include "usage.h"
+
+/* The cgroup v2 group a job runs in */
+struct job_cgroup;
+
+/* Run jobs in cgroups under $CUSH_CGROUP, if it is set. */
+void cgroup_init(void);
+
+/*
+ * Create a cgroup for a new job, with the limits set by the cgroup
+ * builtin.  Returns NULL if jobs do not run in cgroups, or if it cannot
+ * be created; then the job runs in the shell's own cgroup, as before.
+ */
+struct job_cgroup *cgroup_create(void);
+
+/* The cgroup's directory, open for posix_spawnattr_setcgroup_np */
+int cgroup_fd(struct job_cgroup *cg);
+
+/*
+ * Send 'sig' to every process in the cgroup, including those the job's
+ * processes started themselves and that left its process group.
+ * SIGKILL is sent atomically through cgroup.kill.
+ * Returns 0 on success, -1 if a signal could not be sent.
+ */
+int cgroup_signal(struct job_cgroup *cg, int sig);
+
+/* Read the CPU time (cpu.stat) and peak memory (memory.peak, if the
+ * memory controller is enabled) of all processes that ran in the
+ * cgroup into 'u'.  Returns false if they cannot be read. */
+bool cgroup_read_usage(struct job_cgroup *cg, struct usage *u);
+
+/* Make the cgroup's processes run only when the CPU is otherwise idle
+ * (cpu.idle), or no longer.  Returns false if the kernel or the
+ * delegated controllers do not support it. */
+bool cgroup_set_idle(struct job_cgroup *cg, bool idle);
+
+/* Kill the processes left in the cgroup, if any, and remove it. */
+void cgroup_destroy(struct job_cgroup *cg);
+
+/*
+ * The cgroup builtin:
+ *   cgroup                     print where jobs run and the limits
+ *   cgroup on [dir]            run each job in a cgroup under dir, by
+ *                              default the shell's own cgroup
+ *   cgroup off                 no longer create cgroups for new jobs
+ *   cgroup limit...            set the limits of new jobs
+ *   cgroup jid limit...        change the limits of a running job
+ * where a limit is cpu=N% (of one CPU), memory=SIZE[KMG],
+ * io=MAJ:MIN,KEY=VALUE... (as in io.max), or name= to remove one.
+ */
+void cgroup_builtin(char **argv);
+
+#endif /* __CGROUP_H */
@@ -0,0 +1,49 @@
+#!/usr/bin/python
+#
+# Tests the cgroup builtin, which runs each job in a cgroup of its own
+#
+
+import proc_check, subprocess, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("cgroup on")
+expect_prompt()
+sendline("cgroup")
+if console.expect(["cgroup: on", "cgroup: off"]) == 1:
+    # without a cgroup v2 subtree to write to, jobs run as before
+    expect_prompt()
+    sendline("exit")
+    expect_exact("exit\r\n", "Shell output extraneous characters")
+    test_success("no cgroup v2 subtree, skipped")
+expect_prompt()
+
+# a job runs in a cgroup of its own
+sendline("cat /proc/self/cgroup")
+expect(r"0::/.*cush-\d+/job\d+")
+expect_prompt()
+
+# killing a job also kills the processes it started in a new session,
+# which its process group does not reach
+sendline('sh -c "setsid sleep 4217 & exec sleep 4218" &')
+expect(r"\[1\] \d+")
+expect_prompt()
+time.sleep(0.5)
+sendline("kill 1")
+expect_exact("[1]\tTerminated\t\t(sh -c setsid sleep 4217 & exec sleep 4218)")
+expect_prompt()
+time.sleep(0.5)
+assert subprocess.call(["pgrep", "-f", "sleep 421[78]"]) == 1, "a process of the job survived"
+
+sendline("cgroup memory=12X")
+expect_exact("cgroup: memory=12X: expected")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,39 @@
+#!/usr/bin/python
+#
+# Tests that jobs inherit only their standard descriptors, even those the
+# shell was started with and that are not close-on-exec
+#
+
+import os
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a second shell, started with descriptor 7 open without O_CLOEXEC
+script = "/tmp/cush-closefrom-test-%d.sh" % os.getpid()
+with open(script, "w") as f:
+    f.write("exec 7</dev/null\n")
+    f.write("test -e /proc/self/fd/7 && echo leaked 7\n")
+    f.write("exec %s\n" % os.readlink("/proc/%d/exe" % console.pid))
+sendline("sh " + script)
+expect_exact("leaked 7")
+expect_prompt()
+
+# its job has 0, 1 and 2, and the descriptor ls reads the directory with,
+# but not 7
+sendline("ls /proc/self/fd | cat")
+expect("0\r\n1\r\n2\r\n3\r\n[^0-9]")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+expect_prompt()
+
+os.unlink(script)
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -0,0 +1,472 @@
+/*
+ * cush-agent - run the jobs a shell dispatches to it
+ *
+ * usage: cush-agent [-n slots]
+ *
+ * Speaks the agent protocol (see agent.h) on its stdin and stdout, which
+ * may be a socket the shell created when it started the agent with
+ * "agent add name cush-agent", or any byte stream to another host, e.g.
+ * "agent add node2 ssh node2 cush-agent".  It announces 'slots' (by
+ * default, the number of online CPUs) as its capacity, runs each
+ * pipeline it is sent in a process group of its own, and sends back
+ * what the pipeline writes to stdout and stderr, and how its processes
+ * stop and exit.  When the shell hangs up, it terminates its jobs, reports
+ * how they ended, and exits.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+/* Bytes read from a job's pipe at a time */
+#define CHUNK_SIZE 65536
+
+/* Output queued for the shell above which the jobs' pipes are no longer
+ * read until it has caught up */
+#define HIGH_WATER (1 << 20)
+
+struct buffer {
+    char *data;
+    size_t start, len, cap;
+};
+
+struct task {
+    struct task *next;
+    long id;
+    int num_stages;
+    pid_t *pids;        /* 0 once a stage has been reported as exited */
+    int *statuses;      /* Exit statuses held back until the output is sent */
+    bool *exited;
+    pid_t pgid;
+    int fds[2];         /* stdout and stderr, -1 at EOF */
+};
+
+static struct task *tasks;
+static struct buffer in, out;
+static bool hung_up;        /* The shell sends no more requests */
+static bool shell_gone;     /* Nor does it read what is sent */
+
+static void
+buffer_append(struct buffer *b, const void *data, size_t len)
+{
+    if (b->len + len > b->cap && b->start > 0) {
+        memmove(b->data, b->data + b->start, b->len - b->start);
+        b->len -= b->start;
+        b->start = 0;
+    }
+    if (b->len + len > b->cap) {
+        b->cap = b->len + len > 2 * b->cap ? b->len + len : 2 * b->cap;
+        b->data = realloc(b->data, b->cap);
+        if (b->data == NULL) {
+            perror("cush-agent");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void
+buffer_consume(struct buffer *b, size_t len)
+{
+    b->start += len;
+    if (b->start == b->len)
+        b->start = b->len = 0;
+}
+
+static size_t
+buffer_pending(struct buffer *b)
+{
+    return b->len - b->start;
+}
+
+static void
+send_message(const char *fmt, ...)
+{
+    char *message;
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vasprintf(&message, fmt, ap);
+    va_end(ap);
+    if (len == -1)
+        return;
+    buffer_append(&out, message, len);
+    buffer_append(&out, "\n", 1);
+    free(message);
+}
+
+static struct task *
+find_task(long id)
+{
+    for (struct task *t = tasks; t != NULL; t = t->next)
+        if (t->id == id)
+            return t;
+    return NULL;
+}
+
+/* Report the exits of a task's processes once its output has all been
+ * read; returns true when none is left */
+static bool
+finish_task(struct task *t)
+{
+    if (t->fds[0] != -1 || t->fds[1] != -1)
+        return false;
+    bool done = true;
+    for (int k = 0; k < t->num_stages; k++) {
+        if (t->exited[k] && t->pids[k] != 0) {
+            send_message("status %ld %d %d", t->id, k, t->statuses[k]);
+            t->pids[k] = 0;
+        }
+        done &= t->exited[k];
+    }
+    return done;
+}
+
+/* Forget the tasks that have ended */
+static void
+sweep_tasks(void)
+{
+    for (struct task **p = &tasks; *p != NULL; ) {
+        struct task *t = *p;
+        if (!finish_task(t)) {
+            p = &t->next;
+            continue;
+        }
+        *p = t->next;
+        free(t->pids);
+        free(t->statuses);
+        free(t->exited);
+        free(t);
+    }
+}
+
+/* The next of the NUL-terminated strings a run request consists of */
+static char *
+next_field(char **p, char *end)
+{
+    char *field = *p;
+    char *nul = memchr(field, '\0', end - field);
+    if (nul == NULL)
+        return NULL;
+    *p = nul + 1;
+    return field;
+}
+
+/* In a child: make 'fd' its descriptor 'target' */
+static void
+move_fd(int fd, int target)
+{
+    if (fd != target) {
+        dup2(fd, target);
+        close(fd);
+    }
+}
+
+/*
+ * Start the pipeline of a run request:
+ *   input, output, append, number of stages, then for each stage
+ *   its number of words, whether stderr goes to stdout, and the words
+ * Each stage that cannot be started exits with 127 (or 126), having
+ * written why to its stderr, as a shell's would.
+ */
+static void
+run_task(long id, char *payload, size_t len)
+{
+    char *p = payload, *end = payload + len;
+    char *input = next_field(&p, end);
+    char *output = next_field(&p, end);
+    char *append = next_field(&p, end);
+    char *stages = next_field(&p, end);
+    int num_stages = stages != NULL ? atoi(stages) : 0;
+    if (append == NULL || num_stages <= 0 || find_task(id) != NULL) {
+        fprintf(stderr, "cush-agent: malformed request for job %ld\n", id);
+        return;
+    }
+
+    struct task *t = calloc(1, sizeof *t);
+    t->id = id;
+    t->num_stages = num_stages;
+    t->pids = calloc(num_stages, sizeof *t->pids);
+    t->statuses = calloc(num_stages, sizeof *t->statuses);
+    t->exited = calloc(num_stages, sizeof *t->exited);
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) == -1 || pipe2(err_pipe, O_CLOEXEC) == -1) {
+        perror("cush-agent: pipe");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+    t->fds[0] = out_pipe[0];
+    t->fds[1] = err_pipe[0];
+    t->next = tasks;
+    tasks = t;
+
+    int prev = -1;      /* Read end of the pipe from the previous stage */
+    for (int k = 0; k < num_stages; k++) {
+        char *words = next_field(&p, end);
+        char *dup_stderr = next_field(&p, end);
+        int argc = words != NULL ? atoi(words) : 0;
+        char *argv[argc + 1];
+        for (int w = 0; w < argc; w++)
+            argv[w] = next_field(&p, end);
+        argv[argc] = NULL;
+
+        int next[2] = { -1, -1 };
+        if (k < num_stages - 1 && pipe2(next, O_CLOEXEC) == -1) {
+            perror("cush-agent: pipe");
+            exit(EXIT_FAILURE);
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            setpgid(0, t->pgid);
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, NULL);
+            signal(SIGPIPE, SIG_DFL);
+            move_fd(err_pipe[1], STDERR_FILENO);
+            int stdin_fd = prev;
+            if (k == 0)
+                stdin_fd = open(input[0] != '\0' ? input : "/dev/null", O_RDONLY);
+            int stdout_fd = next[1];
+            if (k == num_stages - 1 && output[0] != '\0')
+                stdout_fd = open(output, O_WRONLY | O_CREAT | (append[0] == '1' ? O_APPEND : O_TRUNC), 0666);
+            else if (k == num_stages - 1)
+                stdout_fd = out_pipe[1];
+            if (stdin_fd == -1 || stdout_fd == -1) {
+                fprintf(stderr, "cush-agent: %s: %s\n", stdin_fd == -1 ? input : output, strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            move_fd(stdin_fd, STDIN_FILENO);
+            move_fd(stdout_fd, STDOUT_FILENO);
+            if (dup_stderr != NULL && dup_stderr[0] == '1')
+                dup2(STDOUT_FILENO, STDERR_FILENO);
+            if (argv[0] == NULL) {
+                fprintf(stderr, "cush-agent: malformed command\n");
+                _exit(EXIT_FAILURE);
+            }
+            execvp(argv[0], argv);
+            fprintf(stderr, "cush-agent: %s: %s\n", argv[0], strerror(errno));
+            _exit(errno == ENOENT ? 127 : 126);
+        }
+        if (pid == -1) {
+            /* reported as a stage that could not be started */
+            fprintf(stderr, "cush-agent: fork: %s\n", strerror(errno));
+            t->exited[k] = true;
+            t->pids[k] = -1;
+            t->statuses[k] = 126 << 8;
+        } else {
+            if (t->pgid == 0)
+                t->pgid = pid;
+            setpgid(pid, t->pgid);
+            t->pids[k] = pid;
+            send_message("started %ld %d %d", id, k, pid);
+        }
+        if (prev != -1)
+            close(prev);
+        if (next[1] != -1)
+            close(next[1]);
+        prev = next[0];
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+}
+
+static void
+signal_task(long id, const char *name)
+{
+    struct task *t = find_task(id);
+    int sig = 0;
+    for (int s = 1; s < NSIG; s++) {
+        const char *abbrev = sigabbrev_np(s);
+        if (abbrev != NULL && strcmp(abbrev, name) == 0)
+            sig = s;
+    }
+    if (t == NULL || t->pgid == 0 || sig == 0)
+        return;
+    killpg(t->pgid, sig);
+}
+
+/* Handle the requests that have been received completely */
+static void
+handle_requests(void)
+{
+    for (;;) {
+        char *line = in.data + in.start;
+        char *newline = memchr(line, '\n', buffer_pending(&in));
+        if (newline == NULL)
+            return;
+        *newline = '\0';
+        long id;
+        size_t len;
+        char name[16];
+        if (sscanf(line, "run %ld %zu", &id, &len) == 2) {
+            /* wait until the whole request has arrived */
+            if ((size_t) (in.data + in.len - (newline + 1)) < len) {
+                *newline = '\n';
+                return;
+            }
+            run_task(id, newline + 1, len);
+            buffer_consume(&in, newline + 1 + len - line);
+            continue;
+        }
+        if (sscanf(line, "signal %ld %15s", &id, name) == 2)
+            signal_task(id, name);
+        else
+            fprintf(stderr, "cush-agent: unknown request: %s\n", line);
+        buffer_consume(&in, newline + 1 - line);
+    }
+}
+
+static void
+reap_children(void)
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+        for (struct task *t = tasks; t != NULL; t = t->next) {
+            for (int k = 0; k < t->num_stages; k++) {
+                if (t->pids[k] != pid || t->exited[k])
+                    continue;
+                if (WIFSTOPPED(status)) {
+                    send_message("status %ld %d %d", t->id, k, status);
+                } else {
+                    t->exited[k] = true;
+                    t->statuses[k] = status;
+                }
+                goto next;
+            }
+        }
+    next:;
+    }
+}
+
+/* Terminate the jobs, in case they are stopped */
+static void
+terminate_tasks(void)
+{
+    for (struct task *t = tasks; t != NULL; t = t->next) {
+        if (t->pgid != 0) {
+            killpg(t->pgid, SIGTERM);
+            killpg(t->pgid, SIGCONT);
+        }
+    }
+}
+
+/* Read what a task wrote to stdout (0) or stderr (1) */
+static void
+read_output(struct task *t, int which)
+{
+    char data[CHUNK_SIZE];
+    ssize_t n = read(t->fds[which], data, sizeof data);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close(t->fds[which]);
+        t->fds[which] = -1;
+        return;
+    }
+    char header[64];
+    int len = snprintf(header, sizeof header, "%s %ld %zd\n", which == 0 ? "out" : "err", t->id, n);
+    buffer_append(&out, header, len);
+    buffer_append(&out, data, n);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && (slots = atoi(optarg)) > 0)
+            continue;
+        fprintf(stderr, "usage: cush-agent [-n slots]\n");
+        return EXIT_FAILURE;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+
+    char host[256] = "";
+    gethostname(host, sizeof host - 1);
+    send_message("hello %ld %s", slots, host);
+
+    while (!shell_gone && (!hung_up || tasks != NULL || buffer_pending(&out) > 0)) {
+        int num_tasks = 0;
+        for (struct task *t = tasks; t != NULL; t = t->next)
+            num_tasks++;
+        struct pollfd fds[3 + 2 * num_tasks];
+        struct task *owners[3 + 2 * num_tasks];
+        int n = 0;
+        fds[n++] = (struct pollfd) { .fd = hung_up ? -1 : STDIN_FILENO, .events = POLLIN };
+        fds[n++] = (struct pollfd) { .fd = STDOUT_FILENO, .events = buffer_pending(&out) > 0 ? POLLOUT : 0 };
+        fds[n++] = (struct pollfd) { .fd = sigchld_fd, .events = POLLIN };
+        /* while the shell does not keep up, the jobs wait */
+        for (struct task *t = tasks; t != NULL && buffer_pending(&out) <= HIGH_WATER; t = t->next) {
+            for (int which = 0; which < 2; which++) {
+                if (t->fds[which] != -1) {
+                    owners[n] = t;
+                    fds[n++] = (struct pollfd) { .fd = t->fds[which], .events = POLLIN };
+                }
+            }
+        }
+        if (poll(fds, n, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("cush-agent: poll");
+            return EXIT_FAILURE;
+        }
+
+        if (fds[0].revents) {
+            char data[4096];
+            ssize_t got = read(STDIN_FILENO, data, sizeof data);
+            if (got > 0) {
+                buffer_append(&in, data, got);
+                handle_requests();
+            } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+                hung_up = true;
+                terminate_tasks();
+            }
+        }
+        if (fds[2].revents) {
+            struct signalfd_siginfo info;
+            while (read(sigchld_fd, &info, sizeof info) == sizeof info)
+                continue;
+            reap_children();
+        }
+        for (int k = 3; k < n; k++) {
+            if (fds[k].revents)
+                read_output(owners[k], fds[k].fd == owners[k]->fds[0] ? 0 : 1);
+        }
+        sweep_tasks();
+        while (buffer_pending(&out) > 0) {
+            ssize_t sent = write(STDOUT_FILENO, out.data + out.start, buffer_pending(&out));
+            if (sent > 0) {
+                buffer_consume(&out, sent);
+            } else if (errno == EAGAIN || errno == EINTR) {
+                break;
+            } else {
+                shell_gone = true;
+                break;
+            }
+        }
+    }
+
+    /* the shell has gone: its jobs end with it */
+    terminate_tasks();
+    return EXIT_SUCCESS;
+}
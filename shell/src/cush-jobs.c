@@ -0,0 +1,149 @@
+/*
+ * cush-jobs - list the jobs of running shells
+ *
+ * usage: cush-jobs [pid...]
+ *
+ * Reads the job tables that shells started with CUSH_JOBSHM set, or that
+ * ran "jobshm on", publish in /dev/shm (see jobshm.h), either of the
+ * given shells or of all shells whose table it may read.  The shells
+ * are neither stopped nor slowed down while it reads.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "jobshm.h"
+
+/* Copy a slot the shell may be changing; false if it kept changing it */
+static bool
+read_slot(const struct jobshm_slot *shared, struct jobshm_slot *copy)
+{
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, shared, sizeof *copy);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq)
+            return true;
+    }
+    return false;
+}
+
+static void
+print_slot(const struct jobshm_slot *s)
+{
+    char status[32];
+    if (s->num_alive > 0 || s->num_processes == 0 || strcmp(s->status, "Timed out") == 0)
+        snprintf(status, sizeof status, "%s", s->status);
+    else if (WIFEXITED(s->exit_status) && WEXITSTATUS(s->exit_status) == 0)
+        snprintf(status, sizeof status, "Done");
+    else if (WIFEXITED(s->exit_status))
+        snprintf(status, sizeof status, "Exit %d", WEXITSTATUS(s->exit_status));
+    else
+        snprintf(status, sizeof status, "%s", strsignal(WTERMSIG(s->exit_status)));
+
+    time_t start = s->start_time;
+    char started[16];
+    strftime(started, sizeof started, "%H:%M:%S", localtime(&start));
+    printf("[%d]\t%s\t\t(%s)\n", s->jid, status, s->cmdline);
+    printf("\tpgid %d, started %s, user %.2fs sys %.2fs rss %ldK, pids",
+           s->pgid, started, s->utime, s->stime, (long) s->maxrss_kb);
+    for (int k = 0; k < s->num_processes && k < JOBSHM_PIDS; k++)
+        printf(" %d", s->pids[k]);
+    if (s->num_processes > JOBSHM_PIDS)
+        printf(" ...");
+    printf("\n");
+}
+
+/* Print the job table of shell 'pid'; false if it cannot be read */
+static bool
+print_table(int pid)
+{
+    char name[64];
+    snprintf(name, sizeof name, JOBSHM_PREFIX "%d", pid);
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct jobshm_header)) {
+        fprintf(stderr, "cush-jobs: %d: %s\n", pid, fd == -1 ? strerror(errno) : "not a job table");
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    const struct jobshm_header *table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        fprintf(stderr, "cush-jobs: %d: %s\n", pid, strerror(errno));
+        return false;
+    }
+    if (__atomic_load_n(&table->magic, __ATOMIC_ACQUIRE) != JOBSHM_MAGIC
+        || table->version != JOBSHM_VERSION || table->slot_size != sizeof(struct jobshm_slot)
+        || sizeof *table + (size_t) table->num_slots * table->slot_size > (size_t) st.st_size) {
+        fprintf(stderr, "cush-jobs: %d: not a job table of this version\n", pid);
+        munmap((void *) table, st.st_size);
+        return false;
+    }
+
+    bool running = kill(pid, 0) == 0 || errno != ESRCH;
+    printf("cush %d%s\n", pid, running ? "" : " (no longer running)");
+    for (uint32_t i = 0; i < table->num_slots; i++) {
+        struct jobshm_slot slot;
+        if (!read_slot(&table->slots[i], &slot))
+            fprintf(stderr, "cush-jobs: %d: slot %u keeps changing\n", pid, i);
+        else if (slot.jid != 0)
+            print_slot(&slot);
+    }
+    if (table->dropped > 0)
+        printf("(%u jobs not published, the table was full)\n", table->dropped);
+    munmap((void *) table, st.st_size);
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool ok = true;
+    if (argc > 1) {
+        for (int k = 1; k < argc; k++) {
+            char *end;
+            long pid = strtol(argv[k], &end, 10);
+            if (end == argv[k] || *end != '\0' || pid <= 0) {
+                fprintf(stderr, "usage: cush-jobs [pid...]\n");
+                return EXIT_FAILURE;
+            }
+            ok &= print_table(pid);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL) {
+        perror("cush-jobs: /dev/shm");
+        return EXIT_FAILURE;
+    }
+    /* the segments are named as in JOBSHM_PREFIX, without its slash */
+    size_t len = strlen(JOBSHM_PREFIX) - 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int pid;
+        char rest;
+        if (strncmp(entry->d_name, JOBSHM_PREFIX + 1, len) == 0
+            && sscanf(entry->d_name + len, "%d%c", &pid, &rest) == 1)
+            ok &= print_table(pid);
+    }
+    closedir(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
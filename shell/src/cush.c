@@ -8,10 +8,14 @@
 #include <stdio.h>
 #include <readline/readline.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <sys/wait.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -25,15 +29,44 @@
 #include "signal_support.h"
 #include "shell-ast.h"
 #include "utils.h"
+#include "path_cache.h"
+#include "spawn_pool.h"
+#include "prefetch.h"
+#include "jobs.h"
+#include "event_loop.h"
+#include "usage.h"
+#include "perfstat.h"
+#include "parallel.h"
+#include "dag.h"
+#include "admission.h"
+#include "cgroup.h"
+#include "placement.h"
+#include "priority.h"
+#include "timeout.h"
+#include "jobshm.h"
+#include "server.h"
+#include "agent.h"
+#include "jobserver.h"
 
 
-static void handle_child_status(pid_t pid, int status);
+static void handle_child_status(pid_t pid, int status, const struct usage *usage);
+static void handle_process_status(struct job *curr_job, struct job_process *curr_proc,
+                                  int status, const struct usage *usage);
+static void admit_queued_jobs(void);
+static void give_token(struct job *job);
 
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
-        " -h            print this help\n",
+    printf("Usage: %s -h -s nthreads -j njobs -J ntokens --serve path\n"
+        " -h            print this help\n"
+        " -s nthreads   spawn the commands of a pipeline concurrently,\n"
+        "               using nthreads spawner threads\n"
+        " -j njobs      run at most njobs background jobs at a time\n"
+        " -J ntokens    act as a GNU make jobserver, sharing ntokens job\n"
+        "               slots between background jobs and makes\n"
+        " --serve path  run without a terminal, running the command lines\n"
+        "               that clients send to the Unix socket path\n",
         progname);
 
     exit(EXIT_SUCCESS);
@@ -69,302 +102,1774 @@ build_prompt(void)
     // return strdup("cush> ");
 }
 
-enum job_status {
-    FOREGROUND,     /* job is running in foreground.  Only one job can be
-                       in the foreground state. */
-    BACKGROUND,     /* job is running in background */
-    STOPPED,        /* job is stopped via SIGSTOP */
-    NEEDSTERMINAL,  /* job is stopped because it was a background job
-                       and requires exclusive terminal access */
+/*
+ * Reap every child process that has exited or changed status (been
+ * stopped, needed the terminal, etc.) and record it in the job list.
+ * Use a loop with WNOHANG since only a single SIGCHLD 
+ * signal may be delivered for multiple children that have 
+ * exited. All of them need to be reaped.
+ * A child that has exited is first only looked at (WNOWAIT), so that
+ * its I/O counters can be read from /proc while it is still a zombie;
+ * wait4 then reaps it and returns the CPU time and memory it used.
+ */
+static void
+reap_children(void)
+{
+    siginfo_t info;
+    for (;;) {
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED|WSTOPPED|WNOHANG|WNOWAIT) != 0 || info.si_pid == 0)
+            break;
+
+        struct usage usage;
+        memset(&usage, 0, sizeof usage);
+        bool exited = info.si_code == CLD_EXITED || info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED;
+        if (exited)
+            usage_read_io(info.si_pid, &usage);
+
+        int status;
+        struct rusage rusage;
+        if (wait4(info.si_pid, &status, WUNTRACED|WNOHANG, &rusage) != info.si_pid)
+            break;
+        usage_from_rusage(&usage, &rusage);
+        handle_child_status(info.si_pid, status, exited ? &usage : NULL);
+    }
+}
+
+/* SIGCHLD is blocked and delivered through this signalfd instead */
+static int sigchld_fd = -1;
+
+/* Number of jobs with waited_for set that have not finished yet */
+static int num_jobs_waited_for;
+
+/* True while readline is reading a command line */
+static bool prompting;
+
+/* True if the shell runs headless, for the clients of --serve */
+static bool serving;
+
+/* True if a message was printed over the line being edited */
+static bool prompt_interrupted;
+
+/* Call before printing a message about a job, so that it does not
+ * end up in the middle of the line being edited. */
+static void
+report_begin(void)
+{
+    if (prompting && !prompt_interrupted) {
+        rl_clear_visible_line();
+        prompt_interrupted = true;
+    }
+}
+
+/* Redraw the prompt and the line being edited after report_begin */
+static void
+report_end(void)
+{
+    if (prompt_interrupted) {
+        fflush(stdout);
+        rl_forced_update_display();
+        prompt_interrupted = false;
+    }
+}
+
+/*
+ * Called when SIGCHLD is pending.  All queued SIGCHLDs are read at
+ * once and the children reaped in one batch, however many exited.
+ */
+static void
+sigchld_ready(int fd, void *arg)
+{
+    struct signalfd_siginfo infos[16];
+    while (read(fd, infos, sizeof infos) == sizeof infos)
+        continue;
+    reap_children();
+    //processes that exited may make room for queued jobs
+    admit_queued_jobs();
+    report_end();
+}
+
+/* Wait for all processes in this job to complete, or for
+ * the job no longer to be in the foreground.
+ * You should call this function from a) where you wait for
+ * jobs started without the &; and b) where you implement the
+ * 'fg' command.
+ * 
+ * Implement handle_child_status such that it records the 
+ * information obtained from waitpid() for pid 'child.'
+ *
+ * If a process exited, it must find the job to which it
+ * belongs and decrement num_processes_alive.
+ *
+ * However, note that it is not safe to call delete_job
+ * in handle_child_status because wait_for_job assumes that
+ * even jobs with no more num_processes_alive haven't been
+ * deallocated.  You should postpone deleting completed
+ * jobs from the job list until when your code will no
+ * longer touch them.
+ *
+ * The code below relies on `job->status` having been set to FOREGROUND
+ * and `job->num_processes_alive` having been set to the number of
+ * processes successfully forked for this job.
+ */
+static void
+wait_for_job(struct job *job)
+{
+    assert(signal_is_blocked(SIGCHLD));
+
+    // Background jobs may give way to the job while it runs.
+    priority_foreground(true);
+    // The terminal is not watched while the job runs, so only
+    // SIGCHLD (and timers) wake the loop.
+    while (job->status == FOREGROUND && job->num_processes_alive > 0)
+        event_loop_run_once(-1);
+    priority_foreground(false);
+}
+
+
+
+/* Send signal 'sig' to all processes of a job, through exactly one
+ * mechanism, so that no process gets it twice.
+ * If the job has a cgroup, every process in it is signaled, which also
+ * reaches those the job's commands started themselves.  Otherwise each
+ * process not yet reaped is signaled through its pidfd, which, unlike its
+ * pid, cannot have been reused for an unrelated process.  Only if one has
+ * no pidfd is the process group signaled instead; its id cannot be reused
+ * while one of the job's processes is left unreaped.
+ * Returns 0 on success, -1 if a signal could not be sent.
+ */
+static int
+signal_job(struct job *job, int sig)
+{
+    //a remote job is signaled by its agent
+    if(job->remote != NULL){
+        return agent_signal(job->remote, sig);
+    }
+    if (job->cgroup != NULL)
+        return cgroup_signal(job->cgroup, sig);
+    for (int k = 0; k < job->num_processes; k++) {
+        if (job->processes[k].alive && job->processes[k].pidfd == -1)
+            return killpg(job->pgid, sig);
+    }
+    int rc = 0;
+    for (int k = 0; k < job->num_processes; k++) {
+        struct job_process *proc = &job->processes[k];
+        if (proc->alive)
+            rc |= pidfd_send_signal(proc->pidfd, sig, NULL, 0);
+    }
+    return rc;
+}
+
+static void
+handle_child_status(pid_t pid, int status, const struct usage *usage)
+{
+    assert(signal_is_blocked(SIGCHLD));
+    struct job_process *curr_proc;
+    struct job *curr_job = get_job_from_pid(pid, &curr_proc);
+
+    //the processes started for agents are not jobs
+    if(curr_job == NULL && agent_child_changed(pid, status)){
+        return;
+    }
+    if(curr_job == NULL){
+        printf("job not found :(\n");
+        exit(0);
+    }
+    handle_process_status(curr_job, curr_proc, status, usage);
+}
+
+/* Record that a process of a job, local or on an agent, stopped or exited */
+static void
+handle_process_status(struct job *curr_job, struct job_process *curr_proc,
+                      int status, const struct usage *usage)
+{
+    // Step 2. Determine what status change occurred using the WIF*() macros.
+    // // Step 3. Update the job status accordingly, and adjust num_processes_alive if appropriate. 
+    // // If a process was stopped, save the terminal state.
+    if(WIFSTOPPED(status)){
+        //a stopped job no longer keeps the wait builtin waiting
+        if(curr_job->waited_for){
+            curr_job->waited_for = false;
+            num_jobs_waited_for--;
+        }
+        if(WSTOPSIG(status) == SIGTTOU || WSTOPSIG(status) == SIGTTIN){
+            curr_job->status = NEEDSTERMINAL;
+        }
+        else if(WSTOPSIG(status) == SIGTSTP || WSTOPSIG(status) == SIGSTOP){
+            if(!serving){
+                termstate_save(&curr_job->saved_tty_state);
+            }
+            curr_job->status = STOPPED;
+            report_begin();
+            print_job(curr_job);
+            curr_job->has_saved_tty = true;
+        }
+    }
+    else if(WIFEXITED(status)){
+        job_process_exited(curr_proc, status, usage);
+    }
+    else if(WIFSIGNALED(status)){
+        job_process_exited(curr_proc, status, usage);
+        report_begin();
+        if(WTERMSIG(status)==SIGFPE){
+            printf("floating point exception\n");
+        }
+        else if(WTERMSIG(status) == SIGSEGV){
+            printf("segmentation fault\n");
+        }
+        else if(WTERMSIG(status) == SIGABRT){
+            printf("aborted\n");
+        }
+        else if(WTERMSIG(status) == SIGKILL){
+            printf("killed\n");
+        }
+        else if(WTERMSIG(status) == SIGTERM){
+            printf("terminated\n");
+        }
+        else{
+            printf("unknown signal\n");
+        }
+    }
+    //the job's processes no longer count once they have exited
+    if((WIFEXITED(status) || WIFSIGNALED(status)) && curr_job->admitted){
+        admission_process_exited(curr_job->num_processes_alive == 0);
+    }
+    if(curr_job->num_processes_alive == 0){
+        give_token(curr_job);
+    }
+    //'time' reports once the whole pipeline has ended
+    if(curr_job->num_processes_alive == 0 && curr_job->timed){
+        report_begin();
+        print_job_times(curr_job, stderr);
+    }
+    //as does 'perfstat', with the counts of the whole process group
+    if(curr_job->num_processes_alive == 0 && curr_job->perf != NULL){
+        report_begin();
+        fprintf(stderr, "Performance counter stats for '%s':\n", curr_job->cmdline);
+        perfstat_print(curr_job->perf, "", stderr);
+    }
+    //a foreground job that ran out of time says so
+    if(curr_job->num_processes_alive == 0 && curr_job->status == FOREGROUND && curr_job->timeout.expired){
+        report_begin();
+        print_job_exit(curr_job);
+    }
+    //a background job is reported as soon as its last process is reaped
+    if(curr_job->num_processes_alive == 0 && curr_job->status == BACKGROUND){
+        report_begin();
+        print_job_exit(curr_job);
+        if(curr_job->waited_for){
+            num_jobs_waited_for--;
+        }
+    }
+    jobshm_update(curr_job);
+    //while reading a command line, the shell already owns the terminal,
+    //which readline has set up for editing; a serving shell has none
+    if(!prompting && !serving){
+        termstate_give_terminal_back_to_shell();
+    }
+}
+
+//tells the client that ran a job how it ended, once its output has been
+//sent: with its exit status, or 128 plus the signal that killed it, or if
+//it could not be started because of 'error', with 127 or 126 as a shell does
+static void
+end_client_job(struct job *job, int error)
+{
+    if(job->stream == NULL){
+        return;
+    }
+    char text[64];
+    int code;
+    if(error != 0){
+        code = error == ENOENT ? 127 : 126;
+        snprintf(text, sizeof text, "%s", strerror(error));
+    }
+    else{
+        int status = job_exit_status(job);
+        code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        job_exit_text(job, text, sizeof text);
+    }
+    server_stream_ended(job->stream, code, text);
+    job->stream = NULL;
+}
+
+//the job table tells these of the jobs whose records it keeps, see jobs.h
+static void
+job_changed(struct job *job)
+{
+    jobshm_update(job);
+}
+
+//releases what the shell's modules attached to a job that is deleted
+static void
+job_deleted(struct job *job)
+{
+    jobshm_remove(job);
+    perfstat_free(job->perf);
+    if(job->cgroup != NULL){
+        cgroup_destroy(job->cgroup);
+    }
+    if(job->placement != NULL){
+        placement_release(job->placement);
+    }
+    timeout_cancel(job);
+}
+
+static const char *
+job_location(struct job *job)
+{
+    return job->remote != NULL ? agent_task_name(job->remote) : NULL;
+}
+
+static bool
+job_group_usage(struct job *job, struct usage *usage)
+{
+    return job->cgroup != NULL && cgroup_read_usage(job->cgroup, usage);
+}
+
+//removes all jobs with no more processes alive from the job list
+//also deletes the job; only the jobs queued as completed are looked at
+static void clean_jobs_list(){
+    struct job *done_job;
+    while ((done_job = pop_completed_job()) != NULL){
+        list_remove(&done_job->elem);
+        end_client_job(done_job, 0);
+        if(done_job->remote != NULL){
+            agent_task_free(done_job->remote);
+            done_job->remote = NULL;
+        }
+        //the wait builtin may still ask how a background job ended
+        if(done_job->status == BACKGROUND && !done_job->waited_for){
+            remember_job_exit(done_job);
+        }
+        delete_job(done_job);
+    }
+}
+
+/* Add a running or queued background job to those the wait builtin
+ * waits for */
+static void
+wait_for_background_job(struct job *job)
+{
+    bool running = job->status == BACKGROUND && job->num_processes_alive > 0;
+    if((running || job->status == QUEUED) && !job->waited_for){
+        job->waited_for = true;
+        num_jobs_waited_for++;
+    }
+}
+
+/*
+ * The wait builtin:
+ *   wait [--all]       wait for all running background jobs
+ *   wait jid...        wait for the given jobs
+ *   wait -n [jid...]   wait for the first of the given jobs (or of all
+ *                      running background jobs) to finish
+ * How each job waited for ended is printed as it finishes (see
+ * handle_child_status); for a job that had already ended, the
+ * remembered exit is printed.  A job that is stopped is no longer
+ * waited for.  The shell sleeps in the event loop meanwhile.
+ */
+static void
+wait_builtin(char **p)
+{
+    bool any = false;
+    int k = 1;
+    if(p[k] != NULL && strcmp(p[k], "-n")==0){
+        any = true;
+        k++;
+    }
+    else if(p[k] != NULL && strcmp(p[k], "--all")==0){
+        k++;
+    }
+
+    if(p[k] == NULL){
+        if(!any){
+            forget_finished_jobs();
+        }
+        for (struct list_elem * e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)){
+            wait_for_background_job(list_entry(e, struct job, elem));
+        }
+    }
+    for (; p[k] != NULL; k++){
+        char *end;
+        long jid = strtol(p[k], &end, 10);
+        struct job *job = *end == '\0' ? get_job_from_jid(jid) : NULL;
+        if(job != NULL && job->num_processes_alive == 0 && job->status != QUEUED){
+            //ended, but not yet deleted from the job list
+            print_job_exit(job);
+            job->waited_for = true;
+            if(any){
+                break;
+            }
+        }
+        else if(job != NULL){
+            wait_for_background_job(job);
+        }
+        else if(*end != '\0' || !print_finished_job(jid)){
+            printf("wait: %s: no such job\n", p[k]);
+        }
+        else if(any){
+            //one of the jobs has ended already
+            break;
+        }
+    }
+
+    int waiting = num_jobs_waited_for;
+    if(any && p[k] != NULL){
+        waiting = 0;
+    }
+    while (num_jobs_waited_for > 0 && (!any || num_jobs_waited_for == waiting)){
+        event_loop_run_once(-1);
+    }
+
+    //with -n, the jobs that are still running are no longer waited for
+    for (struct list_elem * e = list_begin(&job_list); num_jobs_waited_for > 0 && e != list_end(&job_list); e = list_next(e)){
+        struct job *job = list_entry(e, struct job, elem);
+        bool running = job->num_processes_alive > 0 && job->status == BACKGROUND;
+        if(job->waited_for && (running || job->status == QUEUED)){
+            job->waited_for = false;
+            num_jobs_waited_for--;
+        }
+    }
+}
+
+/* How spawn_job starts a job */
+struct spawn_options {
+    bool counted;       /* Attach performance counters, see perfstat.c */
+    bool keep_terminal; /* Do not give the terminal to a foreground job */
+    int output_fd;      /* If not -1, the stdout of the last stage */
+    struct placement *placement;    /* Where it runs, if pinned by hand;
+                                       the job takes ownership of it */
+    struct job_timeout timeout;     /* Its time limit, if duration is set */
+    struct server_client *client;   /* The client of a serving shell that
+                                       runs it, which gets its output */
+    int agent;          /* The agent it runs on, or AGENT_ANY, or 0 to run
+                           it here; see agent.c */
 };
 
-struct job {
-    struct list_elem elem;   /* Link element for jobs list. */
-    struct ast_pipeline *pipe;  /* The pipeline of commands this job represents */
-    int     jid;             /* Job id. */
-    enum job_status status;  /* Job status. */ 
-    int  num_processes_alive;   /* The number of processes that we know to be alive */
-    struct termios saved_tty_state;  /* The state of the terminal when this job was 
-                                        stopped after having been in foreground */
-
-    /* Add additional fields here if needed. */
-    pid_t pgid;     /* PGID . */
-    pid_t * pid_array;
-    bool has_saved_tty;
-    int pid_counter;
-};
+/* Start the processes of a job for all commands of 'pipe'.
+ * The whole pipeline is handed to libspawn in one call, which creates
+ * the pipes between the stages and puts every stage into the process
+ * group of the first one.  If the spawn pool is enabled, the stages are
+ * instead spawned concurrently by its threads.
+ * A FOREGROUND job is given the terminal unless 'opts' says otherwise.
+ * Returns 0 if at least one process started, otherwise the error that
+ * kept the first one from starting, which is left to the caller to report.
+ */
+static int
+start_job(struct job *job, struct ast_pipeline *pipe, const struct spawn_options *opts)
+{
+    //the output of a job a client runs goes to the client, unless redirected
+    int output_fd = opts->output_fd, error_fd = -1;
+    if(job->stream != NULL){
+        int stream_fd;
+        if(!server_stream_open(job->stream, &stream_fd, &error_fd)){
+            return errno;
+        }
+        if(pipe->iored_output == NULL){
+            output_fd = stream_fd;
+        }
+    }
+
+    int num_cmds = list_size(&pipe->commands);
+    struct posix_spawn_stage stages[num_cmds];
+    posix_spawn_file_actions_t child_file_attr[num_cmds];
+    pid_t pids[num_cmds];
+    int pidfds[num_cmds];
+
+    posix_spawnattr_t child_spawn_attr;
+    posix_spawnattr_init(&child_spawn_attr);
+    //the first stage starts a new process group, later stages join it
+    posix_spawnattr_setpgroup(&child_spawn_attr, 0);
+    //the shell keeps SIGCHLD blocked, the children must not inherit that
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&child_spawn_attr, &no_signals);
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK;
+    if(job->status == FOREGROUND && !opts->keep_terminal){
+        flags |= POSIX_SPAWN_TCSETPGROUP;
+        posix_spawnattr_tcsetpgrp_np(&child_spawn_attr, termstate_get_tty_fd());
+    }
+    //with per-job cgroups, the processes are created in the job's cgroup
+    if(job->cgroup == NULL){
+        job->cgroup = cgroup_create();
+    }
+    if(job->cgroup != NULL){
+        flags |= POSIX_SPAWN_SETCGROUP;
+        posix_spawnattr_setcgroup_np(&child_spawn_attr, cgroup_fd(job->cgroup));
+    }
+    //a job not pinned by hand may be placed by the CPU topology
+    if(job->placement == NULL){
+        job->placement = placement_choose(num_cmds);
+    }
+    if(job->placement != NULL){
+        placement_set_attr(job->placement, &child_spawn_attr, &flags);
+    }
+    posix_spawnattr_setflags(&child_spawn_attr, flags);
+
+    path_cache_refresh();
+    int i = 0;
+    for (struct list_elem * pipeline_elem = list_begin(&pipe->commands); 
+        pipeline_elem != list_end(&pipe->commands); 
+        pipeline_elem = list_next(pipeline_elem), i++) {
+        struct ast_command *cmd = list_entry(pipeline_elem, struct ast_command, elem);
+        posix_spawn_file_actions_init(&child_file_attr[i]);
+
+        //if they are NOT null, that means either a '<', '>', or '>>" was useed
+        //check for io input file ( < )
+        if(pipe->iored_input != NULL && i == 0){
+            int psx_add_open_val = posix_spawn_file_actions_addopen(&child_file_attr[i], STDIN_FILENO, pipe->iored_input, O_RDONLY | O_CREAT, S_IRUSR);
+            if(psx_add_open_val != 0){
+                fprintf(stderr, "error: cannot open file\n");
+            }
+        }
+        //check for io output file
+        if(pipe->iored_output != NULL && i == num_cmds - 1){
+            //append ( >> ) or overwrite ( > )
+            int flags = O_WRONLY | O_CREAT | (pipe->append_to_output ? O_APPEND : 0);
+            int psx_add_open_val = posix_spawn_file_actions_addopen(&child_file_attr[i], STDOUT_FILENO, pipe->iored_output, flags, S_IRWXU);
+            if(psx_add_open_val != 0){
+                fprintf(stderr, "error: cannot open file\n");
+            }
+        }
+
+        if(output_fd != -1 && i == num_cmds - 1){
+            posix_spawn_file_actions_adddup2(&child_file_attr[i], output_fd, STDOUT_FILENO);
+        }
+        if(error_fd != -1){
+            posix_spawn_file_actions_adddup2(&child_file_attr[i], error_fd, STDERR_FILENO);
+        }
+
+        //the pipes to the neighbouring stages are connected by libspawn
+        //before these actions run, so this duplicates the pipe if any
+        if(cmd->dup_stderr_to_stdout){  //also redirect stderr
+            posix_spawn_file_actions_adddup2(&child_file_attr[i], STDOUT_FILENO, STDERR_FILENO);
+        }
+
+        //pass the jobserver's pipe to a job that holds a token, then close
+        //any descriptor beyond that is not close-on-exec, e.g. one leaked
+        //by a library, so it is not inherited by the job
+        int first_closed = job->has_token ? jobserver_add_file_actions(&child_file_attr[i])
+                                          : STDERR_FILENO + 1;
+        posix_spawn_file_actions_addclosefrom_np(&child_file_attr[i], first_closed);
+
+        //resolve the command through the PATH cache, so the child does not
+        //have to search PATH; commands known not to exist are not spawned
+        int error;
+        const char *file = path_cache_resolve(cmd->argv[0], &error);
+        stages[i] = (struct posix_spawn_stage) {
+            .file = file,
+            .argv = cmd->argv,
+            .file_actions = &child_file_attr[i],
+            .error = error,
+        };
+    }
+
+    //with MAKEFLAGS set for the jobserver, if it has a token
+    extern char **environ;
+    char **envp = job->has_token ? jobserver_environ() : environ;
+    double start_time = usage_now();
+    int spawned;
+    posix_spawn_pipeline_t *pl;
+    struct perfstat *perf = NULL;
+    if(opts->counted){
+        //the counters must be in place before the first stage is created,
+        //so the pipeline is spawned serially by perfstat's own thread
+        spawned = perfstat_spawn_pipeline(&perf, pids, pidfds, stages, num_cmds, &child_spawn_attr, envp);
+    }
+    else if(spawn_pool_enabled() && num_cmds > 1){
+        //the pipes are all created up front, then the pool's threads
+        //each wait only for their own stage to exec
+        spawned = posix_spawn_pipeline_init_np(&pl, pids, pidfds, stages, num_cmds, &child_spawn_attr, envp);
+        if(spawned == 0){
+            spawn_pool_run(pl, num_cmds);
+            spawned = posix_spawn_pipeline_finish_np(pl);
+        }
+    }
+    else{
+        spawned = posix_spawn_pipeline_np(pids, pidfds, stages, num_cmds, &child_spawn_attr, envp);
+    }
+    bool started = false;
+    for (i = 0; i < num_cmds; i++) {
+        started |= pids[i] != -1;
+    }
+    if(!started){
+        for (i = 0; i < num_cmds; i++) {
+            posix_spawn_file_actions_destroy(&child_file_attr[i]);
+        }
+        posix_spawnattr_destroy(&child_spawn_attr);
+        if(perf != NULL){
+            perfstat_free(perf);
+        }
+        return spawned;
+    }
+    if(spawned != 0){
+        errno = spawned;
+        perror("Spawning: ");
+    }
+
+    job->start_time = start_time;
+    job->perf = perf;
+    if(job->status == BACKGROUND){
+        report_begin();
+    }
+
+    for (i = 0; i < num_cmds; i++) {
+        posix_spawn_file_actions_destroy(&child_file_attr[i]);
+        if(pids[i] == -1){
+            continue;
+        }
+        //the first process that started is the process group leader,
+        //except when spawning concurrently: then the group is that of the
+        //first command even if it failed to exec
+        if(job->num_processes_alive == 0){
+            bool concurrent = spawn_pool_enabled() && num_cmds > 1 && !opts->counted;
+            job_set_pgid(job, concurrent ? getpgid(pids[i]) : pids[i]);
+        }
+        //print jid and pid if it is a background process
+        if(job->status == BACKGROUND){
+            printf("[%d] %d\n", job->jid, pids[i]);
+        }
+        // add the process to the job, keeping its pidfd as the handle
+        // used to signal and wait for it
+        job_add_process(job, i, pids[i], pidfds[i]);
+    }
+    posix_spawnattr_destroy(&child_spawn_attr);
+    //a background job gives way to the user's work
+    priority_job_changed(job);
+    timeout_start(job);
+    if(job->stream != NULL){
+        server_stream_started(job->stream);
+    }
+    return 0;
+}
+
+/* Send a background job to an agent, see agent.c.  Its processes are
+ * remote, so what they write is relayed by remote_output and how they
+ * end by remote_process_changed. */
+static int
+start_remote_job(struct job *job, struct ast_pipeline *pipe, int agent)
+{
+    int error = agent_start(job, pipe, agent);
+    if(error == 0){
+        report_begin();
+        printf("[%d] on %s\n", job->jid, agent_task_name(job->remote));
+        timeout_start(job);
+    }
+    return error;
+}
+
+static void
+remote_process_changed(struct job_process *proc, int status)
+{
+    handle_process_status(proc->job, proc, status, NULL);
+}
+
+static void
+remote_output(struct job *job, int fd, const char *data, size_t len)
+{
+    report_begin();
+    FILE *out = fd == STDERR_FILENO ? stderr : stdout;
+    fwrite(data, 1, len, out);
+    fflush(out);
+}
+
+/* An agent or the jobserver may now take a queued job */
+static void
+retry_queued_jobs(void)
+{
+    admit_queued_jobs();
+    report_end();
+}
+
+/* Give back the jobserver token of a job that has ended or did not start */
+static void
+give_token(struct job *job)
+{
+    if(job->has_token){
+        jobserver_give();
+        job->has_token = false;
+    }
+}
+
+/* A background job that admission control has not let start yet */
+struct queued_job {
+    struct list_elem elem;  /* Link element for queued_jobs */
+    struct job *job;
+    struct ast_pipeline *pipe;
+    struct spawn_options opts;
+    int attempts;           /* Spawns that failed with EAGAIN so far */
+    double not_before;      /* usage_now() before which it is not retried */
+};
+
+/* The queued background jobs, in the order they were entered */
+static struct list queued_jobs;
+
+/* timerfd that fires when the head of queued_jobs is to be tried again */
+static int admission_timer_fd = -1;
+
+/* Remove a job from the queue, and from the job list if it never started */
+static void
+dequeue_job(struct queued_job *q, bool started)
+{
+    list_remove(&q->elem);
+    q->job->queued = NULL;
+    if(!started){
+        if(q->job->waited_for){
+            num_jobs_waited_for--;
+        }
+        end_client_job(q->job, ECANCELED);
+        list_remove(&q->job->elem);
+        delete_job(q->job);
+    }
+    ast_pipeline_free(q->pipe);
+    free(q);
+}
+
+static void
+arm_admission_timer(int ms)
+{
+    struct itimerspec when = {
+        .it_value = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L },
+    };
+    timerfd_settime(admission_timer_fd, 0, &when, NULL);
+}
+
+/*
+ * Start the queued background jobs, in order, as far as admission
+ * control lets them.  The first one it holds back holds back those
+ * behind it, too; the timer is armed to try it again when admission.c
+ * suggests, and it is also tried again whenever children were reaped.
+ * A spawn that fails with EAGAIN because the system is out of processes
+ * is retried after a growing delay.
+ */
+static void
+admit_queued_jobs(void)
+{
+    while(!list_empty(&queued_jobs)){
+        struct queued_job *q = list_entry(list_front(&queued_jobs), struct queued_job, elem);
+        double now = usage_now();
+        if(q->not_before > now){
+            arm_admission_timer((q->not_before - now) * 1000 + 1);
+            return;
+        }
+        int retry_ms;
+        //a remote job does not count against the shell's limits, but
+        //waits for a free slot on its agent; it is tried again when an
+        //agent reports one
+        if(q->opts.agent != 0){
+            if(!agent_can_start(q->opts.agent)){
+                arm_admission_timer(0);
+                return;
+            }
+        }
+        //a local one also needs a token of the jobserver, if the shell is
+        //one; it is tried again when a token is given back
+        else if(jobserver_enabled() && !(q->job->has_token = jobserver_take())){
+            jobserver_wait();
+            arm_admission_timer(0);
+            return;
+        }
+        else if(!admission_admit(list_size(&q->pipe->commands), &retry_ms)){
+            give_token(q->job);
+            arm_admission_timer(retry_ms);
+            return;
+        }
+        q->job->status = BACKGROUND;
+        int error = q->opts.agent != 0 ? start_remote_job(q->job, q->pipe, q->opts.agent)
+                                       : start_job(q->job, q->pipe, &q->opts);
+        if(error != 0){
+            give_token(q->job);
+        }
+        if(error == EAGAIN && q->opts.agent == 0 && (retry_ms = admission_backoff_ms(q->attempts++)) != -1){
+            q->job->status = QUEUED;
+            q->not_before = now + retry_ms / 1000.0;
+            continue;
+        }
+        if(error != 0){
+            report_begin();
+            errno = error;
+            perror("Spawning: ");
+            end_client_job(q->job, error);
+        }
+        else if(q->opts.agent == 0){
+            q->job->admitted = true;
+            admission_job_started(q->job->num_processes_alive);
+        }
+        dequeue_job(q, error == 0);
+    }
+    arm_admission_timer(0);
+}
+
+static void
+admission_timer_ready(int fd, void *arg)
+{
+    uint64_t expirations;
+    if(read(fd, &expirations, sizeof expirations) == sizeof expirations){
+        admit_queued_jobs();
+        report_end();
+    }
+}
+
+/* Spawn all commands of a pipeline as a new job, as 'opts' says.
+ * A background job is queued for admit_queued_jobs, and reported as
+ * "Queued" if it cannot start right away.  A foreground job bypasses
+ * admission control, but if it cannot be spawned because the system is
+ * out of processes (EAGAIN), that is retried after a growing delay
+ * while the shell keeps reaping children.
+ * Takes ownership of 'pipe'.
+ * Returns NULL if not a single process of the pipeline could be started.
+ */
+static struct job *
+spawn_job(struct ast_pipeline *pipe, const struct spawn_options *opts)
+{
+    struct job *job = add_job(pipe, list_size(&pipe->commands));
+    job->has_saved_tty = false;
+    job->placement = opts->placement;
+    if(opts->client != NULL){
+        job->stream = server_stream_create(opts->client, job->jid);
+    }
+    if(opts->timeout.duration > 0){
+        job->timeout = opts->timeout;
+    }
+    if(pipe->bg_job && !opts->keep_terminal){
+        struct queued_job *q = calloc(1, sizeof *q);
+        q->job = job;
+        q->pipe = pipe;
+        q->opts = *opts;
+        job->status = QUEUED;
+        job->queued = q;
+        jobshm_update(job);
+        list_push_back(&queued_jobs, &q->elem);
+
+        int jid = job->jid;
+        admit_queued_jobs();
+        job = get_job_from_jid(jid);
+        if(job != NULL && job->status == QUEUED){
+            printf("[%d] Queued\n", job->jid);
+        }
+        return job;
+    }
+
+    job->status = pipe->bg_job ? BACKGROUND : FOREGROUND;
+    //it does not wait for a token of the jobserver, but uses a free one
+    job->has_token = jobserver_take();
+    int error, attempts = 0, delay_ms;
+    while((error = start_job(job, pipe, opts)) == EAGAIN
+          && (delay_ms = admission_backoff_ms(attempts++)) != -1){
+        double deadline = usage_now() + delay_ms / 1000.0;
+        double left;
+        while((left = deadline - usage_now()) > 0){
+            event_loop_run_once(left * 1000 + 1);
+        }
+    }
+    ast_pipeline_free(pipe);
+    if(error != 0){
+        errno = error;
+        perror("Spawning: ");
+        end_client_job(job, error);
+        give_token(job);
+        list_remove(&job->elem);
+        delete_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+/*
+ * Remove the prefixes of a pipeline from the arguments of its first
+ * command 'cmd', and record them in 'opts' and '*timed':
+ * 'time' in front of a pipeline reports what it used once it ends,
+ * 'perfstat' the counts of its performance counters,
+ * 'pin cpus' runs it on the given CPUs,
+ * 'timeout duration' signals it once it has run that long,
+ * 'on agent' runs it in the background on an agent (or on any).
+ * Returns false after printing an error to 'errors' if a prefix is not
+ * valid.
+ */
+static bool
+strip_prefixes(struct ast_command *cmd, struct spawn_options *opts, bool *timed, FILE *errors)
+{
+    for(;;){
+        char **argv = cmd->argv;
+        int words = 1;
+        if(argv[1] != NULL && strcmp(argv[0], "time")==0){
+            *timed = true;
+        }
+        else if(argv[1] != NULL && strcmp(argv[0], "perfstat")==0){
+            opts->counted = true;
+        }
+        else if(opts->placement == NULL && argv[1] != NULL && argv[2] != NULL
+                && strcmp(argv[0], "pin")==0 && (opts->placement = placement_parse(argv[1])) != NULL){
+            words = 2;
+        }
+        else if(opts->agent == 0 && argv[1] != NULL && argv[2] != NULL && strcmp(argv[0], "on")==0){
+            if(!agent_parse(argv[1], &opts->agent)){
+                return false;
+            }
+            words = 2;
+        }
+        else if(opts->timeout.duration == 0 && argv[1] != NULL && strcmp(argv[0], "timeout")==0){
+            words = timeout_parse(argv, &opts->timeout, errors);
+            if(words == -1){
+                return false;
+            }
+        }
+        else{
+            return true;
+        }
+        for(int w = 0; w < words; w++){
+            free(argv[0]);
+            for(int k = 0; argv[k] != NULL; k++){
+                argv[k] = argv[k + 1];
+            }
+        }
+    }
+}
+
+/* Run the built-in command 'p' if it is one.
+ * Returns false if p[0] does not name a built-in command.
+ */
+static bool
+handle_builtin(char **p)
+{
+    if(strcmp(p[0], "jobs")==0){          //jobs built-in command
+        //with -l, also show what each process has used so far,
+        //with -p, the performance counters of the jobs that have them
+        bool long_format = p[1] != NULL && strcmp(p[1], "-l")==0;
+        bool perf_format = p[1] != NULL && strcmp(p[1], "-p")==0;
+        //loop through job_list and print each job
+        for (struct list_elem * job_list_elem = list_begin(&job_list); 
+        job_list_elem != list_end(&job_list);
+        job_list_elem = list_next(job_list_elem)){
+            struct job *job_in_list = list_entry(job_list_elem, struct job, elem);
+            print_job(job_in_list);
+            if(long_format){
+                print_job_usage(job_in_list);
+            }
+            if(perf_format && job_in_list->perf != NULL){
+                perfstat_print(job_in_list->perf, "\t", stdout);
+            }
+        }
+    } 
+    else if(strcmp(p[0], "kill")==0){      //kill built-in command
+        //kill -9 (or -KILL) sends SIGKILL instead of SIGTERM
+        int sig = SIGTERM;
+        if(p[1] != NULL && (strcmp(p[1], "-9")==0 || strcmp(p[1], "-KILL")==0)){
+            sig = SIGKILL;
+            p++;
+        }
+        if(p[1] == NULL){
+            printf("job id missing\n");
+            return true;
+        }
+        struct job * kill_job = get_job_from_jid(atoi(p[1]));
+        if(kill_job == NULL){
+            printf("No such job\n");
+            return true;
+        }
+        //a job that has not started yet is just taken off the queue
+        if(kill_job->status == QUEUED){
+            dequeue_job(kill_job->queued, false);
+            return true;
+        }
+        if(signal_job(kill_job, sig) != 0){
+            printf("error detected");
+        }
+    }
+    else if(strcmp(p[0], "stop")==0){      //stop built-in command
+        if(p[1] == NULL){
+            printf("job id missing\n");
+            return true;
+        }
+        struct job * stop_job = get_job_from_jid(atoi(p[1]));
+        if(stop_job == NULL){
+            printf("No such job\n");
+            return true;
+        }
+        if(stop_job->status == QUEUED){
+            printf("stop: job %d has not started yet\n", stop_job->jid);
+            return true;
+        }
+        stop_job->status = STOPPED;
+        jobshm_update(stop_job);
+        if(signal_job(stop_job, SIGSTOP) != 0){
+            printf("stop failed\n");
+        }
+    }
+    else if(strcmp(p[0], "exit")==0){      //exit built-in command
+        exit(EXIT_SUCCESS);
+    }
+    else if(strcmp(p[0], "fg")==0){     //fg built-in command
+        struct job *fg_job = p[1] != NULL ? get_job_from_jid(atoi(p[1])) : NULL;
+        if(fg_job == NULL){
+            printf("No such job\n");
+            return true;
+        }
+        //a remote job has no terminal to be given
+        if(fg_job->remote != NULL || (fg_job->status == QUEUED && fg_job->queued->opts.agent != 0)){
+            printf("fg: job %d runs on an agent\n", fg_job->jid);
+            return true;
+        }
+
+        //a queued job is started right away, in the foreground
+        if(fg_job->status == QUEUED){
+            struct queued_job *q = fg_job->queued;
+            fg_job->status = FOREGROUND;
+            fg_job->has_token = jobserver_take();
+            int error = start_job(fg_job, q->pipe, &q->opts);
+            if(error != 0){
+                give_token(fg_job);
+            }
+            dequeue_job(q, error == 0);
+            if(error != 0){
+                errno = error;
+                perror("Spawning: ");
+                return true;
+            }
+            printf("%s\n", fg_job->cmdline);
+            wait_for_job(fg_job);
+            return true;
+        }
+        if(fg_job->has_saved_tty == true){
+            termstate_give_terminal_to(&fg_job->saved_tty_state, fg_job->pgid);
+        }
+        else{
+        termstate_give_terminal_to(NULL, fg_job->pgid);
+        }
+        if(fg_job->status == STOPPED){
+            if(signal_job(fg_job, SIGCONT) != 0){
+                printf("error detected");
+            }
+        }
+        if(fg_job->status == NEEDSTERMINAL){
+            tcsetpgrp(termstate_get_tty_fd(), fg_job->pgid);
+            if(signal_job(fg_job, SIGCONT) != 0){
+                printf("error detected");
+            }
+        }
+        fg_job->status = FOREGROUND;
+        priority_job_changed(fg_job);
+        jobshm_update(fg_job);
+        printf("%s\n", fg_job->cmdline);
+        
+        wait_for_job(fg_job);
+    }
+    else if(strcmp(p[0], "bg")==0){     //bg built-in command
+        struct job *bg_job = p[1] != NULL ? get_job_from_jid(atoi(p[1])) : NULL;
+        if(bg_job == NULL){
+            printf("No such job\n");
+            return true;
+        }
+        if(bg_job->status == QUEUED){
+            printf("[%d] Queued\n", bg_job->jid);
+            return true;
+        }
+        if(bg_job->status == STOPPED){
+            if(signal_job(bg_job, SIGCONT) != 0){
+                printf("error detected");
+            }
+            bg_job->status = BACKGROUND; //how to change from current state to running
+            priority_job_changed(bg_job);
+            jobshm_update(bg_job);
+        }
+        printf("[%d] %d\n", bg_job->jid, bg_job->pgid);
+    }
+    else if(strcmp(p[0], "hash")==0){      //hash built-in command
+        if(p[1] == NULL){
+            path_cache_print();
+        }
+        else if(strcmp(p[1], "-r")==0){
+            path_cache_clear();
+        }
+        else{
+            for(int k = 1; p[k] != NULL; k++){
+                if(!path_cache_add(p[k])){
+                    printf("hash: %s: not found\n", p[k]);
+                }
+            }
+        }
+    }
+    else if(strcmp(p[0], "wait")==0){      //wait built-in command
+        wait_builtin(p);
+    }
+    else if(strcmp(p[0], "admission")==0){ //admission built-in command
+        admission_builtin(p);
+    }
+    else if(strcmp(p[0], "cgroup")==0){    //cgroup built-in command
+        cgroup_builtin(p);
+    }
+    else if(strcmp(p[0], "pin")==0){    //pin built-in command
+        placement_builtin(p);
+    }
+    else if(strcmp(p[0], "priority")==0){   //priority built-in command
+        priority_builtin(p);
+    }
+    else if(strcmp(p[0], "jobshm")==0){     //jobshm built-in command
+        jobshm_builtin(p);
+    }
+    else if(strcmp(p[0], "agent")==0){      //agent built-in command
+        agent_builtin(p);
+    }
+    else if(strcmp(p[0], "jobserver")==0){  //jobserver built-in command
+        jobserver_builtin(p);
+    }
+    else if(strcmp(p[0], "history")==0){
+        HISTORY_STATE *history = history_get_history_state();
+        for(int k=0; k<history->length; k++){
+            printf("%d  %s\n", k+1, history->entries[k]->line);
+        }
+    }
+    else{
+        return false;
+    }
+    return true;
+}
 
-/* Utility functions for job list management.
- * We use 2 data structures: 
- * (a) an array jid2job to quickly find a job based on its id
- * (b) a linked list to support iteration
- */
-#define MAXJOBS (1<<16)
-static struct list job_list;
+/* Set when Ctrl-C is typed while a builtin runs jobs (parallel, dag) */
+static bool builtin_interrupted;
 
-static struct job * jid2job[MAXJOBS];
+/* signalfds for SIGINT and SIGTSTP while a builtin runs jobs */
+static int sigint_fd = -1, sigtstp_fd = -1;
 
-/* Return job corresponding to jid */
-static struct job * 
-get_job_from_jid(int jid)
+/* Reads the signals the shell receives itself while a builtin runs jobs */
+static void
+interrupt_ready(int fd, void *arg)
 {
-    if (jid > 0 && jid < MAXJOBS && jid2job[jid] != NULL)
-        return jid2job[jid];
-
-    return NULL;
+    struct signalfd_siginfo info;
+    while (read(fd, &info, sizeof info) == sizeof info){
+        if(info.ssi_signo == SIGINT){
+            builtin_interrupted = true;
+        }
+    }
 }
 
-/* Add a new job to the job list */
-static struct job *
-add_job(struct ast_pipeline *pipe)
+/* While a builtin runs jobs, the shell keeps the terminal, so Ctrl-C
+ * and Ctrl-Z reach the shell; read them instead of being killed or
+ * stopped by them.  Ctrl-Z is ignored. */
+static void
+watch_interrupts(void)
 {
-    struct job * job = malloc(sizeof *job);
-    job->pipe = pipe;
-    job->num_processes_alive = 0;
-    list_push_back(&job_list, &job->elem);
-    for (int i = 1; i < MAXJOBS; i++) {
-        if (jid2job[i] == NULL) {
-            jid2job[i] = job;
-            job->jid = i;
-            return job;
-        }
-    }
-    fprintf(stderr, "Maximum number of jobs exceeded\n");
-    abort();
-    return NULL;
+    builtin_interrupted = false;
+    sigint_fd = signal_create_fd(SIGINT);
+    sigtstp_fd = signal_create_fd(SIGTSTP);
+    event_loop_add(sigint_fd, interrupt_ready, NULL);
+    event_loop_add(sigtstp_fd, interrupt_ready, NULL);
 }
 
-/* Delete a job.
- * This should be called only when all processes that were
- * forked for this job are known to have terminated.
- */
 static void
-delete_job(struct job *job)
+unwatch_interrupts(void)
 {
-    int jid = job->jid;
-    assert(jid != -1);
-    jid2job[jid]->jid = -1;
-    jid2job[jid] = NULL;
-    ast_pipeline_free(job->pipe);
-    free(job);
+    event_loop_remove(sigint_fd);
+    event_loop_remove(sigtstp_fd);
+    signal_close_fd(SIGINT, sigint_fd);
+    signal_close_fd(SIGTSTP, sigtstp_fd);
+    sigint_fd = sigtstp_fd = -1;
 }
 
-static const char *
-get_status(enum job_status status)
+/* Spawn a job that a builtin runs itself, alongside others: the shell
+ * keeps the terminal, the job reads from /dev/null unless redirected,
+ * and its stdout is 'output_fd' unless that is -1. */
+static struct job *
+spawn_builtin_job(struct ast_pipeline *pipe, int output_fd)
 {
-    switch (status) {
-    case FOREGROUND:
-        return "Foreground";
-    case BACKGROUND:
-        return "Running";
-    case STOPPED:
-        return "Stopped";
-    case NEEDSTERMINAL:
-        return "Stopped (tty)";
-    default:
-        return "Unknown";
+    if(pipe->iored_input == NULL){
+        pipe->iored_input = strdup("/dev/null");
     }
+    pipe->bg_job = false;
+    struct spawn_options opts = { .keep_terminal = true, .output_fd = output_fd };
+    return spawn_job(pipe, &opts);
 }
 
-/* Print the command line that belongs to one job. */
+/*
+ * The parallel builtin:
+ *   parallel [-j N] [--tag] [--keep-order] command [arg...] [::: item...]
+ * runs 'command' once for each item, as a job of its own, with at most N
+ * (by default, the number of CPUs) of them running at a time.  The items
+ * follow ':::', or are read one per line from the input of the builtin:
+ * the file it is redirected from, the output of the commands piped into
+ * it, or else the shell's stdin.  The instances read from /dev/null and
+ * write to the output of the builtin, through parallel_output if it is
+ * to be tagged or kept in order.
+ * parallel always runs in the foreground, while the shell keeps the
+ * terminal; Ctrl-C sends SIGINT to the running instances and starts no
+ * further ones.  Takes ownership of 'pipe'.
+ */
 static void
-print_cmdline(struct ast_pipeline *pipeline)
+parallel_builtin(struct ast_pipeline *pipe)
 {
-    struct list_elem * e = list_begin (&pipeline->commands); 
-    for (; e != list_end (&pipeline->commands); e = list_next(e)) {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        if (e != list_begin(&pipeline->commands))
-            printf("| ");
-        char **p = cmd->argv;
-        printf("%s", *p++);
-        while (*p)
-            printf(" %s", *p++);
+    struct ast_command *cmd = list_entry(list_pop_back(&pipe->commands), struct ast_command, elem);
+    struct parallel_args args;
+    if(!parallel_parse_args(cmd->argv, &args)){
+        ast_command_free(cmd);
+        ast_pipeline_free(pipe);
+        return;
+    }
+
+    int output_fd = -1;
+    if(pipe->iored_output != NULL){
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (pipe->append_to_output ? O_APPEND : O_TRUNC);
+        output_fd = open(pipe->iored_output, flags, S_IRWXU);
+        if(output_fd == -1){
+            printf("parallel: cannot open %s\n", pipe->iored_output);
+            ast_command_free(cmd);
+            ast_pipeline_free(pipe);
+            return;
+        }
+    }
+
+    char **read_items = NULL;
+    if(args.items == NULL){
+        int input_fd = STDIN_FILENO;
+        if(!list_empty(&pipe->commands)){
+            //the commands piped into parallel run as a job of their own
+            int fds[2];
+            if(pipe2(fds, O_CLOEXEC) == 0){
+                struct spawn_options opts = { .keep_terminal = true, .output_fd = fds[1] };
+                pipe->bg_job = false;
+                spawn_job(pipe, &opts);
+                close(fds[1]);
+                input_fd = fds[0];
+            }
+            else{
+                input_fd = -1;
+                ast_pipeline_free(pipe);
+            }
+            pipe = NULL;
+        }
+        else if(pipe->iored_input != NULL){
+            input_fd = open(pipe->iored_input, O_RDONLY | O_CLOEXEC);
+        }
+        if(input_fd == -1){
+            printf("parallel: cannot read items\n");
+        }
+        else{
+            read_items = parallel_read_items(input_fd, &args.num_items);
+            args.items = read_items;
+        }
+        if(input_fd != -1 && input_fd != STDIN_FILENO){
+            close(input_fd);
+        }
     }
+    if(pipe != NULL){
+        ast_pipeline_free(pipe);
+    }
+
+    struct parallel_output *out = NULL;
+    if(args.tag || args.keep_order){
+        out = parallel_output_create(args.tag, args.keep_order, output_fd != -1 ? output_fd : STDOUT_FILENO);
+    }
+    watch_interrupts();
+    bool interrupt_sent = false;
+
+    struct job **running = calloc(args.jobs, sizeof *running);
+    int num_running = 0, num_failed = 0;
+    size_t next = 0;
+    for(;;){
+        //start an instance for the next item in every free slot
+        for(int slot = 0; slot < args.jobs; slot++){
+            while(running[slot] == NULL && next < args.num_items && !builtin_interrupted){
+                const char *item = args.items[next++];
+                struct ast_pipeline *instance = ast_pipeline_create(NULL, NULL, false);
+                ast_pipeline_add_command(instance, ast_command_create(parallel_command(&args, item), false));
+                int instance_fd = out != NULL ? parallel_output_add(out, item) : output_fd;
+                running[slot] = spawn_builtin_job(instance, instance_fd);
+                if(out != NULL && instance_fd != -1){
+                    close(instance_fd);
+                }
+                if(running[slot] == NULL){
+                    num_failed++;
+                }
+                else{
+                    num_running++;
+                }
+            }
+        }
+        if(num_running == 0 && (out == NULL || !parallel_output_busy(out))){
+            break;
+        }
+
+        event_loop_run_once(-1);
+
+        if(builtin_interrupted && !interrupt_sent){
+            for(int slot = 0; slot < args.jobs; slot++){
+                if(running[slot] != NULL){
+                    signal_job(running[slot], SIGINT);
+                }
+            }
+            interrupt_sent = true;
+        }
+        //an instance is done once all of its processes have exited
+        for(int slot = 0; slot < args.jobs; slot++){
+            if(running[slot] != NULL && running[slot]->num_processes_alive == 0){
+                int status = job_exit_status(running[slot]);
+                if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+                    num_failed++;
+                }
+                running[slot] = NULL;
+                num_running--;
+            }
+        }
+        clean_jobs_list();
+    }
+    if(num_failed > 0){
+        printf("parallel: %d of %zu instances failed\n", num_failed, next);
+    }
+
+    unwatch_interrupts();
+    if(out != NULL){
+        parallel_output_destroy(out);
+    }
+    if(output_fd != -1){
+        close(output_fd);
+    }
+    free(running);
+    if(read_items != NULL){
+        parallel_free_items(read_items);
+    }
+    ast_command_free(cmd);
 }
 
-/* Print a job */
-static void
-print_job(struct job *job)
+/* Describe how a job ended, for messages: "exit 1", "Terminated", ... */
+static const char *
+describe_exit(int status)
 {
-    printf("[%d]\t%s\t\t(", job->jid, get_status(job->status));
-    print_cmdline(job->pipe);
-    printf(")\n");
+    static char buf[32];
+    if(WIFSIGNALED(status)){
+        return strsignal(WTERMSIG(status));
+    }
+    snprintf(buf, sizeof buf, "exit %d", WEXITSTATUS(status));
+    return buf;
 }
 
-/*
- * Suggested SIGCHLD handler.
- *
- * Call waitpid() to learn about any child processes that
- * have exited or changed status (been stopped, needed the
- * terminal, etc.)
- * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
- * Use a loop with WNOHANG since only a single SIGCHLD 
- * signal may be delivered for multiple children that have 
- * exited. All of them need to be reaped.
- */
+/* Start the next pipeline of a running dag node, or end the node if it
+ * has none left or 'failed' is set. */
 static void
-sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
+dag_node_advance(struct dag *dag, struct dag_node *node, bool failed)
 {
-    pid_t child;
-    int status;
-
-    assert(sig == SIGCHLD);
-
-    while ((child = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0) {
-        handle_child_status(child, status);
+    node->job = NULL;
+    while(!failed && !list_empty(&node->pipelines->pipes)){
+        struct ast_pipeline *pipe = list_entry(list_pop_front(&node->pipelines->pipes), struct ast_pipeline, elem);
+        node->job = spawn_builtin_job(pipe, -1);
+        if(node->job != NULL){
+            return;
+        }
+        printf("dag: %s: cannot be started\n", node->name);
+        failed = true;
     }
+    double seconds = usage_now() - node->start_time;
+    dag_node_ended(dag, node, !failed, seconds);
+    printf("dag: %s %s after %.1fs\n", node->name, failed ? "failed" : "done", seconds);
 }
 
-/* Wait for all processes in this job to complete, or for
- * the job no longer to be in the foreground.
- * You should call this function from a) where you wait for
- * jobs started without the &; and b) where you implement the
- * 'fg' command.
- * 
- * Implement handle_child_status such that it records the 
- * information obtained from waitpid() for pid 'child.'
- *
- * If a process exited, it must find the job to which it
- * belongs and decrement num_processes_alive.
- *
- * However, note that it is not safe to call delete_job
- * in handle_child_status because wait_for_job assumes that
- * even jobs with no more num_processes_alive haven't been
- * deallocated.  You should postpone deleting completed
- * jobs from the job list until when your code will no
- * longer touch them.
- *
- * The code below relies on `job->status` having been set to FOREGROUND
- * and `job->num_processes_alive` having been set to the number of
- * processes successfully forked for this job.
+/*
+ * The dag builtin:
+ *   dag [-j N] [-f] file
+ * runs the nodes of the dependency graph in 'file' (see dag.h), each of
+ * whose pipelines is run as a job, with at most N (by default, the
+ * number of CPUs) nodes running at a time.  Of the nodes that are ready,
+ * the one with the longest critical path is started first.  Nodes that
+ * succeeded in an earlier run are skipped, unless -f is given.
+ * As soon as a node fails, no further nodes are started and the running
+ * ones are terminated; Ctrl-C interrupts them likewise.
  */
 static void
-wait_for_job(struct job *job)
+dag_builtin(char **p)
 {
-    assert(signal_is_blocked(SIGCHLD));
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_running = ncpus > 0 ? ncpus : 1;
+    bool force = false;
+    int k = 1;
+    for(; p[k] != NULL && p[k][0] == '-'; k++){
+        if(strcmp(p[k], "-f")==0){
+            force = true;
+        }
+        else if(strcmp(p[k], "-j")==0 && p[k + 1] != NULL && atoi(p[k + 1]) > 0){
+            max_running = atoi(p[++k]);
+        }
+        else{
+            break;
+        }
+    }
+    if(p[k] == NULL || p[k + 1] != NULL){
+        printf("usage: dag [-j N] [-f] file\n");
+        return;
+    }
+    struct dag *dag = dag_load(p[k]);
+    if(dag == NULL){
+        return;
+    }
+    dag_plan(dag, force);
 
-    while (job->status == FOREGROUND && job->num_processes_alive > 0) {
-        int status;
+    watch_interrupts();
+    int num_running = 0;
+    bool stopping = false, stop_sent = false;
+    for(;;){
+        struct dag_node *node;
+        while(!stopping && num_running < max_running && (node = dag_next_ready(dag)) != NULL){
+            printf("dag: %s started\n", node->name);
+            node->state = DAG_RUNNING;
+            node->start_time = usage_now();
+            dag_node_advance(dag, node, false);
+            if(node->state == DAG_RUNNING){
+                num_running++;
+            }
+            stopping |= node->state == DAG_FAILED;
+        }
+        if(num_running == 0){
+            break;
+        }
+
+        event_loop_run_once(-1);
+
+        //a node moves on to its next pipeline once all processes of the
+        //current one have exited
+        for(int i = 0; i < dag->num_nodes; i++){
+            node = &dag->nodes[i];
+            if(node->state != DAG_RUNNING || node->job->num_processes_alive > 0){
+                continue;
+            }
+            int status = job_exit_status(node->job);
+            bool failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            if(failed){
+                printf("dag: %s: %s (%s)\n", node->name, node->job->cmdline, describe_exit(status));
+            }
+            dag_node_advance(dag, node, failed || stopping);
+            if(node->state != DAG_RUNNING){
+                num_running--;
+            }
+            stopping |= node->state == DAG_FAILED;
+        }
+        clean_jobs_list();
 
-        pid_t child = waitpid(-1, &status, WUNTRACED);
+        stopping |= builtin_interrupted;
+        if(stopping && !stop_sent){
+            for(int i = 0; i < dag->num_nodes; i++){
+                if(dag->nodes[i].state == DAG_RUNNING){
+                    signal_job(dag->nodes[i].job, builtin_interrupted ? SIGINT : SIGTERM);
+                }
+            }
+            stop_sent = true;
+        }
+    }
+    unwatch_interrupts();
 
-        // When called here, any error returned by waitpid indicates a logic
-        // bug in the shell.
-        // In particular, ECHILD "No child process" means that there has
-        // already been a successful waitpid() call that reaped the child, so
-        // there's likely a bug in handle_child_status where it failed to update
-        // the "job" status and/or num_processes_alive fields in the required
-        // fashion.
-        // Since SIGCHLD is blocked, there cannot be races where a child's exit
-        // was handled via the SIGCHLD signal handler.
-        if (child != -1)
-            handle_child_status(child, status);
-        else
-            utils_fatal_error("waitpid failed, see code for explanation");
+    int counts[DAG_FAILED + 1] = { 0 };
+    for(int i = 0; i < dag->num_nodes; i++){
+        counts[dag->nodes[i].state]++;
     }
+    printf("dag: %d done, %d skipped, %d failed, %d not run\n",
+           counts[DAG_DONE], counts[DAG_SKIPPED], counts[DAG_FAILED], counts[DAG_WAITING]);
+    dag_free(dag);
 }
 
+/* The built-in commands, which a client of a serving shell cannot run */
+static const char *builtin_names[] = {
+    "jobs", "fg", "bg", "kill", "stop", "exit", "history", "wait", "hash",
+    "admission", "cgroup", "pin", "priority", "jobshm", "agent", "jobserver", "dag", "parallel", NULL
+};
 
-
-static void
-handle_child_status(pid_t pid, int status)
+static bool
+is_builtin(const char *name)
 {
-    assert(signal_is_blocked(SIGCHLD));
-    struct job *curr_job = NULL;
-    for (struct list_elem * job_elem = list_begin(&job_list);   //loop through job list
-    job_elem != list_end(&job_list);
-    job_elem = list_next(job_elem)){
-        struct job *list_job = list_entry(job_elem, struct job, elem);  //get each job
-        //loop through pid array
-        for (int k=0; k<list_job->pid_counter; k++){
-            if(list_job->pid_array[k] == pid){   //compare pid in the job's pid list to the pid we are looking for
-                curr_job = list_job;
-                break;      //exit loop when found
-            }
+    for(int i = 0; builtin_names[i] != NULL; i++){
+        if(strcmp(name, builtin_names[i])==0){
+            return true;
         }
     }
+    return false;
+}
 
-    if(curr_job == NULL){
-        printf("job not found :(\n");
-        exit(0);
+/* A client asks to run a command line: each of its pipelines becomes a
+ * background job of its own, which admission control may queue, with
+ * stdin from /dev/null unless redirected and its output sent to the
+ * client.  Its prefixes are those of the interactive shell. */
+static void
+serve_run(struct server_client *client, char *cmdline)
+{
+    struct ast_command_line *cline = ast_parse_command_line(cmdline);
+    if(cline == NULL){
+        server_send(client, "error syntax error");
+        return;
     }
-    // Step 2. Determine what status change occurred using the WIF*() macros.
-    // // Step 3. Update the job status accordingly, and adjust num_processes_alive if appropriate. 
-    // // If a process was stopped, save the terminal state.
-    if(WIFSTOPPED(status)){
-        if(WSTOPSIG(status) == SIGTTOU || WSTOPSIG(status) == SIGTTIN){
-            curr_job->status = NEEDSTERMINAL;
+    while(!list_empty(&cline->pipes)){
+        struct ast_pipeline *pipe = list_entry(list_pop_front(&cline->pipes), struct ast_pipeline, elem);
+        struct ast_command *first_cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+        struct ast_command *last_cmd = list_entry(list_back(&pipe->commands), struct ast_command, elem);
+        struct spawn_options opts = { .output_fd = -1, .client = client };
+        bool timed = false;
+        //why a prefix is not valid goes to the client
+        char *reason = NULL;
+        size_t reason_len = 0;
+        FILE *errors = open_memstream(&reason, &reason_len);
+        bool valid = strip_prefixes(first_cmd, &opts, &timed, errors);
+        fclose(errors);
+        reason[strcspn(reason, "\n")] = '\0';
+        if(!valid && *reason != '\0'){
+            server_send(client, "error %s", reason);
         }
-        else if(WSTOPSIG(status) == SIGTSTP || WSTOPSIG(status) == SIGSTOP){
-            termstate_save(&curr_job->saved_tty_state);
-            curr_job->status = STOPPED;
-            print_job(curr_job);
-            curr_job->has_saved_tty = true;
+        else if(!valid){
+            server_send(client, "error %s: invalid prefix", first_cmd->argv[0]);
         }
-    }
-    else if(WIFEXITED(status)){
-        curr_job->num_processes_alive--;
-    }
-    else if(WIFSIGNALED(status)){
-        curr_job->num_processes_alive--;
-        if(WTERMSIG(status)==SIGFPE){
-            printf("floating point exception");
+        else if(opts.agent != 0){
+            server_send(client, "error on: jobs of clients cannot run on agents");
         }
-        else if(WTERMSIG(status) == SIGSEGV){
-            printf("segmentation fault");
+        //their reports would go to the server's log, not to the client
+        else if(timed || opts.counted){
+            server_send(client, "error %s: reports are not sent to clients", timed ? "time" : "perfstat");
         }
-        else if(WTERMSIG(status) == SIGABRT){
-            printf("aborted");
+        else if(is_builtin(first_cmd->argv[0]) || is_builtin(last_cmd->argv[0])){
+            server_send(client, "error %s: built-in commands cannot be run", first_cmd->argv[0]);
         }
-        else if(WTERMSIG(status) == SIGKILL){
-            printf("killed");
+        else{
+            if(pipe->iored_input == NULL){
+                pipe->iored_input = strdup("/dev/null");
+            }
+            pipe->bg_job = true;
+            spawn_job(pipe, &opts);
+            free(reason);
+            continue;
         }
-        else if(WTERMSIG(status) == SIGTERM){
-            printf("terminated");
+        free(reason);
+        if(opts.placement != NULL){
+            placement_release(opts.placement);
         }
-        else{
-            printf("unknown signal");
+        ast_pipeline_free(pipe);
+    }
+    ast_command_line_free(cline);
+}
+
+/* A client asks for the jobs of all clients */
+static void
+serve_list(struct server_client *client)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)){
+        struct job *job = list_entry(e, struct job, elem);
+        server_send(client, "list %d %s\t%s", job->jid, get_status(job), job->cmdline);
+    }
+    server_send(client, "end");
+}
+
+/* A client asks to terminate a job, or to drop it if it is still queued */
+static void
+serve_cancel(struct server_client *client, int jid)
+{
+    struct job *job = get_job_from_jid(jid);
+    if(job == NULL){
+        server_send(client, "error %d: no such job", jid);
+        return;
+    }
+    if(job->status == QUEUED){
+        dequeue_job(job->queued, false);
+    }
+    else{
+        signal_job(job, SIGTERM);
+        signal_job(job, SIGCONT);
+    }
+    server_send(client, "ok");
+}
+
+/* A client has gone: its jobs are terminated.  Not with SIGHUP, as a
+ * terminal's would be, since a server started with nohup passes on
+ * ignoring that. */
+static void
+serve_disconnected(struct server_client *client)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); ){
+        struct job *job = list_entry(e, struct job, elem);
+        e = list_next(e);
+        if(job->stream == NULL || server_stream_client(job->stream) != client){
+            continue;
+        }
+        if(job->status == QUEUED){
+            dequeue_job(job->queued, false);
+        }
+        else if(job->num_processes_alive > 0){
+            signal_job(job, SIGTERM);
+            signal_job(job, SIGCONT);
         }
     }
-    termstate_give_terminal_back_to_shell();
 }
 
-//removes all jobs with no more processes alive from the job list
-//also deletes the job
-static void clean_jobs_list(){
-    struct list_elem * job_elem = list_begin(&job_list);
-    while (job_elem != list_end(&job_list)){
-        struct job *list_job = list_entry(job_elem, struct job, elem);
-        if(list_job->num_processes_alive==0){
-            job_elem = list_remove(job_elem);
-            delete_job(list_job);
+/* SIGTERM or SIGINT ends a serving shell: its jobs are terminated, and
+ * it exits, which removes its socket */
+static void
+serve_stop_ready(int fd, void *arg)
+{
+    struct signalfd_siginfo info;
+    if(read(fd, &info, sizeof info) != sizeof info){
+        return;
+    }
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)){
+        struct job *job = list_entry(e, struct job, elem);
+        if(job->num_processes_alive > 0){
+            signal_job(job, SIGTERM);
+            signal_job(job, SIGCONT);
         }
-        else{
-            job_elem = list_next(job_elem);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/* Run headless, serving the clients of the socket 'path' until stopped.
+ * Without a user at a terminal to give way to, background jobs are not
+ * demoted. */
+static void
+serve(const char *path)
+{
+    static const struct server_ops ops = {
+        .run = serve_run,
+        .list = serve_list,
+        .cancel = serve_cancel,
+        .disconnected = serve_disconnected,
+    };
+    if(!server_init(path, &ops)){
+        exit(EXIT_FAILURE);
+    }
+    char *priority_off[] = { "priority", "off", NULL };
+    priority_builtin(priority_off);
+    event_loop_add(signal_create_fd(SIGTERM), serve_stop_ready, NULL);
+    event_loop_add(signal_create_fd(SIGINT), serve_stop_ready, NULL);
+    //its messages go to a log rather than a terminal
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    for(;;){
+        event_loop_run_once(-1);
+        clean_jobs_list();
+    }
+}
+
+/* The line read by readline, once line_ready is set */
+static char *pending_line;
+static bool line_ready;
+
+/* Called by readline with a complete line, or NULL on EOF */
+static void
+line_handler(char *line)
+{
+    pending_line = line;
+    line_ready = true;
+    prompting = false;
+    rl_callback_handler_remove();
+    event_loop_remove(STDIN_FILENO);
+}
+
+static void
+stdin_ready(int fd, void *arg)
+{
+    rl_callback_read_char();
+}
+
+/*
+ * Read a command line with readline in callback mode, which is fed one
+ * character at a time as the terminal becomes readable.  Meanwhile, the
+ * event loop keeps reaping children and reporting on background jobs.
+ * Returns NULL on EOF.
+ */
+static char *
+read_command_line(void)
+{
+    /* Do not output a prompt unless shell's stdin is a terminal */
+    char * prompt = isatty(0) ? build_prompt() : NULL;
+    line_ready = false;
+    prompting = true;
+    rl_callback_handler_install(prompt, line_handler);
+    free (prompt);
+
+    if (event_loop_add(STDIN_FILENO, stdin_ready, NULL)) {
+        while (!line_ready)
+            event_loop_run_once(-1);
+    }
+    else {
+        //stdin cannot be polled (it is a regular file), so it is always
+        //ready; children are still reaped between characters
+        while (!line_ready) {
+            event_loop_run_once(0);
+            rl_callback_read_char();
         }
     }
+    return pending_line;
 }
 
 int
 main(int ac, char *av[])
 {
     int opt;
+    char *serve_path = NULL;
+    char *max_jobs = NULL;
+    char *jobserver_tokens = NULL;
+    static const struct option long_options[] = {
+        { "serve", required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 },
+    };
 
     /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0) {
+    while ((opt = getopt_long(ac, av, "hs:j:J:", long_options, NULL)) > 0) {
         switch (opt) {
         case 'h':
             usage(av[0]);
             break;
+        case 's':
+            spawn_pool_init(atoi(optarg));
+            break;
+        case 'S':
+            serve_path = optarg;
+            break;
+        case 'j':
+            max_jobs = optarg;
+            break;
+        case 'J':
+            jobserver_tokens = optarg;
+            break;
         }
     }
 
-    list_init(&job_list);
-    signal_set_handler(SIGCHLD, sigchld_handler);
+    jobs_init();
+    static const struct job_hooks job_hooks = {
+        .changed = job_changed,
+        .deleted = job_deleted,
+        .location = job_location,
+        .group_usage = job_group_usage,
+    };
+    jobs_set_hooks(&job_hooks);
+    path_cache_init();
+    admission_init();
+    if (max_jobs != NULL) {
+        //the same limit as "admission jobs=njobs"
+        char limit[32];
+        snprintf(limit, sizeof limit, "jobs=%s", max_jobs);
+        char *argv[] = { "admission", limit, NULL };
+        admission_builtin(argv);
+    }
+    cgroup_init();
+    placement_init();
+    priority_init();
+    event_loop_init();
+    //SIGCHLD stays blocked; the event loop learns of it through a signalfd
+    sigchld_fd = signal_create_fd(SIGCHLD);
+    event_loop_add(sigchld_fd, sigchld_ready, NULL);
+    //queued background jobs are tried again when this timer fires
+    list_init(&queued_jobs);
+    admission_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    event_loop_add(admission_timer_fd, admission_timer_ready, NULL);
+    //as are the time limits of jobs
+    timeout_init(signal_job);
+    jobshm_init();
+    //jobs may run on agents, whose news the event loop brings
+    static const struct agent_ops agent_ops = {
+        .process_changed = remote_process_changed,
+        .output = remote_output,
+        .slot_freed = retry_queued_jobs,
+    };
+    agent_init(&agent_ops);
+    //and on tokens that jobs and makes give back to the jobserver
+    jobserver_init(retry_queued_jobs);
+    if (jobserver_tokens != NULL) {
+        char *argv[] = { "jobserver", "on", jobserver_tokens, NULL };
+        jobserver_builtin(argv);
+    }
+    if (serve_path != NULL) {
+        serving = true;
+        serve(serve_path);
+    }
     termstate_init();
 
     //start history session
@@ -373,13 +1878,11 @@ main(int ac, char *av[])
     /* Read/eval loop. */
     for (;;) {
 
-        /* If you fail this assertion, you were about to enter readline()
-         * while SIGCHLD is blocked.  This means that your shell would be
-         * unable to receive SIGCHLD signals, and thus would be unable to
-         * wait for background jobs that may finish while the
+        /* SIGCHLD must stay blocked, or it would no longer be reported
+         * through the signalfd the event loop waits on while the
          * shell is sitting at the prompt waiting for user input.
          */
-        assert(!signal_is_blocked(SIGCHLD));
+        assert(signal_is_blocked(SIGCHLD));
 
         /* If you fail this assertion, you were about to call readline()
          * without having terminal ownership.
@@ -389,10 +1892,7 @@ main(int ac, char *av[])
          */
         assert(termstate_get_current_terminal_owner() == getpgrp());
 
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char * prompt = isatty(0) ? build_prompt() : NULL;
-        char * cmdline = readline(prompt);
-        free (prompt);
+        char * cmdline = read_command_line();
 
         if (cmdline == NULL)  /* User typed EOF */
             break;
@@ -415,246 +1915,58 @@ main(int ac, char *av[])
         // ast_command_line_print(cline);      /* Output a representation of
                                             //    the entered command line */
 
-        signal_block(SIGCHLD);
-        bool is_builtin_flag = false;
+        //while the first pipeline runs, warm the page cache for the
+        //programs of the ones that follow it
+        prefetch_command_line(cline);
+
         //loop through command line struct (terminal input)
-        for (struct list_elem * command_line_elem = list_begin (&cline->pipes); 
-         command_line_elem != list_end (&cline->pipes); 
-         command_line_elem = list_remove(command_line_elem)) {
-            struct ast_pipeline *pipe = list_entry(command_line_elem, struct ast_pipeline, elem);
-            struct job *added_job = NULL;
-            bool spawn_success = true;
-            int pipeinput[2] = {0, 0};
-            int pipeoutput[2] = {0, 0};
-            //loop through pipeline struct (terminal input)
-            for (struct list_elem * pipeline_elem = list_begin(&pipe->commands); 
-                pipeline_elem != list_end(&pipe->commands); 
-                pipeline_elem = list_next(pipeline_elem)) {
-                struct ast_command *cmd = list_entry(pipeline_elem, struct ast_command, elem);
-                char **p = cmd->argv;
-                //look at commands (terminal input)
-                if(strcmp(p[0], "jobs")==0){          //jobs built-in command
-                    is_builtin_flag = true;
-                    //loop through job_list and print each job
-                    for (struct list_elem * job_list_elem = list_begin(&job_list); 
-                    job_list_elem != list_end(&job_list);
-                    job_list_elem = list_next(job_list_elem)){
-                        struct job *job_in_list = list_entry(job_list_elem, struct job, elem);
-                        print_job(job_in_list);
-                    }
-                } 
-                else if(strcmp(p[0], "kill")==0){      //kill built-in command
-                    is_builtin_flag = true;
-                    if(p[1] == NULL){
-                        printf("job id missing\n");
-                    }
-                    struct job * kill_job = get_job_from_jid(atoi(p[1]));
-                    if(kill_job == NULL){
-                        printf("No such job\n");
-                    }
-                    //loop through child pids then kill all child pids
-                    for(int k = 0; k < kill_job->num_processes_alive; k++){
-                        if(kill(kill_job->pid_array[k], SIGTERM) != 0){
-                            printf("error detected");
-                        };
-                    }
-                    //then kill the pgid
-                    if(kill(kill_job->pgid, SIGTERM) != 0){
-                        printf("error detected");
-                    }
-                }
-                else if(strcmp(p[0], "stop")==0){      //stop built-in command
-                    is_builtin_flag = true;
-                    if(p[1] == NULL){
-                        printf("job id missing\n");
-                    }
-                    struct job * stop_job = get_job_from_jid(atoi(p[1]));
-                    if(stop_job == NULL){
-                        printf("No such job\n");
-                    }
-                    for(int k = 0; k < stop_job->num_processes_alive; k++){
-                        if(kill(stop_job->pid_array[k], SIGSTOP) != 0){
-                            printf("error detected");
-                        }
-                    }
-                    stop_job->status = STOPPED;
-                    if(kill(stop_job->pgid, SIGSTOP)!=0){
-                        printf("stop failed\n");
-                    }  //kill the entire process group
-                }
-                else if(strcmp(p[0], "exit")==0){      //exit built-in command
-                    is_builtin_flag = true;
-                    exit(EXIT_SUCCESS);
-                }
-                else if(strcmp(p[0], "fg")==0){     //fg built-in command
-                    is_builtin_flag = true;
-                    struct job *fg_job = get_job_from_jid(atoi(p[1]));
-                    
-                    if(fg_job->has_saved_tty == true){
-                        termstate_give_terminal_to(&fg_job->saved_tty_state, fg_job->pgid);
-                    }
-                    else{
-                    termstate_give_terminal_to(NULL, fg_job->pgid);
-                    }
-                    if(fg_job->status == STOPPED){
-                        if(killpg(fg_job->pgid, SIGCONT) != 0){
-                            printf("error detected");
-                        }
-                    }
-                    if(fg_job->status == NEEDSTERMINAL){
-                        tcsetpgrp(termstate_get_tty_fd(), fg_job->pgid);
-                        if(killpg(fg_job->pgid, SIGCONT) != 0){
-                            printf("error detected");
-                        }
-                    }
-                    fg_job->status = FOREGROUND;
-                    print_cmdline(fg_job->pipe);
-                    printf("\n");
-                    
-                    wait_for_job(fg_job);
-                }
-                else if(strcmp(p[0], "bg")==0){     //bg built-in command
-                    is_builtin_flag = true;
-                    struct job *bg_job = get_job_from_jid(atoi(p[1]));
-                    if(bg_job->status == STOPPED){
-                        if(killpg(bg_job->pgid, SIGCONT) != 0){
-                            printf("error detected");
-                        }
-                        bg_job->status = BACKGROUND; //how to change from current state to running
-                    }
-                    printf("[%d] %d\n", bg_job->jid, bg_job->pgid);
-                }
-                else if(strcmp(p[0], "history")==0){
-                    is_builtin_flag = true;
-                    HISTORY_STATE *history = history_get_history_state();
-                    for(int k=0; k<history->length; k++){
-                        printf("%d  %s\n", k+1, history->entries[k]->line);
-                    }
+        //each pipeline is removed from the command line; a job takes ownership of it
+        while (!list_empty(&cline->pipes)) {
+            struct ast_pipeline *pipe = list_entry(list_pop_front(&cline->pipes), struct ast_pipeline, elem);
+            struct ast_command *first_cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+            struct spawn_options opts = { .output_fd = -1 };
+            bool timed = false;
+            bool invalid = !strip_prefixes(first_cmd, &opts, &timed, stdout);
+            struct ast_command *last_cmd = list_entry(list_back(&pipe->commands), struct ast_command, elem);
+            if(!invalid && opts.agent != 0 && (is_builtin(first_cmd->argv[0]) || is_builtin(last_cmd->argv[0]))){
+                printf("on: %s: built-in commands run in the shell\n", first_cmd->argv[0]);
+                invalid = true;
+            }
+            if(invalid){
+                ast_pipeline_free(pipe);
+            }
+            else if(strcmp(last_cmd->argv[0], "parallel")==0){
+                parallel_builtin(pipe);
+            }
+            else if(strcmp(first_cmd->argv[0], "dag")==0){
+                dag_builtin(first_cmd->argv);
+                ast_pipeline_free(pipe);
+            }
+            else if(handle_builtin(first_cmd->argv)){
+                ast_pipeline_free(pipe);
+            }
+            //if not a built-in command, posix spawn and add to job list
+            else{
+                //a job on an agent always runs in the background
+                if(opts.agent != 0){
+                    pipe->bg_job = true;
                 }
-                //if not a built-in command, posix spawn and add to job list
-                else{
-                    if(pipeline_elem == list_begin(&pipe->commands)){//only add job for first process in pipe
-                        added_job = add_job(pipe);  //add job
-                        added_job->pid_array = malloc(list_size(&pipe->commands)*sizeof(pid_t));
-                        added_job->pid_counter = 0;
-                        added_job->has_saved_tty = false;
-                        if(pipe->bg_job){   //set status
-                            added_job->status=BACKGROUND;
-                        }
-                        else{
-                            added_job->status=FOREGROUND;
-                        }
-                    }
-                    
-                    pid_t pid;
-                    posix_spawnattr_t child_spawn_attr;
-                    posix_spawn_file_actions_t child_file_attr;
-                    posix_spawnattr_init(&child_spawn_attr);
-                    posix_spawn_file_actions_init(&child_file_attr);
-                    posix_spawnattr_setflags(&child_spawn_attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_TCSETPGROUP);
-                    if(pipeline_elem == list_begin(&pipe->commands)){
-                        posix_spawnattr_setpgroup(&child_spawn_attr, 0);//set process group
-                    }
-                    else{
-                        posix_spawnattr_setpgroup(&child_spawn_attr, added_job->pgid);
-                    }
-                    //if fg:
-                    if(added_job->status == FOREGROUND){
-                        posix_spawnattr_tcsetpgrp_np(&child_spawn_attr, termstate_get_tty_fd());
-                    }
-
-                    //if they are NOT null, that means either a '<', '>', or '>>" was useed
-                    //check for io input file ( < )
-                    if(pipe->iored_input != NULL && pipeline_elem == list_begin(&pipe->commands)){
-                        int psx_add_open_val = posix_spawn_file_actions_addopen(&child_file_attr, STDIN_FILENO, pipe->iored_input, O_RDONLY | O_CREAT, S_IRUSR);
-                        if(psx_add_open_val != 0){
-                            fprintf(stderr, "error: cannot open file\n");
-                        }
-                    }
-                    //check for io output file
-                    if(pipe->iored_output != NULL && list_next(pipeline_elem) == list_end(&pipe->commands)){
-                        //append ( >> )
-                        if(pipe->append_to_output){
-                            int psx_add_open_val = posix_spawn_file_actions_addopen(&child_file_attr, STDOUT_FILENO, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, S_IRWXU);
-                            if(psx_add_open_val != 0){
-                                fprintf(stderr, "error: cannot open file\n");
-                            }
-                        }
-                        //overwrite ( > )
-                        else{
-                            int psx_add_open_val = posix_spawn_file_actions_addopen(&child_file_attr, STDOUT_FILENO, pipe->iored_output, O_WRONLY | O_CREAT, S_IRWXU);
-                            if(psx_add_open_val != 0){
-                                fprintf(stderr, "error: cannot open file\n");
-                            }
-                        }
-                    }
-                    
-                    if(list_next(pipeline_elem) != list_end(&pipe->commands)){
-                        int initial_pipe2 = pipe2(pipeoutput, O_CLOEXEC);
-                        if(initial_pipe2 != 0){
-                            printf("error detected");
-                        }
-                        posix_spawn_file_actions_adddup2(&child_file_attr, pipeoutput[1], STDOUT_FILENO);
-                    }
-
-                    if(pipeline_elem != list_begin(&pipe->commands)){
-                        posix_spawn_file_actions_adddup2(&child_file_attr, pipeinput[0], STDIN_FILENO);
-                    }
-
-                    if(cmd->dup_stderr_to_stdout){  //also redirect stderr
-                        posix_spawn_file_actions_adddup2(&child_file_attr, STDOUT_FILENO, STDERR_FILENO);
-                    }
-
-                    extern char **environ;
-                    int spawned = posix_spawnp(&pid, p[0], &child_file_attr, &child_spawn_attr, p, environ);
-                    if(spawned != 0){
-                        spawn_success = false;
-                        errno = spawned;
-                        perror("Spawning: ");
-                    }
-
-                    if(pipeline_elem != list_begin(&pipe->commands)){
-                        int close_pipe1 = close(pipeinput[0]); //
-                        if (close_pipe1 != 0){
-                            printf("error detected");
-                        }
-                        int close_pipe2 = close(pipeinput[1]); //
-                        if (close_pipe2 != 0){
-                            printf("error detected");
-                        }
-                    }
-
-                    pipeinput[0]=pipeoutput[0];
-                    pipeinput[1]=pipeoutput[1];
-
-                    //print jid and pid if it is a background process
-                    if(added_job->status == BACKGROUND){
-                        printf("[%d] %d\n", added_job->jid, pid);
-                    }
-
-                    // add pid to job's pid array
-                    added_job->pid_counter++;
-                    added_job->pid_array[added_job->num_processes_alive] = pid;
-                    added_job->num_processes_alive = added_job->num_processes_alive + 1;
-
-                    if(pipeline_elem == list_begin(&pipe->commands)){
-                        added_job->pgid=pid; //store pgid of first process of the job
-                    }
+                struct job *added_job = spawn_job(pipe, &opts);
+                opts.placement = NULL;
+                if(added_job != NULL){
+                    added_job->timed = timed;
                 }
-            }
-            if(!is_builtin_flag && spawn_success){ //if posix spawn works with given commands and it is not a built-in command
-                if(added_job->status == FOREGROUND){
+                if(added_job != NULL && added_job->status == FOREGROUND){
                     wait_for_job(added_job);
                 }
                 termstate_give_terminal_back_to_shell();
             }
-            if(!spawn_success){ //if posix spawn fails
-                list_remove(&added_job->elem);
-                termstate_give_terminal_back_to_shell();
+            //a pinned built-in runs in the shell, which stays where it is
+            if(opts.placement != NULL){
+                placement_release(opts.placement);
             }
             clean_jobs_list();      //remove all jobs from jobs list that have no more processes alive
         }
-        signal_unblock(SIGCHLD);
 
 
         /* Free the command line.
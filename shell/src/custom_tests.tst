@@ -1,3 +1,21 @@
 = Tests for Custom Features
 1 history_test.py
-2 custom_prompt_test.py
\ No newline at end of file
+2 custom_prompt_test.py
+3 hash_test.py
+4 wait_test.py
+5 time_test.py
+6 perfstat_test.py
+7 parallel_test.py
+8 dag_test.py
+9 admission_test.py
+10 cgroup_test.py
+11 pin_test.py
+12 priority_test.py
+13 timeout_test.py
+14 jobshm_test.py
+15 server_test.py
+16 agent_test.py
+17 jobserver_test.py
+18 stop_test.py
+19 spawn_pool_test.py
+20 closefrom_test.py
\ No newline at end of file
@@ -0,0 +1,315 @@
+/*
+ * Dependency graphs of command lines for the dag builtin.
+ *
+ * The graph is loaded and checked up front: every command line is parsed
+ * with ast_parse_command_line, and the nodes are sorted topologically,
+ * which also finds cycles.  Which nodes succeeded in earlier runs, and
+ * how long each node took, is kept in "<graph file>.state", one line
+ * "name seconds hash" per node, where the hash is that of the node's
+ * command lines, or "-" if the node has not succeeded.  Lines are
+ * appended as nodes end; a later line overrides an earlier one.
+ *
+ * Ready nodes are started in the order of their priority, which is the
+ * estimated run time of the longest chain of nodes from the node to the
+ * end of the graph (the critical path), so the nodes that hold up the
+ * most work are started first.  Nodes without a recorded run time are
+ * estimated to take DEFAULT_ESTIMATE.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dag.h"
+
+#define DEFAULT_ESTIMATE 1.0
+
+/* FNV-1a hash of a string */
+static uint64_t
+hash_string(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char) *s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int
+find_node(struct dag *dag, const char *name)
+{
+    for (int i = 0; i < dag->num_nodes; i++)
+        if (strcmp(dag->nodes[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+/* Add the words of 'text' as the dependencies of node 'i'.
+ * Returns false if one is not a node. */
+static bool
+resolve_deps(struct dag *dag, int i, char *text, const char *path)
+{
+    struct dag_node *node = &dag->nodes[i];
+    char *saveptr;
+    for (char *name = strtok_r(text, " \t", &saveptr); name != NULL; name = strtok_r(NULL, " \t", &saveptr)) {
+        int dep = find_node(dag, name);
+        if (dep == -1) {
+            printf("dag: %s: %s depends on unknown node %s\n", path, node->name, name);
+            return false;
+        }
+        node->deps = realloc(node->deps, (node->num_deps + 1) * sizeof *node->deps);
+        node->deps[node->num_deps++] = dep;
+
+        struct dag_node *d = &dag->nodes[dep];
+        d->dependents = realloc(d->dependents, (d->num_dependents + 1) * sizeof *d->dependents);
+        d->dependents[d->num_dependents++] = i;
+    }
+    return true;
+}
+
+/* Sort the nodes topologically into dag->order.
+ * Returns false if there is a cycle. */
+static bool
+sort_nodes(struct dag *dag, const char *path)
+{
+    int *deps_left = malloc(dag->num_nodes * sizeof *deps_left);
+    int n = 0;
+    dag->order = malloc(dag->num_nodes * sizeof *dag->order);
+    for (int i = 0; i < dag->num_nodes; i++) {
+        deps_left[i] = dag->nodes[i].num_deps;
+        if (deps_left[i] == 0)
+            dag->order[n++] = i;
+    }
+    for (int k = 0; k < n; k++) {
+        struct dag_node *node = &dag->nodes[dag->order[k]];
+        for (int j = 0; j < node->num_dependents; j++)
+            if (--deps_left[node->dependents[j]] == 0)
+                dag->order[n++] = node->dependents[j];
+    }
+
+    if (n < dag->num_nodes) {
+        printf("dag: %s: dependency cycle among", path);
+        for (int i = 0; i < dag->num_nodes; i++)
+            if (deps_left[i] > 0)
+                printf(" %s", dag->nodes[i].name);
+        printf("\n");
+    }
+    free(deps_left);
+    return n == dag->num_nodes;
+}
+
+struct dag *
+dag_load(const char *path)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        printf("dag: cannot open %s\n", path);
+        return NULL;
+    }
+
+    struct dag *dag = calloc(1, sizeof *dag);
+    char **dep_texts = NULL;
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0;
+    bool ok = true;
+    while (ok && getline(&line, &cap, f) != -1) {
+        lineno++;
+        line[strcspn(line, "\n")] = '\0';
+        char *text = line + strspn(line, " \t");
+        if (*text == '\0' || *text == '#')
+            continue;
+
+        if (text != line) {
+            /* an indented command line of the current node */
+            if (dag->num_nodes == 0) {
+                printf("dag: %s:%d: command line outside of a node\n", path, lineno);
+                ok = false;
+                break;
+            }
+            struct dag_node *node = &dag->nodes[dag->num_nodes - 1];
+            struct ast_command_line *cline = ast_parse_command_line(text);
+            if (cline == NULL) {
+                printf("dag: %s:%d: cannot parse command line\n", path, lineno);
+                ok = false;
+                break;
+            }
+            while (!list_empty(&cline->pipes))
+                list_push_back(&node->pipelines->pipes, list_pop_front(&cline->pipes));
+            ast_command_line_free(cline);
+
+            size_t len = strlen(node->command);
+            node->command = realloc(node->command, len + strlen(text) + 2);
+            sprintf(node->command + len, "%s\n", text);
+            continue;
+        }
+
+        /* a node: exactly one name before the colon */
+        char *colon = strchr(line, ':');
+        char *name = NULL, *saveptr;
+        if (colon != NULL) {
+            *colon = '\0';
+            name = strtok_r(line, " \t", &saveptr);
+        }
+        if (name == NULL || strtok_r(NULL, " \t", &saveptr) != NULL) {
+            printf("dag: %s:%d: expected 'name: dependency...'\n", path, lineno);
+            ok = false;
+            break;
+        }
+        if (find_node(dag, name) != -1) {
+            printf("dag: %s:%d: node %s defined twice\n", path, lineno, name);
+            ok = false;
+            break;
+        }
+        dag->nodes = realloc(dag->nodes, (dag->num_nodes + 1) * sizeof *dag->nodes);
+        dep_texts = realloc(dep_texts, (dag->num_nodes + 1) * sizeof *dep_texts);
+        struct dag_node *node = &dag->nodes[dag->num_nodes];
+        memset(node, 0, sizeof *node);
+        node->name = strdup(name);
+        node->command = strdup("");
+        node->estimate = -1;
+        node->pipelines = ast_command_line_create_empty();
+        dep_texts[dag->num_nodes++] = strdup(colon + 1);
+    }
+    free(line);
+    fclose(f);
+
+    for (int i = 0; ok && i < dag->num_nodes; i++)
+        ok = resolve_deps(dag, i, dep_texts[i], path);
+    for (int i = 0; i < dag->num_nodes; i++) {
+        free(dep_texts[i]);
+        dag->nodes[i].hash = hash_string(dag->nodes[i].command);
+    }
+    free(dep_texts);
+
+    if (!ok || !sort_nodes(dag, path)) {
+        dag_free(dag);
+        return NULL;
+    }
+    if (asprintf(&dag->state_path, "%s.state", path) == -1)
+        dag->state_path = NULL;
+    return dag;
+}
+
+/* Write a node's line to the state file */
+static void
+write_state(FILE *f, struct dag_node *node, bool succeeded)
+{
+    if (succeeded)
+        fprintf(f, "%s %.3f %016" PRIx64 "\n", node->name, node->estimate, node->hash);
+    else if (node->estimate >= 0)
+        fprintf(f, "%s %.3f -\n", node->name, node->estimate);
+}
+
+void
+dag_plan(struct dag *dag, bool force)
+{
+    bool *succeeded = calloc(dag->num_nodes, sizeof *succeeded);
+    FILE *f = dag->state_path != NULL ? fopen(dag->state_path, "re") : NULL;
+    if (f != NULL) {
+        char *name, *hash;
+        double seconds;
+        while (fscanf(f, "%ms %lf %ms", &name, &seconds, &hash) == 3) {
+            int i = find_node(dag, name);
+            if (i != -1) {
+                dag->nodes[i].estimate = seconds;
+                succeeded[i] = strcmp(hash, "-") != 0 && strtoull(hash, NULL, 16) == dag->nodes[i].hash;
+            }
+            free(name);
+            free(hash);
+        }
+        fclose(f);
+    }
+
+    /* a node is skipped only if everything it depends on is, too */
+    for (int k = 0; k < dag->num_nodes; k++) {
+        struct dag_node *node = &dag->nodes[dag->order[k]];
+        bool skip = !force && succeeded[dag->order[k]];
+        node->deps_left = 0;
+        for (int j = 0; j < node->num_deps; j++) {
+            if (dag->nodes[node->deps[j]].state != DAG_SKIPPED) {
+                skip = false;
+                node->deps_left++;
+            }
+        }
+        node->state = skip ? DAG_SKIPPED : DAG_WAITING;
+    }
+
+    /* forget that the nodes that run again succeeded before, in case
+     * they fail this time */
+    if (dag->state_path != NULL) {
+        char *tmp_path;
+        if (asprintf(&tmp_path, "%s.tmp", dag->state_path) != -1) {
+            f = fopen(tmp_path, "we");
+            if (f != NULL) {
+                for (int i = 0; i < dag->num_nodes; i++)
+                    write_state(f, &dag->nodes[i], dag->nodes[i].state == DAG_SKIPPED);
+                if (fclose(f) == 0)
+                    rename(tmp_path, dag->state_path);
+            }
+            free(tmp_path);
+        }
+    }
+
+    /* the critical path from each node, computed backwards */
+    for (int k = dag->num_nodes - 1; k >= 0; k--) {
+        struct dag_node *node = &dag->nodes[dag->order[k]];
+        double longest = 0;
+        for (int j = 0; j < node->num_dependents; j++)
+            if (dag->nodes[node->dependents[j]].priority > longest)
+                longest = dag->nodes[node->dependents[j]].priority;
+        node->priority = longest;
+        if (node->state != DAG_SKIPPED)
+            node->priority += node->estimate >= 0 ? node->estimate : DEFAULT_ESTIMATE;
+    }
+    free(succeeded);
+}
+
+struct dag_node *
+dag_next_ready(struct dag *dag)
+{
+    struct dag_node *best = NULL;
+    for (int i = 0; i < dag->num_nodes; i++) {
+        struct dag_node *node = &dag->nodes[i];
+        if (node->state == DAG_WAITING && node->deps_left == 0
+            && (best == NULL || node->priority > best->priority))
+            best = node;
+    }
+    return best;
+}
+
+void
+dag_node_ended(struct dag *dag, struct dag_node *node, bool success, double seconds)
+{
+    node->state = success ? DAG_DONE : DAG_FAILED;
+    node->estimate = seconds;
+    if (success)
+        for (int j = 0; j < node->num_dependents; j++)
+            dag->nodes[node->dependents[j]].deps_left--;
+
+    FILE *f = dag->state_path != NULL ? fopen(dag->state_path, "ae") : NULL;
+    if (f != NULL) {
+        write_state(f, node, success);
+        fclose(f);
+    }
+}
+
+void
+dag_free(struct dag *dag)
+{
+    for (int i = 0; i < dag->num_nodes; i++) {
+        struct dag_node *node = &dag->nodes[i];
+        if (node->pipelines != NULL)
+            ast_command_line_free(node->pipelines);
+        free(node->name);
+        free(node->command);
+        free(node->deps);
+        free(node->dependents);
+    }
+    free(dag->nodes);
+    free(dag->order);
+    free(dag->state_path);
+    free(dag);
+}
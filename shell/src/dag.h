@@ -0,0 +1,81 @@
+#ifndef __DAG_H
+#define __DAG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "shell-ast.h"
+#include "jobs.h"
+
+enum dag_node_state {
+    DAG_WAITING,    /* Not all of its dependencies have succeeded yet */
+    DAG_SKIPPED,    /* Succeeded in an earlier run */
+    DAG_RUNNING,
+    DAG_DONE,       /* Succeeded in this run */
+    DAG_FAILED,     /* Failed, or was stopped after another node failed */
+};
+
+/* A named command line in a dependency graph */
+struct dag_node {
+    char *name;
+    char *command;          /* The text of its command lines, one per line */
+    uint64_t hash;          /* Hash of 'command' */
+    struct ast_command_line *pipelines;     /* The parsed pipelines not
+                                               yet started */
+    int *deps;              /* Indices of the nodes it depends on */
+    int num_deps;
+    int *dependents;        /* Indices of the nodes that depend on it */
+    int num_dependents;
+
+    double estimate;        /* Its run time in the last run, in seconds,
+                               or -1 if it is not known */
+    double priority;        /* Estimated time from its start to the end
+                               of the longest path of nodes it starts */
+    enum dag_node_state state;
+    int deps_left;          /* Dependencies that have not yet succeeded */
+    struct job *job;        /* The job of its current pipeline while it runs */
+    double start_time;      /* usage_now() when it was started */
+};
+
+struct dag {
+    struct dag_node *nodes;
+    int num_nodes;
+    int *order;             /* The nodes in an order where each node comes
+                               after the nodes it depends on */
+    char *state_path;       /* Where the nodes that succeeded are recorded */
+};
+
+/*
+ * Load a graph file, which consists of nodes like this:
+ *
+ *   transform: extract clean
+ *           sort raw.csv | uniq > sorted.csv
+ *           ./transform sorted.csv > out.csv
+ *
+ * A line "name: dependency..." starts a node; the indented lines below
+ * it are its command lines, whose pipelines are run one after another.
+ * Empty lines and lines starting with '#' are ignored.  Prints a message
+ * and returns NULL if the file cannot be read, a command line does not
+ * parse, a dependency is unknown, or the dependencies form a cycle.
+ */
+struct dag *dag_load(const char *path);
+
+/*
+ * Decide which nodes have to run: a node is skipped if it succeeded with
+ * the same command lines in an earlier run and none of the nodes it
+ * depends on has to run, unless 'force' is set.  The nodes that will
+ * run are forgotten in the state file, and the priority of each is
+ * computed from the run times recorded there.
+ */
+void dag_plan(struct dag *dag, bool force);
+
+/* Return the waiting node whose dependencies have all succeeded and
+ * that has the longest path of nodes ahead of it, or NULL. */
+struct dag_node *dag_next_ready(struct dag *dag);
+
+/* Record that a node has ended after 'seconds', and if it succeeded,
+ * that the nodes depending on it may be ready now. */
+void dag_node_ended(struct dag *dag, struct dag_node *node, bool success, double seconds);
+
+void dag_free(struct dag *dag);
+
+#endif /* __DAG_H */
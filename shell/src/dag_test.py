@@ -0,0 +1,68 @@
+#!/usr/bin/python
+#
+# Tests the dag builtin
+#
+
+import atexit, proc_check, time, os, tempfile
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+workdir = tempfile.mkdtemp()
+graph = os.path.join(workdir, "test.dag")
+out = os.path.join(workdir, "out")
+with open(graph, "w") as f:
+    f.write("# a small graph\n"
+            "first:\n"
+            "\techo first >> %s\n"
+            "second: first\n"
+            "\techo second >> %s\n"
+            "\techo second again >> %s\n" % (out, out, out))
+
+def cleanup():
+    for name in os.listdir(workdir):
+        os.unlink(os.path.join(workdir, name))
+    os.rmdir(workdir)
+atexit.register(cleanup)
+
+# the nodes run in the order of their dependencies
+sendline("dag " + graph)
+expect_exact("dag: 2 done, 0 skipped, 0 failed, 0 not run")
+expect_prompt()
+assert open(out).read() == "first\nsecond\nsecond again\n", "nodes did not run in order"
+
+# on a rerun, nodes that succeeded are skipped
+sendline("dag " + graph)
+expect_exact("dag: 0 done, 2 skipped, 0 failed, 0 not run")
+expect_prompt()
+
+# unless -f is given
+sendline("dag -f " + graph)
+expect_exact("dag: 2 done, 0 skipped, 0 failed, 0 not run")
+expect_prompt()
+
+# a failed node stops the nodes that depend on it
+with open(graph, "a") as f:
+    f.write("broken: second\n"
+            "\tfalse\n"
+            "last: broken\n"
+            "\techo last\n")
+sendline("dag " + graph)
+expect_exact("dag: broken: false (exit 1)")
+expect_exact("dag: 0 done, 2 skipped, 1 failed, 1 not run")
+expect_prompt()
+
+# cycles are found before anything runs
+with open(graph, "a") as f:
+    f.write("a: b\n\ttrue\nb: a\n\ttrue\n")
+sendline("dag " + graph)
+expect_exact("dependency cycle among a b")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
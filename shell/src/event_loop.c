@@ -0,0 +1,104 @@
+/*
+ * The event loop of the shell.
+ *
+ * Everything the shell waits for is a file descriptor watched by one
+ * epoll instance: SIGCHLD arrives through a signalfd, input through the
+ * terminal, which readline reads in callback mode, timeouts through
+ * timerfds, and the clients of a serving shell through sockets.  The
+ * callbacks run in the main thread, outside of any signal handler, so
+ * they are free to print, allocate and use the terminal.
+ */
+#define _GNU_SOURCE    1
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "event_loop.h"
+#include "utils.h"
+
+/* Number of ready descriptors handled per wakeup */
+#define MAX_EVENTS 16
+
+struct handler {
+    event_callback_t callback;      /* NULL if the fd is not watched */
+    void *arg;
+};
+
+static int epoll_fd = -1;
+static struct handler *handlers;    /* Indexed by fd */
+static int num_handlers;
+
+void
+event_loop_init(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        utils_fatal_error("epoll_create1 failed");
+}
+
+static bool
+watch(int fd, uint32_t events, event_callback_t callback, void *arg)
+{
+    if (fd >= num_handlers) {
+        int n = fd + 1 > 2 * num_handlers ? fd + 1 : 2 * num_handlers;
+        struct handler *grown = realloc(handlers, n * sizeof *handlers);
+        if (grown == NULL)
+            utils_fatal_error("cannot watch fd %d", fd);
+        for (int i = num_handlers; i < n; i++)
+            grown[i].callback = NULL;
+        handlers = grown;
+        num_handlers = n;
+    }
+
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return false;
+
+    handlers[fd] = (struct handler) { .callback = callback, .arg = arg };
+    return true;
+}
+
+bool
+event_loop_add(int fd, event_callback_t callback, void *arg)
+{
+    return watch(fd, EPOLLIN, callback, arg);
+}
+
+bool
+event_loop_add_writable(int fd, event_callback_t callback, void *arg)
+{
+    return watch(fd, EPOLLOUT, callback, arg);
+}
+
+void
+event_loop_remove(int fd)
+{
+    if (fd >= num_handlers || handlers[fd].callback == NULL)
+        return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    handlers[fd].callback = NULL;
+}
+
+int
+event_loop_run_once(int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno != EINTR)
+            utils_fatal_error("epoll_wait failed");
+        return 0;
+    }
+
+    int ran = 0;
+    for (int i = 0; i < n; i++) {
+        /* an earlier callback may have stopped watching this fd */
+        struct handler *h = &handlers[events[i].data.fd];
+        if (h->callback != NULL) {
+            h->callback(events[i].data.fd, h->arg);
+            ran++;
+        }
+    }
+    return ran;
+}
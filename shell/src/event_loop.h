@@ -0,0 +1,38 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+#include <stdbool.h>
+
+/* Called when 'fd' is ready for reading (or writing, if so watched) */
+typedef void (*event_callback_t)(int fd, void *arg);
+
+/* Create the epoll instance the shell waits on. */
+void event_loop_init(void);
+
+/*
+ * Call 'callback' whenever 'fd' is readable, until event_loop_remove.
+ * Any pollable descriptor can be watched: a signalfd, the terminal, a
+ * pidfd or a timerfd.
+ * Returns false with errno set if 'fd' cannot be watched, e.g. EPERM for
+ * a regular file.
+ */
+bool event_loop_add(int fd, event_callback_t callback, void *arg);
+
+/*
+ * Call 'callback' whenever 'fd' is writable, until event_loop_remove.
+ * An fd is watched for one direction only; watch a dup() of it for the
+ * other.
+ */
+bool event_loop_add_writable(int fd, event_callback_t callback, void *arg);
+
+/* Stop watching 'fd'.  It may be removed from within a callback. */
+void event_loop_remove(int fd);
+
+/*
+ * Wait up to 'timeout_ms' milliseconds (-1 for no limit) until a watched
+ * descriptor is ready, then run the callbacks of all that are.
+ * Returns the number of callbacks run.
+ */
+int event_loop_run_once(int timeout_ms);
+
+#endif /* __EVENT_LOOP_H */
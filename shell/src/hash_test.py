@@ -0,0 +1,64 @@
+#!/usr/bin/python
+#
+# Tests the hash builtin and the invalidation of the PATH cache
+#
+
+import atexit, proc_check, time, tempfile, shutil
+from testutils import *
+
+# put a directory we control at the front of PATH
+bindir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, bindir)
+os.environ['PATH'] = bindir + ":" + os.environ['PATH']
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("hash")
+expect_exact("hash: hash table empty")
+expect_prompt()
+
+# commands that were run are remembered
+sendline("echo cached")
+expect_exact("cached")
+expect_prompt()
+sendline("hash")
+expect_exact("/echo")
+expect_prompt()
+
+# a command that is not found is remembered too, and forgotten
+# once it is created
+sendline("cush_hash_test")
+console.ignorecase = True
+expect("no such file or directory")
+console.ignorecase = False
+expect_prompt()
+shutil.copy("/bin/echo", bindir + "/cush_hash_test")
+time.sleep(0.5)
+sendline("cush_hash_test now found")
+expect_exact("now found")
+expect_prompt()
+
+# a new command earlier on PATH shadows the remembered one
+os.symlink("/bin/echo", bindir + "/true")
+time.sleep(0.5)
+sendline("true shadowed")
+expect_exact("shadowed")
+expect_prompt()
+
+# add and clear
+sendline("hash -r")
+expect_prompt()
+sendline("hash ls cush_no_such_command")
+expect_exact("hash: cush_no_such_command: not found")
+expect_prompt()
+sendline("hash")
+expect_exact("/ls")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
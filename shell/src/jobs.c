@@ -0,0 +1,620 @@
+/*
+ * The job list of cush.
+ *
+ * We use 5 data structures:
+ * (a) slabs of job records indexed by job id, to quickly find a job based
+ *     on its id, with a two-level bitmap of free ids from which add_job
+ *     takes the lowest with two ffsll calls
+ * (b) a linked list to support iteration
+ * (c) hash tables from the pid of every live process and from the pgid
+ *     of every job to the job, so that the job of a reaped child is found
+ *     without looking at the other jobs.  Their entries are embedded in
+ *     the processes and jobs, so reaping a child never allocates; the
+ *     reaper runs from the event loop when the SIGCHLD signalfd becomes
+ *     readable, in the main thread like every other change to them.
+ * (d) a queue of the jobs whose last process has exited, filled as their
+ *     processes are reaped, so that the finished jobs can be deleted
+ *     without walking the job list.
+ * (e) a list of how the most recently deleted background jobs ended,
+ *     newest first, for the wait builtin.
+ *
+ * A slab is allocated when the first of its job ids is taken and freed
+ * when the last is released.  Since the lowest free id is always used,
+ * the jobs of a long session stay packed into the first few slabs.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+
+struct list job_list;
+
+/* Jobs whose processes have all exited, oldest first */
+static struct list completed_jobs;
+
+/* A deleted background job whose end was remembered */
+struct finished_job {
+    struct list_elem elem;
+    int jid;
+    int status;
+    bool timed_out;
+    char *cmdline;
+};
+
+static struct list finished_jobs;
+static int num_finished_jobs;
+
+static struct job_hooks hooks;
+
+#define JOBS_PER_SLAB 64
+
+struct job_slab {
+    struct job jobs[JOBS_PER_SLAB];
+    int num_used;
+};
+
+static struct job_slab *slabs[MAXJOBS / JOBS_PER_SLAB];
+
+/* Bit j % 64 of free_jids[j / 64] is set if job id j is free,
+ * and bit i % 64 of free_words[i / 64] if free_jids[i] is not 0. */
+static uint64_t free_jids[MAXJOBS / 64];
+static uint64_t free_words[MAXJOBS / 64 / 64];
+
+static int
+alloc_jid(void)
+{
+    for (int w = 0; w < MAXJOBS / 64 / 64; w++) {
+        if (free_words[w] == 0)
+            continue;
+        int i = w * 64 + ffsll(free_words[w]) - 1;
+        int jid = i * 64 + ffsll(free_jids[i]) - 1;
+        free_jids[i] &= ~(1ULL << (jid % 64));
+        if (free_jids[i] == 0)
+            free_words[w] &= ~(1ULL << (i % 64));
+        return jid;
+    }
+    return -1;
+}
+
+static void
+free_jid(int jid)
+{
+    int i = jid / 64;
+    free_jids[i] |= 1ULL << (jid % 64);
+    free_words[i / 64] |= 1ULL << (i % 64);
+}
+
+struct pid_table {
+    struct list *buckets;
+    size_t nbuckets;        /* A power of 2 */
+    size_t count;
+};
+
+#define MIN_BUCKETS 64
+
+static struct pid_table pid_table;     /* pids of live processes */
+static struct pid_table pgid_table;    /* pgids of jobs */
+
+static void
+pid_table_init(struct pid_table *table, size_t nbuckets)
+{
+    table->buckets = malloc(nbuckets * sizeof *table->buckets);
+    if (table->buckets == NULL) {
+        fprintf(stderr, "Cannot allocate the job table\n");
+        abort();
+    }
+    for (size_t i = 0; i < nbuckets; i++)
+        list_init(&table->buckets[i]);
+    table->nbuckets = nbuckets;
+    table->count = 0;
+}
+
+/* Pids are mostly handed out in sequence, so their low bits
+ * spread them evenly. */
+static struct list *
+pid_bucket(struct pid_table *table, pid_t pid)
+{
+    return &table->buckets[(size_t) pid & (table->nbuckets - 1)];
+}
+
+/* Double the number of buckets, keeping the entries. */
+static void
+pid_table_grow(struct pid_table *table)
+{
+    struct pid_table bigger;
+    pid_table_init(&bigger, table->nbuckets * 2);
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        while (!list_empty(&table->buckets[i])) {
+            struct pid_entry *entry = list_entry(list_pop_front(&table->buckets[i]), struct pid_entry, elem);
+            list_push_back(pid_bucket(&bigger, entry->pid), &entry->elem);
+        }
+    }
+    bigger.count = table->count;
+    free(table->buckets);
+    *table = bigger;
+}
+
+static void
+pid_table_insert(struct pid_table *table, struct pid_entry *entry, pid_t pid)
+{
+    if (table->count >= 2 * table->nbuckets)
+        pid_table_grow(table);
+    entry->pid = pid;
+    list_push_front(pid_bucket(table, pid), &entry->elem);
+    table->count++;
+}
+
+static void
+pid_table_remove(struct pid_table *table, struct pid_entry *entry)
+{
+    list_remove(&entry->elem);
+    table->count--;
+}
+
+static struct pid_entry *
+pid_table_find(struct pid_table *table, pid_t pid)
+{
+    struct list *bucket = pid_bucket(table, pid);
+    for (struct list_elem *e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+        struct pid_entry *entry = list_entry(e, struct pid_entry, elem);
+        if (entry->pid == pid)
+            return entry;
+    }
+    return NULL;
+}
+
+void
+jobs_init(void)
+{
+    list_init(&job_list);
+    list_init(&completed_jobs);
+    list_init(&finished_jobs);
+    pid_table_init(&pid_table, MIN_BUCKETS);
+    pid_table_init(&pgid_table, MIN_BUCKETS);
+    memset(free_jids, 0xff, sizeof free_jids);
+    memset(free_words, 0xff, sizeof free_words);
+    free_jids[0] &= ~1ULL;      /* job ids start at 1 */
+}
+
+void
+jobs_set_hooks(const struct job_hooks *new_hooks)
+{
+    hooks = *new_hooks;
+}
+
+static void
+job_changed(struct job *job)
+{
+    if (hooks.changed)
+        hooks.changed(job);
+}
+
+struct job * 
+get_job_from_jid(int jid)
+{
+    if (jid <= 0 || jid >= MAXJOBS)
+        return NULL;
+
+    struct job_slab *slab = slabs[jid / JOBS_PER_SLAB];
+    if (slab == NULL || slab->jobs[jid % JOBS_PER_SLAB].jid != jid)
+        return NULL;
+    return &slab->jobs[jid % JOBS_PER_SLAB];
+}
+
+struct job *
+get_job_from_pid(pid_t pid, struct job_process **proc)
+{
+    struct pid_entry *entry = pid_table_find(&pid_table, pid);
+    if (entry == NULL)
+        return NULL;
+
+    *proc = list_entry(&entry->elem, struct job_process, pid_index.elem);
+    return (*proc)->job;
+}
+
+struct job *
+get_job_from_pgid(pid_t pgid)
+{
+    struct pid_entry *entry = pid_table_find(&pgid_table, pgid);
+    return entry ? list_entry(&entry->elem, struct job, pgid_index.elem) : NULL;
+}
+
+/* Render the command line of a pipeline as the jobs builtin shows it.
+ * The position of each command in it is stored in stages[]. */
+static char *
+format_cmdline(struct ast_pipeline *pipeline, struct job_process *stages)
+{
+    char *text;
+    size_t size;
+    FILE *out = open_memstream(&text, &size);
+    if (out == NULL)
+        return strdup("");
+
+    int i = 0;
+    struct list_elem * e = list_begin (&pipeline->commands); 
+    for (; e != list_end (&pipeline->commands); e = list_next(e), i++) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        if (e != list_begin(&pipeline->commands))
+            fputs("| ", out);
+        stages[i].cmd_start = ftell(out);
+        char **p = cmd->argv;
+        fputs(*p++, out);
+        while (*p)
+            fprintf(out, " %s", *p++);
+        stages[i].cmd_len = ftell(out) - stages[i].cmd_start;
+    }
+    fclose(out);
+    return text;
+}
+
+struct job *
+add_job(struct ast_pipeline *pipe, int max_processes)
+{
+    int jid = alloc_jid();
+    if (jid == -1) {
+        fprintf(stderr, "Maximum number of jobs exceeded\n");
+        abort();
+    }
+
+    struct job_slab **slab = &slabs[jid / JOBS_PER_SLAB];
+    if (*slab == NULL) {
+        *slab = calloc(1, sizeof **slab);
+        if (*slab == NULL) {
+            fprintf(stderr, "Cannot allocate the job table\n");
+            abort();
+        }
+    }
+    (*slab)->num_used++;
+
+    struct job * job = &(*slab)->jobs[jid % JOBS_PER_SLAB];
+    job->jid = jid;
+    job->num_processes_alive = 0;
+    job->processes = max_processes <= JOB_INLINE_PROCESSES
+        ? job->inline_processes : malloc(max_processes * sizeof *job->processes);
+    job->num_processes = 0;
+    /* until the processes are added, processes[i] holds only where the
+     * i'th command is in the command line */
+    job->cmdline = format_cmdline(pipe, job->processes);
+    job->pgid = 0;
+    job->waited_for = false;
+    job->timed = false;
+    job->perf = NULL;
+    job->admitted = false;
+    job->has_token = false;
+    job->queued = NULL;
+    job->cgroup = NULL;
+    job->placement = NULL;
+    job->demoted = false;
+    memset(&job->timeout, 0, sizeof job->timeout);
+    job->timeout.heap_index = -1;
+    job->shm_slot = -1;
+    job->stream = NULL;
+    job->remote = NULL;
+    job->start_time = usage_now();
+    list_push_back(&job_list, &job->elem);
+    return job;
+}
+
+struct job_process *
+job_add_process(struct job *job, int stage, pid_t pid, int pidfd)
+{
+    assert(stage >= job->num_processes);
+    struct job_process *proc = &job->processes[job->num_processes++];
+    proc->cmd_start = job->processes[stage].cmd_start;
+    proc->cmd_len = job->processes[stage].cmd_len;
+    proc->pid = pid;
+    proc->pidfd = pidfd;
+    proc->remote = false;
+    proc->alive = true;
+    proc->job = job;
+    pid_table_insert(&pid_table, &proc->pid_index, pid);
+    job->num_processes_alive++;
+    job_changed(job);
+    return proc;
+}
+
+struct job_process *
+job_add_remote_process(struct job *job, int stage)
+{
+    assert(stage >= job->num_processes);
+    struct job_process *proc = &job->processes[job->num_processes++];
+    proc->cmd_start = job->processes[stage].cmd_start;
+    proc->cmd_len = job->processes[stage].cmd_len;
+    proc->pid = 0;
+    proc->pidfd = -1;
+    proc->remote = true;
+    proc->alive = true;
+    proc->job = job;
+    job->num_processes_alive++;
+    job_changed(job);
+    return proc;
+}
+
+void
+job_set_pgid(struct job *job, pid_t pgid)
+{
+    assert(job->pgid == 0);
+    job->pgid = pgid;
+    pid_table_insert(&pgid_table, &job->pgid_index, pgid);
+}
+
+/* Remove a process from the pid table and close its pidfd */
+static void
+forget_process(struct job_process *proc)
+{
+    proc->alive = false;
+    if (!proc->remote)
+        pid_table_remove(&pid_table, &proc->pid_index);
+    if (proc->pidfd != -1) {
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+}
+
+void
+job_process_exited(struct job_process *proc, int status, const struct usage *usage)
+{
+    assert(proc->alive);
+    forget_process(proc);
+    proc->status = status;
+    proc->end_time = usage_now();
+    if (usage)
+        proc->usage = *usage;
+    else
+        memset(&proc->usage, 0, sizeof proc->usage);
+    struct job *job = proc->job;
+    if (--job->num_processes_alive == 0)
+        list_push_back(&completed_jobs, &job->completed_elem);
+    job_changed(job);
+}
+
+int
+job_exit_status(struct job *job)
+{
+    assert(job->num_processes_alive == 0);
+    return job->num_processes > 0 ? job->processes[job->num_processes - 1].status : 0;
+}
+
+struct job *
+pop_completed_job(void)
+{
+    if (list_empty(&completed_jobs))
+        return NULL;
+    return list_entry(list_pop_front(&completed_jobs), struct job, completed_elem);
+}
+
+void
+delete_job(struct job *job)
+{
+    int jid = job->jid;
+    assert(jid != -1);
+    if (hooks.deleted)
+        hooks.deleted(job);
+    for (int k = 0; k < job->num_processes; k++)
+        if (job->processes[k].alive)
+            forget_process(&job->processes[k]);
+    if (job->pgid != 0)
+        pid_table_remove(&pgid_table, &job->pgid_index);
+    if (job->processes != job->inline_processes)
+        free(job->processes);
+    free(job->cmdline);
+    job->jid = -1;
+
+    struct job_slab **slab = &slabs[jid / JOBS_PER_SLAB];
+    if (--(*slab)->num_used == 0) {
+        free(*slab);
+        *slab = NULL;
+    }
+    free_jid(jid);
+}
+
+/* A job that ran out of time is shown as "Timed out" */
+const char *
+get_status(struct job *job)
+{
+    if (job->timeout.expired)
+        return "Timed out";
+    switch (job->status) {
+    case FOREGROUND:
+        return "Foreground";
+    case BACKGROUND:
+        return "Running";
+    case STOPPED:
+        return "Stopped";
+    case NEEDSTERMINAL:
+        return "Stopped (tty)";
+    case QUEUED:
+        return "Queued";
+    default:
+        return "Unknown";
+    }
+}
+
+void
+print_job(struct job *job)
+{
+    const char *location = hooks.location ? hooks.location(job) : NULL;
+    if (location != NULL)
+        printf("[%d]\t%s\t\t(%s) on %s\n", job->jid, get_status(job), job->cmdline, location);
+    else
+        printf("[%d]\t%s\t\t(%s)\n", job->jid, get_status(job), job->cmdline);
+}
+
+/* Print a byte count with a unit */
+static void
+print_bytes(const char *label, unsigned long long bytes)
+{
+    if (bytes >= 10 << 20)
+        printf(" %s %lluM", label, bytes >> 20);
+    else if (bytes >= 10 << 10)
+        printf(" %s %lluK", label, bytes >> 10);
+    else
+        printf(" %s %llu", label, bytes);
+}
+
+static void
+print_usage(const struct usage *u)
+{
+    printf("user %.2fs sys %.2fs rss %ldK", u->utime, u->stime, u->rss_kb);
+    print_bytes("read", u->rchar);
+    print_bytes("write", u->wchar);
+    print_bytes("disk read", u->read_bytes);
+    print_bytes("disk write", u->write_bytes);
+}
+
+void
+print_job_usage(struct job *job)
+{
+    struct usage total;
+    memset(&total, 0, sizeof total);
+    for (int k = 0; k < job->num_processes; k++) {
+        struct job_process *proc = &job->processes[k];
+        struct usage live;
+        memset(&live, 0, sizeof live);
+        const struct usage *u = &proc->usage;
+        if (proc->alive && proc->remote)
+            u = NULL;
+        else if (proc->alive)
+            u = usage_read_live(proc->pid, &live) ? &live : NULL;
+
+        printf("\t%d\t%s\t", proc->pid, proc->alive ? "running" : "exited");
+        if (u) {
+            print_usage(u);
+            usage_add(&total, u);
+        }
+        printf("\t(%.*s)\n", proc->cmd_len, job->cmdline + proc->cmd_start);
+    }
+    printf("\ttotal\t\t");
+    print_usage(&total);
+    printf("\n");
+
+    /* including what the processes they started used */
+    struct usage group;
+    if (hooks.group_usage && hooks.group_usage(job, &group)) {
+        printf("\tcgroup\t\tuser %.2fs sys %.2fs", group.utime, group.stime);
+        if (group.rss_kb > 0)
+            printf(" peak %ldK", group.rss_kb);
+        printf("\n");
+    }
+}
+
+void
+print_job_times(struct job *job, FILE *out)
+{
+    struct usage total;
+    memset(&total, 0, sizeof total);
+    double end = job->start_time;
+
+    fprintf(out, "%-24s %9s %9s %9s %10s\n", "", "real", "user", "sys", "maxrss");
+    for (int k = 0; k < job->num_processes; k++) {
+        struct job_process *proc = &job->processes[k];
+        const struct usage *u = &proc->usage;
+        fprintf(out, "%-24.*s %8.3fs %8.3fs %8.3fs %9ldK\n",
+                proc->cmd_len < 24 ? proc->cmd_len : 24, job->cmdline + proc->cmd_start,
+                proc->end_time - job->start_time, u->utime, u->stime, u->rss_kb);
+        usage_add(&total, u);
+        if (proc->end_time > end)
+            end = proc->end_time;
+    }
+    if (job->num_processes > 1)
+        fprintf(out, "%-24s %8.3fs %8.3fs %8.3fs %9ldK\n", "total",
+                end - job->start_time, total.utime, total.stime, total.rss_kb);
+
+    /* memory.peak is only there with the memory controller */
+    struct usage group;
+    if (hooks.group_usage && hooks.group_usage(job, &group)) {
+        fprintf(out, "%-24s %8.3fs %8.3fs %8.3fs ", "cgroup",
+                end - job->start_time, group.utime, group.stime);
+        if (group.rss_kb > 0)
+            fprintf(out, "%9ldK\n", group.rss_kb);
+        else
+            fprintf(out, "%10s\n", "-");
+    }
+}
+
+/* Describe how a job ended with waitpid() status 'status' in 'buf' */
+static const char *
+exit_text(int status, bool timed_out, char *buf, size_t size)
+{
+    if (timed_out)
+        snprintf(buf, size, "Timed out");
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        snprintf(buf, size, "Done");
+    else if (WIFEXITED(status))
+        snprintf(buf, size, "Exit %d", WEXITSTATUS(status));
+    else
+        snprintf(buf, size, "%s", strsignal(WTERMSIG(status)));
+    return buf;
+}
+
+static void
+print_exit(int jid, int status, bool timed_out, const char *cmdline)
+{
+    char text[64];
+    printf("[%d]\t%s\t\t(%s)\n", jid, exit_text(status, timed_out, text, sizeof text), cmdline);
+}
+
+const char *
+job_exit_text(struct job *job, char *buf, size_t size)
+{
+    return exit_text(job_exit_status(job), job->timeout.expired, buf, size);
+}
+
+void
+print_job_exit(struct job *job)
+{
+    print_exit(job->jid, job_exit_status(job), job->timeout.expired, job->cmdline);
+}
+
+static void
+free_finished_job(struct finished_job *finished)
+{
+    list_remove(&finished->elem);
+    num_finished_jobs--;
+    free(finished->cmdline);
+    free(finished);
+}
+
+void
+remember_job_exit(struct job *job)
+{
+    if (num_finished_jobs == MAX_FINISHED_JOBS)
+        free_finished_job(list_entry(list_back(&finished_jobs), struct finished_job, elem));
+
+    struct finished_job *finished = malloc(sizeof *finished);
+    finished->jid = job->jid;
+    finished->status = job_exit_status(job);
+    finished->timed_out = job->timeout.expired;
+    finished->cmdline = job->cmdline;
+    job->cmdline = NULL;
+    list_push_front(&finished_jobs, &finished->elem);
+    num_finished_jobs++;
+}
+
+bool
+print_finished_job(int jid)
+{
+    for (struct list_elem *e = list_begin(&finished_jobs); e != list_end(&finished_jobs); e = list_next(e)) {
+        struct finished_job *finished = list_entry(e, struct finished_job, elem);
+        if (finished->jid == jid) {
+            print_exit(finished->jid, finished->status, finished->timed_out, finished->cmdline);
+            free_finished_job(finished);
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+forget_finished_jobs(void)
+{
+    while (!list_empty(&finished_jobs))
+        free_finished_job(list_entry(list_front(&finished_jobs), struct finished_job, elem));
+}
+
@@ -0,0 +1,214 @@
+#ifndef __JOBS_H
+#define __JOBS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <termios.h>
+#include "list.h"
+#include "shell-ast.h"
+#include "usage.h"
+#include "timeout.h"
+
+struct perfstat;
+struct job_cgroup;
+struct placement;
+struct server_stream;
+struct agent_task;
+
+enum job_status {
+    FOREGROUND,     /* job is running in foreground.  Only one job can be
+                       in the foreground state. */
+    BACKGROUND,     /* job is running in background */
+    STOPPED,        /* job is stopped via SIGSTOP */
+    NEEDSTERMINAL,  /* job is stopped because it was a background job
+                       and requires exclusive terminal access */
+    QUEUED,         /* background job not started yet because admission
+                       control holds it back, see admission.c */
+};
+
+/* An entry in one of the hash tables that map a pid or pgid to a job. */
+struct pid_entry {
+    struct list_elem elem;  /* Link element for the hash bucket. */
+    pid_t pid;
+};
+
+/* A process started for a job. */
+struct job_process {
+    pid_t pid;
+    int pidfd;      /* pidfd referring to the process, or -1 once it has been
+                       reaped or if the kernel does not support pidfds */
+    bool remote;    /* It runs on an agent, which reports its status; its
+                       pid is not in the pid table, see agent.c */
+    bool alive;     /* Not yet known to have exited; only these processes
+                       can be found by get_job_from_pid */
+    int status;     /* waitpid() status, once it has exited */
+    int cmd_start, cmd_len;     /* Its command within the job's cmdline */
+    struct usage usage;         /* Resources it used, once it has exited */
+    double end_time;            /* usage_now() when it was reaped */
+    struct job *job;            /* The job the process belongs to */
+    struct pid_entry pid_index; /* Entry in the pid table */
+};
+
+/* Number of processes a job record holds without allocating */
+#define JOB_INLINE_PROCESSES 4
+
+struct job {
+    struct list_elem elem;   /* Link element for jobs list. */
+    char   *cmdline;         /* The pipeline of commands this job represents,
+                                as printed by print_job */
+    int     jid;             /* Job id. */
+    enum job_status status;  /* Job status. */ 
+    int  num_processes_alive;   /* The number of processes that we know to be alive */
+    struct termios saved_tty_state;  /* The state of the terminal when this job was 
+                                        stopped after having been in foreground */
+
+    /* Add additional fields here if needed. */
+    pid_t pgid;     /* PGID . */
+    struct job_process * processes;    /* inline_processes, or allocated for
+                                          longer pipelines */
+    bool has_saved_tty;
+    int num_processes;
+    struct pid_entry pgid_index;    /* Entry in the pgid table, if pgid is set */
+    struct list_elem completed_elem;    /* Link element for the queue of
+                                           completed jobs */
+    bool waited_for;    /* The wait builtin waits for this job */
+    bool timed;         /* Report its resource usage once it has ended */
+    double start_time;  /* usage_now() when it was spawned */
+    struct perfstat *perf;  /* Its performance counters, or NULL if it
+                               is not counted */
+    bool admitted;      /* Its processes count towards the limits of
+                           admission control */
+    bool has_token;     /* It holds a token of the jobserver */
+    struct queued_job *queued;  /* While it is QUEUED, its place in the
+                                   shell's queue */
+    struct job_cgroup *cgroup;  /* The cgroup its processes run in, or NULL */
+    struct placement *placement;    /* The CPUs it runs on, or NULL if
+                                       it is not placed */
+    bool demoted;       /* Its CPU and IO priority is lowered while it
+                           runs in the background, see priority.c */
+    struct job_timeout timeout;     /* Its time limit, if any */
+    int shm_slot;       /* Its slot in the published job table, or -1 */
+    struct server_stream *stream;   /* Where its output and exit go, if
+                                       a client of a serving shell ran it */
+    struct agent_task *remote;      /* The agent it runs on, if any */
+    struct job_process inline_processes[JOB_INLINE_PROCESSES];
+};
+
+#define MAXJOBS (1<<16)
+#define MAX_FINISHED_JOBS 1024
+
+/* All jobs, in the order they were added. */
+extern struct list job_list;
+
+/* Initialize the job list. */
+void jobs_init(void);
+
+/*
+ * What the shell's other modules attach to a job (its counters, cgroup,
+ * placement, time limit, agent and published entry) is looked after by
+ * the shell through these hooks, so the job table does not depend on
+ * those modules.  Any of them may be NULL.
+ */
+struct job_hooks {
+    /* A job's processes or their status changed */
+    void (*changed)(struct job *job);
+    /* A job is being deleted: release what is attached to it */
+    void (*deleted)(struct job *job);
+    /* Where a job runs if not on this host, or NULL */
+    const char *(*location)(struct job *job);
+    /* Read what all processes of a job used, including those they
+     * started, if that is known */
+    bool (*group_usage)(struct job *job, struct usage *usage);
+};
+
+void jobs_set_hooks(const struct job_hooks *hooks);
+
+/* Return job corresponding to jid, or NULL. */
+struct job * get_job_from_jid(int jid);
+
+/* Return the job that the live process 'pid' belongs to, or NULL, and
+ * set *proc to the process.  Takes constant time. */
+struct job * get_job_from_pid(pid_t pid, struct job_process **proc);
+
+/* Return the job whose process group is 'pgid', or NULL. */
+struct job * get_job_from_pgid(pid_t pgid);
+
+/* Add a new job for 'pipe' to the job list and assign it the lowest free
+ * job id.  The job keeps the text of the command line; 'pipe' is left
+ * to the caller.  Its processes are added with job_add_process. */
+struct job * add_job(struct ast_pipeline *pipe, int max_processes);
+
+/* Add a live process that runs the 'stage'th command of the job's
+ * pipeline, so get_job_from_pid finds it.  Processes must be added in
+ * the order of their stages. */
+struct job_process * job_add_process(struct job *job, int stage, pid_t pid, int pidfd);
+
+/* Add a process that runs the 'stage'th command of the job's pipeline
+ * on an agent.  Its pid is filled in once the agent has started it;
+ * get_job_from_pid does not find it. */
+struct job_process * job_add_remote_process(struct job *job, int stage);
+
+/* Set the process group of a job, so get_job_from_pgid finds it. */
+void job_set_pgid(struct job *job, pid_t pgid);
+
+/* Record that a process has exited with waitpid() status 'status' and
+ * been reaped, having used 'usage' (if not NULL): close its pidfd and
+ * remove it from the pid table, since its pid may now be reused.
+ * When it was the job's last live process, the job is queued for
+ * pop_completed_job. */
+void job_process_exited(struct job_process *proc, int status, const struct usage *usage);
+
+/* Return the exit status of a completed job, which is that of its
+ * last process, as a waitpid() status. */
+int job_exit_status(struct job *job);
+
+/* Remove and return the oldest job whose processes have all exited,
+ * or NULL if there is none. */
+struct job * pop_completed_job(void);
+
+/* Delete a job and release its job id, its cgroup and its placement.
+ * This should be called only when all processes that were
+ * forked for this job are known to have terminated; the caller
+ * must already have removed it from job_list and must not leave it
+ * on the queue of completed jobs.
+ */
+void delete_job(struct job *job);
+
+/* Print a job */
+void print_job(struct job *job);
+
+/* Print the resources used by each process of a job and in total, as
+ * far as they are known: final figures for the processes that have
+ * exited, current ones sampled from /proc for those still running.
+ * For a job in a cgroup, also print what all processes in it used. */
+void print_job_usage(struct job *job);
+
+/* Print the real, user and system time and the peak RSS of each stage
+ * of a completed job and of the whole job to 'out', as time does, and
+ * those of all processes in its cgroup, if it has one. */
+void print_job_times(struct job *job, FILE *out);
+
+/* The status of a job as shown by jobs, e.g. "Running" */
+const char *get_status(struct job *job);
+
+/* Describe how a completed job ended in 'buf', e.g. "Done" or "Exit 1",
+ * and return it */
+const char *job_exit_text(struct job *job, char *buf, size_t size);
+
+/* Print how a completed job ended, e.g. "[1]\tDone\t\t(sleep 1)" */
+void print_job_exit(struct job *job);
+
+/* Remember how a completed background job ended before it is deleted,
+ * so that a later wait can still report it.  Only the most recent
+ * MAX_FINISHED_JOBS are remembered. */
+void remember_job_exit(struct job *job);
+
+/* If the end of job 'jid' is remembered, print it, forget it and
+ * return true. */
+bool print_finished_job(int jid);
+
+/* Forget the ends of all completed jobs. */
+void forget_finished_jobs(void);
+
+#endif /* __JOBS_H */
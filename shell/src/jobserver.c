@@ -0,0 +1,221 @@
+/*
+ * The shell as a GNU make jobserver.
+ *
+ * As in make, a pool of n tokens is a pipe holding n - 1 bytes plus one
+ * implicit token: whoever wants to run one more thing at a time reads a
+ * byte from the pipe first, and writes it back when that has ended.
+ * The shell's background jobs wait for a token before they start, the
+ * first running one taking the implicit token.  Foreground jobs take one
+ * if it is free, but do not wait for it, as they bypass admission
+ * control.  A job that holds a token gets the pipe as descriptors 3 and 4
+ * and MAKEFLAGS in its environment saying so, so a make running in it
+ * builds with its job's token and takes more from the pool for its other
+ * recipes, as would a make it runs itself.  A job without a token gets
+ * neither, so a make in it runs one recipe at a time, outside the pool.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "jobserver.h"
+#include "event_loop.h"
+
+/* The descriptors a job's processes find the pipe at; make 4.2 and
+ * later read them from "--jobserver-auth=3,4" */
+#define JOB_READ_FD 3
+#define JOB_WRITE_FD 4
+
+/* The shell's own descriptors of the pipe are above those, so they are
+ * not overwritten while being passed */
+#define MIN_SHELL_FD 10
+
+/* The pool must fit into the pipe's buffer */
+#define MAX_TOKENS 4096
+
+static int size;            /* Tokens in the pool, 0 while off */
+static int pipe_fds[2] = { -1, -1 };    /* As passed to jobs, which
+                                           expect blocking reads */
+static int take_fd = -1;    /* The shell's nonblocking read end */
+static int held;            /* Tokens held by the shell's jobs */
+static bool watching;       /* take_fd is in the event loop */
+static void (*token_ready)(void);
+static char *makeflags;     /* "MAKEFLAGS=..." for the jobs */
+static char **job_environ;  /* Their environment, see jobserver_environ */
+static size_t job_environ_cap;
+
+void
+jobserver_init(void (*ready)(void))
+{
+    token_ready = ready;
+}
+
+static void
+token_returned(int fd, void *arg)
+{
+    event_loop_remove(take_fd);
+    watching = false;
+    token_ready();
+}
+
+bool
+jobserver_enabled(void)
+{
+    return size > 0;
+}
+
+bool
+jobserver_take(void)
+{
+    char token;
+    if (size == 0 || (held > 0 && read(take_fd, &token, 1) != 1))
+        return false;
+    held++;
+    return true;
+}
+
+void
+jobserver_wait(void)
+{
+    /* until a job or a make gives one back */
+    if (size > 0 && !watching) {
+        event_loop_add(take_fd, token_returned, NULL);
+        watching = true;
+    }
+}
+
+void
+jobserver_give(void)
+{
+    if (size == 0 || held == 0)
+        return;
+    /* tokens are alike: the last job to end gives back the implicit one */
+    if (--held > 0 && write(pipe_fds[1], "+", 1) != 1)
+        perror("jobserver: write");
+}
+
+int
+jobserver_add_file_actions(posix_spawn_file_actions_t *actions)
+{
+    posix_spawn_file_actions_adddup2(actions, pipe_fds[0], JOB_READ_FD);
+    posix_spawn_file_actions_adddup2(actions, pipe_fds[1], JOB_WRITE_FD);
+    return JOB_WRITE_FD + 1;
+}
+
+char **
+jobserver_environ(void)
+{
+    extern char **environ;
+    /* the shell's environment, with MAKEFLAGS replaced; built for every
+     * job, since the shell's may have changed */
+    size_t n = 0;
+    while (environ[n] != NULL)
+        n++;
+    if (n + 2 > job_environ_cap) {
+        job_environ_cap = n + 2;
+        job_environ = realloc(job_environ, job_environ_cap * sizeof *job_environ);
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp(environ[i], "MAKEFLAGS=", 10) != 0)
+            job_environ[k++] = environ[i];
+    }
+    job_environ[k++] = makeflags;
+    job_environ[k] = NULL;
+    return job_environ;
+}
+
+static void
+stop(void)
+{
+    if (watching)
+        event_loop_remove(take_fd);
+    watching = false;
+    close(take_fd);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    take_fd = pipe_fds[0] = pipe_fds[1] = -1;
+    free(makeflags);
+    makeflags = NULL;
+    size = 0;
+}
+
+/* Create a pool of n tokens; returns false after printing an error */
+static bool
+start(int n)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("jobserver: pipe");
+        return false;
+    }
+    pipe_fds[0] = fcntl(fds[0], F_DUPFD_CLOEXEC, MIN_SHELL_FD);
+    pipe_fds[1] = fcntl(fds[1], F_DUPFD_CLOEXEC, MIN_SHELL_FD);
+    close(fds[0]);
+    close(fds[1]);
+    /* reopening the read end gives the shell a file description of its
+     * own, which it can make nonblocking without affecting the jobs */
+    char path[64];
+    snprintf(path, sizeof path, "/proc/self/fd/%d", pipe_fds[0]);
+    take_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    size = n;
+    if (pipe_fds[0] == -1 || pipe_fds[1] == -1 || take_fd == -1) {
+        perror("jobserver");
+        stop();
+        return false;
+    }
+
+    char tokens[MAX_TOKENS];
+    memset(tokens, '+', n - 1);
+    if (n > 1 && write(pipe_fds[1], tokens, n - 1) != n - 1) {
+        perror("jobserver: write");
+        stop();
+        return false;
+    }
+    /* the flags the user gave make come first, so ours win */
+    const char *flags = getenv("MAKEFLAGS");
+    if (asprintf(&makeflags, "MAKEFLAGS=%s%s-j%d --jobserver-auth=%d,%d",
+                 flags ? flags : "", flags && *flags ? " " : "",
+                 n, JOB_READ_FD, JOB_WRITE_FD) == -1) {
+        makeflags = NULL;
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void
+jobserver_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        int available = 0;
+        if (size == 0) {
+            printf("jobserver: off\n");
+        } else if (ioctl(take_fd, FIONREAD, &available) == 0) {
+            /* tokens neither in the pipe nor held by jobs are used by makes */
+            printf("jobserver: %d tokens, %d held by jobs, %d by makes, %d free\n",
+                   size, held, size - held - available - (held == 0),
+                   available + (held == 0));
+        }
+    } else if (strcmp(argv[1], "on") == 0 && (argv[2] == NULL || argv[3] == NULL)) {
+        /* makes still running with the old pool would keep using it */
+        int n = argv[2] != NULL ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+        if (size > 0)
+            printf("jobserver: already on with %d tokens; turn it off first\n", size);
+        else if (n < 1 || n > MAX_TOKENS)
+            printf("jobserver: %d: expected 1 to %d tokens\n", n, MAX_TOKENS);
+        else
+            start(n);
+    } else if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+        if (held > 0)
+            printf("jobserver: %d jobs hold tokens\n", held);
+        else if (size > 0)
+            stop();
+    } else {
+        printf("usage: jobserver [on [ntokens] | off]\n");
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __JOBSERVER_H
+#define __JOBSERVER_H
+
+#include <stdbool.h>
+#include "../posix_spawn/spawn.h"
+
+/*
+ * The shell as a GNU make jobserver: a pool of tokens shared by its
+ * background jobs and by the make -j invocations (and other tools that
+ * speak the protocol) run in any of its jobs, so that together they run
+ * no more than that many things at a time.
+ */
+
+/* 'token_ready' is called when a token may have been returned to the
+ * pool after jobserver_wait. */
+void jobserver_init(void (*token_ready)(void));
+
+/* Whether the shell is a jobserver */
+bool jobserver_enabled(void);
+
+/* Take a token for a job that is about to start.  Returns false if
+ * none is free, or if the shell is not a jobserver. */
+bool jobserver_take(void);
+
+/* Call token_ready once a token may have been given back. */
+void jobserver_wait(void);
+
+/* Return the token of a job that has ended or could not be started. */
+void jobserver_give(void);
+
+/* Add actions that pass the pool to a process of a job that holds a
+ * token; returns the first descriptor after those passed, from which
+ * the others are closed. */
+int jobserver_add_file_actions(posix_spawn_file_actions_t *actions);
+
+/* The environment of the processes of a job that holds a token: the
+ * shell's, with MAKEFLAGS telling make where the pool is. */
+char **jobserver_environ(void);
+
+/*
+ * The jobserver builtin:
+ *   jobserver              print the size of the pool and its tokens in use
+ *   jobserver on [n]       share n tokens, by default one per online CPU
+ *   jobserver off          stop, once no job holds a token; it must be
+ *                          off before the pool can be resized
+ */
+void jobserver_builtin(char **argv);
+
+#endif /* __JOBSERVER_H */
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+#
+# Tests the jobserver builtin: background jobs and the makes they run
+# share one pool of tokens
+#
+
+import os, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# three targets that could all be built at once
+makefile = "/tmp/cush-jobserver-test-%d.mk" % os.getpid()
+with open(makefile, "w") as f:
+    f.write("all: a b c\na b c:\n\t@sleep 1; echo built $@\n")
+
+sendline("jobserver on 3")
+expect_prompt()
+sendline("jobserver")
+expect_exact("jobserver: 3 tokens, 0 held by jobs, 0 by makes, 3 free")
+expect_prompt()
+
+# jobs that get a token are told where the pool is
+sendline("printenv MAKEFLAGS")
+expect("-j3 --jobserver-auth=3,4\r\n")
+expect_prompt()
+
+# the pool is only resized once it is off
+sendline("jobserver on 4")
+expect_exact("jobserver: already on with 3 tokens; turn it off first")
+expect_prompt()
+
+# a make in a background job builds with the job's token and the two
+# others, so the next background job waits until a target is built
+sendline("make -f %s &" % makefile)
+(make,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+time.sleep(0.5)
+sendline("jobserver")
+expect_exact("jobserver: 3 tokens, 1 held by jobs, 2 by makes, 0 free")
+expect_prompt()
+
+# a foreground job does not wait for a token, but without one it does
+# not get the pool either, so a make in it would not exceed the pool
+sendline("printenv MAKEFLAGS")
+expect_prompt()
+assert "jobserver-auth" not in console.before, "a job without a token got the pool"
+sendline("sleep 10 &")
+(sleeper,) = parse_regular_expression(console, "\[([0-9]+)\] Queued")
+expect_prompt()
+expect("built [abc]")
+expect_exact("[%s] " % sleeper)
+expect_exact("[%s]\tDone\t\t(make -f %s)" % (make, makefile))
+
+# the pool is kept while a job holds a token
+sendline("jobserver off")
+expect_exact("jobserver: 1 jobs hold tokens")
+expect_prompt()
+sendline("kill " + sleeper)
+expect_exact("[%s]\tTerminated\t\t(sleep 10)" % sleeper)
+sendline("jobserver off")
+expect_prompt()
+sendline("jobserver")
+expect_exact("jobserver: off")
+expect_prompt()
+
+# errors
+sendline("jobserver on 0")
+expect_exact("jobserver: 0: expected 1 to 4096 tokens")
+expect_prompt()
+
+os.unlink(makefile)
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -0,0 +1,175 @@
+/*
+ * Publishing the job table in shared memory.
+ *
+ * The shell is the only writer.  It updates a job's slot whenever the
+ * job gains or loses a process or changes its status, so the table is
+ * kept current without the shell doing any work for its readers.  See
+ * jobshm.h for the layout and cush-jobs.c for a reader.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "jobshm.h"
+#include "jobs.h"
+#include "usage.h"
+
+static struct jobshm_header *table;     /* The mapped segment, or NULL */
+static size_t table_size;
+static char name[64];
+static int free_slots[JOBSHM_SLOTS];    /* Stack of free slot indices */
+static int num_free;
+static double epoch_offset;     /* Real time minus usage_now() */
+
+/* Change a slot under its sequence count */
+static void
+begin_write(struct jobshm_slot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+end_write(struct jobshm_slot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&table->generation, 1, __ATOMIC_RELEASE);
+}
+
+static void
+unpublish(void)
+{
+    if (table == NULL)
+        return;
+    shm_unlink(name);
+    munmap(table, table_size);
+    table = NULL;
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+        list_entry(e, struct job, elem)->shm_slot = -1;
+}
+
+static bool
+publish(void)
+{
+    snprintf(name, sizeof name, JOBSHM_PREFIX "%d", getpid());
+    /* a segment with our pid was left by a shell that has died */
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    table_size = sizeof *table + JOBSHM_SLOTS * sizeof table->slots[0];
+    if (fd == -1 || ftruncate(fd, table_size) != 0) {
+        printf("jobshm: cannot create /dev/shm%s: %s\n", name, strerror(errno));
+        if (fd != -1) {
+            shm_unlink(name);
+            close(fd);
+        }
+        return false;
+    }
+    table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        table = NULL;
+        shm_unlink(name);
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    epoch_offset = now.tv_sec + now.tv_nsec / 1e9 - usage_now();
+    table->version = JOBSHM_VERSION;
+    table->slot_size = sizeof table->slots[0];
+    table->num_slots = JOBSHM_SLOTS;
+    table->shell_pid = getpid();
+    /* readers check the magic number last */
+    __atomic_store_n(&table->magic, JOBSHM_MAGIC, __ATOMIC_RELEASE);
+    num_free = 0;
+    for (int i = JOBSHM_SLOTS - 1; i >= 0; i--)
+        free_slots[num_free++] = i;
+
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+        jobshm_update(list_entry(e, struct job, elem));
+    return true;
+}
+
+void
+jobshm_init(void)
+{
+    atexit(unpublish);
+    if (getenv("CUSH_JOBSHM") != NULL)
+        publish();
+}
+
+void
+jobshm_update(struct job *job)
+{
+    if (table == NULL)
+        return;
+    if (job->shm_slot == -1) {
+        if (num_free == 0) {
+            table->dropped++;
+            return;
+        }
+        job->shm_slot = free_slots[--num_free];
+    }
+
+    struct jobshm_slot *s = &table->slots[job->shm_slot];
+    begin_write(s);
+    s->jid = job->jid;
+    s->pgid = job->pgid;
+    s->num_processes = job->num_processes;
+    s->num_alive = job->num_processes_alive;
+    s->exit_status = job->num_processes_alive == 0 ? job_exit_status(job) : 0;
+    snprintf(s->status, sizeof s->status, "%s", get_status(job));
+    s->start_time = job->start_time + epoch_offset;
+    s->utime = s->stime = 0;
+    s->maxrss_kb = 0;
+    for (int k = 0; k < job->num_processes; k++) {
+        struct job_process *proc = &job->processes[k];
+        if (k < JOBSHM_PIDS)
+            s->pids[k] = proc->pid;
+        if (!proc->alive) {
+            s->utime += proc->usage.utime;
+            s->stime += proc->usage.stime;
+            if (proc->usage.rss_kb > s->maxrss_kb)
+                s->maxrss_kb = proc->usage.rss_kb;
+        }
+    }
+    snprintf(s->cmdline, sizeof s->cmdline, "%s", job->cmdline != NULL ? job->cmdline : "");
+    end_write(s);
+}
+
+void
+jobshm_remove(struct job *job)
+{
+    if (table == NULL || job->shm_slot == -1)
+        return;
+    struct jobshm_slot *s = &table->slots[job->shm_slot];
+    begin_write(s);
+    s->jid = 0;
+    end_write(s);
+    free_slots[num_free++] = job->shm_slot;
+    job->shm_slot = -1;
+}
+
+void
+jobshm_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        if (table != NULL)
+            printf("jobshm: publishing %d jobs in /dev/shm%s\n", JOBSHM_SLOTS - num_free, name);
+        else
+            printf("jobshm: off\n");
+    } else if (strcmp(argv[1], "on") == 0) {
+        if (table == NULL)
+            publish();
+    } else if (strcmp(argv[1], "off") == 0) {
+        unpublish();
+    } else {
+        printf("usage: jobshm [on | off]\n");
+    }
+}
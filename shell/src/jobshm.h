@@ -0,0 +1,69 @@
+#ifndef __JOBSHM_H
+#define __JOBSHM_H
+
+/*
+ * The job table a shell publishes in shared memory, for monitoring tools
+ * such as cush-jobs.
+ *
+ * The segment /dev/shm/cush-jobs-<pid> holds a header followed by
+ * num_slots slots, one per job.  Each slot is protected by a sequence
+ * count (a seqlock): the shell makes it odd before it changes the slot
+ * and even again afterwards, so a reader copies a slot and retries if
+ * the count was odd or changed meanwhile.  Readers never block the shell.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JOBSHM_MAGIC 0x6a687363     /* "cshj" */
+#define JOBSHM_VERSION 1
+#define JOBSHM_SLOTS 1024
+#define JOBSHM_PIDS 16
+#define JOBSHM_CMDLINE 256
+#define JOBSHM_PREFIX "/cush-jobs-"
+
+struct jobshm_slot {
+    uint32_t seq;           /* Odd while the shell changes the slot */
+    int32_t jid;            /* 0 if the slot is free */
+    int32_t pgid;
+    int32_t num_processes;  /* Started, of which pids holds the first */
+    int32_t num_alive;
+    int32_t exit_status;    /* waitpid() status, once none is alive */
+    char status[16];        /* As shown by jobs, e.g. "Running" */
+    int32_t pids[JOBSHM_PIDS];
+    double start_time;      /* Seconds since the epoch */
+    double utime, stime;    /* CPU time of the exited processes */
+    int64_t maxrss_kb;      /* Largest of their peak resident sizes */
+    char cmdline[JOBSHM_CMDLINE];
+};
+
+struct jobshm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;     /* sizeof(struct jobshm_slot) */
+    uint32_t num_slots;
+    int32_t shell_pid;
+    uint32_t dropped;       /* Jobs not published because no slot was free */
+    uint64_t generation;    /* Incremented after every change of a slot */
+    struct jobshm_slot slots[];
+};
+
+struct job;
+
+/* Publish the job table if $CUSH_JOBSHM is set. */
+void jobshm_init(void);
+
+/* Publish the current state of a job, in a new slot if it has none. */
+void jobshm_update(struct job *job);
+
+/* Free the slot of a job that is deleted. */
+void jobshm_remove(struct job *job);
+
+/*
+ * The jobshm builtin:
+ *   jobshm             print the segment's name, if the table is published
+ *   jobshm on | off    start or stop publishing it
+ */
+void jobshm_builtin(char **argv);
+
+#endif /* __JOBSHM_H */
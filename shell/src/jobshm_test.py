@@ -0,0 +1,53 @@
+#!/usr/bin/python
+#
+# Tests the job table published in shared memory, and its reader cush-jobs
+#
+
+import proc_check
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("jobshm")
+expect_exact("jobshm: off")
+expect_prompt()
+sendline("jobshm on")
+expect_prompt()
+sendline("jobshm")
+expect("jobshm: publishing 0 jobs in /dev/shm/cush-jobs-([0-9]+)")
+shell_pid = int(console.match.group(1))
+expect_prompt()
+
+# a background pipeline, as seen from outside the shell
+sendline("sleep 10 | cat &")
+expect("\[1\] ([0-9]+)")
+pgid = int(console.match.group(1))
+expect_prompt()
+sendline("./cush-jobs %d" % shell_pid)
+expect_exact("cush %d" % shell_pid)
+expect_exact("[1]\tRunning\t\t(sleep 10| cat)")
+expect("\tpgid %d, started [0-9:]+, user [0-9.]+s sys [0-9.]+s rss [0-9]+K, pids %d [0-9]+" % (pgid, pgid))
+expect_prompt()
+
+# its status is kept up to date
+sendline("stop 1")
+expect_prompt()
+sendline("./cush-jobs %d" % shell_pid)
+expect_exact("[1]\tStopped\t\t(sleep 10| cat)")
+expect_prompt()
+sendline("kill -9 1")
+expect_prompt()
+
+# once no longer published, there is nothing to read
+sendline("jobshm off")
+expect_prompt()
+sendline("./cush-jobs %d" % shell_pid)
+expect_exact("cush-jobs: %d: No such file or directory" % shell_pid)
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
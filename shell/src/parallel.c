@@ -0,0 +1,344 @@
+/*
+ * Support for the parallel builtin, which runs a command once per item
+ * with a bounded number of instances at a time.  The instances are
+ * spawned and waited for as ordinary jobs by the shell; this file parses
+ * the arguments, reads the items, builds each instance's command, and
+ * merges the output of the instances.
+ *
+ * With --tag or --keep-order, the stdout of every instance is a pipe
+ * read in the event loop.  With --tag, only whole lines are written,
+ * each prefixed with the item, so the lines of concurrent instances do
+ * not get mixed up.  With --keep-order, the output of an instance is
+ * held back until all instances for earlier items have finished; that
+ * of the oldest unfinished instance is written as it arrives.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "parallel.h"
+#include "event_loop.h"
+#include "utils.h"
+
+/* Most instances that may be running at the same time */
+#define MAX_PARALLEL_JOBS 1024
+
+bool
+parallel_parse_args(char **argv, struct parallel_args *args)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    args->jobs = ncpus > 0 ? ncpus : 1;
+    args->tag = false;
+    args->keep_order = false;
+    args->items = NULL;
+    args->num_items = 0;
+
+    int k = 1;
+    for (; argv[k] != NULL && argv[k][0] == '-'; k++) {
+        if (strcmp(argv[k], "--tag") == 0) {
+            args->tag = true;
+        } else if (strcmp(argv[k], "--keep-order") == 0 || strcmp(argv[k], "-k") == 0) {
+            args->keep_order = true;
+        } else if (strncmp(argv[k], "-j", 2) == 0) {
+            const char *n = argv[k][2] != '\0' ? argv[k] + 2 : argv[++k];
+            char *end = NULL;
+            long jobs = n != NULL ? strtol(n, &end, 10) : 0;
+            if (n == NULL || *end != '\0' || jobs < 1 || jobs > MAX_PARALLEL_JOBS) {
+                printf("parallel: -j takes a number from 1 to %d\n", MAX_PARALLEL_JOBS);
+                return false;
+            }
+            args->jobs = jobs;
+        } else if (strcmp(argv[k], "--") == 0) {
+            k++;
+            break;
+        } else {
+            printf("parallel: unknown option %s\n", argv[k]);
+            return false;
+        }
+    }
+
+    args->command = &argv[k];
+    args->command_len = 0;
+    while (argv[k] != NULL && strcmp(argv[k], ":::") != 0)
+        args->command_len++, k++;
+    if (args->command_len == 0) {
+        printf("usage: parallel [-j N] [--tag] [--keep-order] command [arg...] [::: item...]\n");
+        return false;
+    }
+    if (argv[k] != NULL) {
+        args->items = &argv[k + 1];
+        while (args->items[args->num_items] != NULL)
+            args->num_items++;
+    }
+    return true;
+}
+
+char **
+parallel_read_items(int fd, size_t *num_items)
+{
+    size_t len = 0, cap = 4096;
+    char *text = malloc(cap);
+    for (;;) {
+        if (len + 1 == cap)
+            text = realloc(text, cap *= 2);
+        ssize_t n = read(fd, text + len, cap - len - 1);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    text[len] = '\0';
+
+    size_t count = 0;
+    char **items = malloc(sizeof *items);
+    char *saveptr;
+    for (char *line = strtok_r(text, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+        items = realloc(items, (count + 2) * sizeof *items);
+        items[count++] = strdup(line);
+    }
+    items[count] = NULL;
+    free(text);
+    *num_items = count;
+    return items;
+}
+
+void
+parallel_free_items(char **items)
+{
+    for (char **p = items; *p != NULL; p++)
+        free(*p);
+    free(items);
+}
+
+/* Return a copy of 'word' with each "{}" replaced by 'item' */
+static char *
+replace_braces(const char *word, const char *item)
+{
+    char *result;
+    size_t size;
+    FILE *f = open_memstream(&result, &size);
+    for (const char *p = word; *p != '\0'; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            fputs(item, f);
+            p++;
+        } else {
+            fputc(*p, f);
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+char **
+parallel_command(const struct parallel_args *args, const char *item)
+{
+    char **argv = malloc((args->command_len + 2) * sizeof *argv);
+    bool replaced = false;
+    size_t k;
+    for (k = 0; k < args->command_len; k++) {
+        replaced |= strstr(args->command[k], "{}") != NULL;
+        argv[k] = replace_braces(args->command[k], item);
+    }
+    if (!replaced)
+        argv[k++] = strdup(item);
+    argv[k] = NULL;
+    return argv;
+}
+
+/* The output of one instance */
+struct instance_output {
+    struct parallel_output *out;
+    size_t seq;         /* Index of the instance, in the order of the items */
+    int fd;             /* Read end of its stdout, -1 at end of file */
+    char *item;
+    char *buf;          /* Output not yet written */
+    size_t len, cap;
+};
+
+struct parallel_output {
+    int fd;             /* Where the output goes */
+    bool tag;
+    bool keep_order;
+    struct instance_output **instances;   /* By seq; NULL once written */
+    size_t num_instances;
+    size_t next;        /* With keep_order, the instance being written */
+    int num_open;       /* Instances whose pipe is still open */
+};
+
+/* Write all of 'len' bytes to 'fd' */
+static void
+write_all(int fd, const char *buf, size_t len)
+{
+    fflush(stdout);
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Write what an instance may write so far: with --tag only whole
+ * lines, unless it has ended. */
+static void
+flush_instance(struct instance_output *inst)
+{
+    struct parallel_output *out = inst->out;
+    if (inst->len == 0 || (out->keep_order && inst->seq != out->next))
+        return;
+
+    size_t end = inst->len;
+    if (out->tag && inst->fd != -1) {
+        char *nl = memrchr(inst->buf, '\n', inst->len);
+        end = nl != NULL ? nl - inst->buf + 1 : 0;
+    }
+    if (end == 0)
+        return;
+
+    if (!out->tag) {
+        write_all(out->fd, inst->buf, end);
+    } else {
+        char *tagged;
+        size_t size;
+        FILE *f = open_memstream(&tagged, &size);
+        for (size_t start = 0; start < end; ) {
+            char *nl = memchr(inst->buf + start, '\n', end - start);
+            size_t line_len = nl != NULL ? nl - (inst->buf + start) : end - start;
+            fprintf(f, "%s\t%.*s\n", inst->item, (int) line_len, inst->buf + start);
+            start += line_len + 1;
+        }
+        fclose(f);
+        write_all(out->fd, tagged, size);
+        free(tagged);
+    }
+    memmove(inst->buf, inst->buf + end, inst->len - end);
+    inst->len -= end;
+}
+
+static void
+free_instance(struct instance_output *inst)
+{
+    inst->out->instances[inst->seq] = NULL;
+    free(inst->item);
+    free(inst->buf);
+    free(inst);
+}
+
+/* With --keep-order, move on past the instances that have ended and
+ * write the output of the next one so far. */
+static void
+advance(struct parallel_output *out)
+{
+    while (out->next < out->num_instances) {
+        struct instance_output *inst = out->instances[out->next];
+        flush_instance(inst);
+        if (inst->fd != -1)
+            break;
+        free_instance(inst);
+        out->next++;
+    }
+}
+
+static void
+close_instance(struct instance_output *inst)
+{
+    event_loop_remove(inst->fd);
+    close(inst->fd);
+    inst->fd = -1;
+    inst->out->num_open--;
+}
+
+static void
+output_ready(int fd, void *arg)
+{
+    struct instance_output *inst = arg;
+    for (;;) {
+        if (inst->cap - inst->len < 4096) {
+            inst->cap = inst->cap * 2 + 4096;
+            inst->buf = realloc(inst->buf, inst->cap);
+        }
+        ssize_t n = read(fd, inst->buf + inst->len, inst->cap - inst->len);
+        if (n > 0) {
+            inst->len += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 || errno != EAGAIN)
+            close_instance(inst);
+        break;
+    }
+
+    struct parallel_output *out = inst->out;
+    if (out->keep_order) {
+        advance(out);
+    } else {
+        flush_instance(inst);
+        if (inst->fd == -1)
+            free_instance(inst);
+    }
+}
+
+struct parallel_output *
+parallel_output_create(bool tag, bool keep_order, int fd)
+{
+    struct parallel_output *out = calloc(1, sizeof *out);
+    out->fd = fd;
+    out->tag = tag;
+    out->keep_order = keep_order;
+    return out;
+}
+
+int
+parallel_output_add(struct parallel_output *out, const char *item)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        utils_error("parallel: cannot create pipe: ");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    struct instance_output *inst = calloc(1, sizeof *inst);
+    inst->out = out;
+    inst->seq = out->num_instances;
+    inst->fd = fds[0];
+    inst->item = strdup(item);
+    out->instances = realloc(out->instances, (out->num_instances + 1) * sizeof *out->instances);
+    out->instances[out->num_instances++] = inst;
+    out->num_open++;
+    event_loop_add(inst->fd, output_ready, inst);
+    return fds[1];
+}
+
+bool
+parallel_output_busy(struct parallel_output *out)
+{
+    return out->num_open > 0;
+}
+
+void
+parallel_output_destroy(struct parallel_output *out)
+{
+    for (size_t k = out->keep_order ? out->next : 0; k < out->num_instances; k++) {
+        struct instance_output *inst = out->instances[k];
+        if (inst == NULL)
+            continue;
+        if (inst->fd != -1)
+            close_instance(inst);
+        if (out->keep_order)
+            out->next = k;
+        flush_instance(inst);
+        free_instance(inst);
+    }
+    free(out->instances);
+    free(out);
+}
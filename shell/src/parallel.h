@@ -0,0 +1,58 @@
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The arguments of the parallel builtin:
+ *   parallel [-j N] [--tag] [--keep-order] command [arg...] [::: item...]
+ */
+struct parallel_args {
+    int jobs;           /* Most instances running at the same time */
+    bool tag;           /* Prefix each output line with its item */
+    bool keep_order;    /* Output in the order of the items */
+    char **command;     /* Command template */
+    size_t command_len; /* Its number of words, up to ':::' */
+    char **items;       /* The items after ':::', or NULL if none */
+    size_t num_items;
+};
+
+/* Parse the arguments of the parallel builtin 'argv'.  The command
+ * and items point into 'argv'.  Prints a message and returns false if
+ * they are invalid. */
+bool parallel_parse_args(char **argv, struct parallel_args *args);
+
+/* Read items from 'fd' until end of file, one per non-empty line.
+ * Returns a NULL-terminated array to be freed with parallel_free_items. */
+char **parallel_read_items(int fd, size_t *num_items);
+
+/* Free an array returned by parallel_read_items. */
+void parallel_free_items(char **items);
+
+/* Return the argv of the instance of the command template for 'item':
+ * each "{}" in an argument is replaced by the item, and if there is
+ * none, the item is added as the last argument.  All strings are
+ * allocated, as for ast_command_create. */
+char **parallel_command(const struct parallel_args *args, const char *item);
+
+/*
+ * Collects the output of the instances through pipes, so that it can be
+ * tagged or kept in order.  The pipes are read in the event loop.
+ */
+struct parallel_output;
+
+/* Create a collector that writes the merged output to 'fd' */
+struct parallel_output *parallel_output_create(bool tag, bool keep_order, int fd);
+
+/* Start collecting the output of the next instance, which runs for
+ * 'item'.  Returns the end of the pipe its stdout is to be connected
+ * to, which the caller must close once it has been spawned, or -1. */
+int parallel_output_add(struct parallel_output *out, const char *item);
+
+/* Return true while an instance may still write output. */
+bool parallel_output_busy(struct parallel_output *out);
+
+/* Write what is left and free the collector. */
+void parallel_output_destroy(struct parallel_output *out);
+
+#endif /* __PARALLEL_H */
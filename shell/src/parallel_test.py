@@ -0,0 +1,43 @@
+#!/usr/bin/python
+#
+# Tests the parallel builtin
+#
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# items after ':::', tagged and in order
+sendline("parallel -j 3 --tag --keep-order echo x{}y ::: 1 2 3")
+expect_exact("1\tx1y\r\n2\tx2y\r\n3\tx3y")
+expect_prompt()
+
+# the output is kept in order even if later items finish first
+sendline("parallel -k sh -c \"sleep 0.$((4-{})); echo {}\" ::: 1 2 3")
+expect_exact("1\r\n2\r\n3")
+expect_prompt()
+
+# items read from the commands piped into parallel
+sendline("seq 3 | parallel -k echo n")
+expect_exact("n 1\r\nn 2\r\nn 3")
+expect_prompt()
+
+# at most 2 instances run at a time
+start = time.time()
+sendline("parallel -j 2 sleep ::: 0.5 0.5 0.5 0.5")
+expect_prompt()
+assert time.time() - start >= 1.0, "more than 2 instances ran at a time"
+
+# failed instances are counted
+sendline("parallel false ::: 1 2")
+expect_exact("parallel: 2 of 2 instances failed")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
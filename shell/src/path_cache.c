@@ -0,0 +1,323 @@
+/*
+ * A cache of PATH lookups for the commands run by the shell.
+ *
+ * posix_spawnp searches PATH in the child, trying execve in every
+ * directory until one succeeds, while the shell is suspended.  Instead,
+ * the shell resolves each command name once, remembers the result (also
+ * when the command was not found) and spawns the remembered path, which
+ * the child executes directly.
+ *
+ * The directories on PATH are watched with inotify, and a name is
+ * forgotten whenever a file of that name is created, removed, renamed
+ * or has its permissions changed in one of them.  Results that depend
+ * on a directory that cannot be watched (such as a relative one) are not
+ * remembered.  Changes made on other hosts of a network file system, and
+ * directories on PATH that are created later, are not seen; 'hash -r'
+ * clears the cache.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "path_cache.h"
+#include "list.h"
+
+#define NBUCKETS 256
+
+/* Used by execvpe if PATH is not set */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+struct path_entry {
+    struct list_elem elem;  /* Link element for the hash bucket. */
+    char *name;             /* Command name as typed. */
+    char *path;             /* Resolved path, or NULL if not found. */
+    int error;              /* errno for a failed lookup. */
+    int hits;               /* Number of times this lookup was reused. */
+    bool transient;         /* True if the result cannot be remembered and
+                               is dropped by the next path_cache_refresh. */
+};
+
+static struct list buckets[NBUCKETS];
+static int inotify_fd = -1;
+static char *watched_path;      /* The value of PATH that is being watched,
+                                   or NULL if the watches need to be set up */
+static int num_watched_dirs;    /* Number of leading PATH directories that
+                                   are watched */
+static int num_path_dirs;       /* Number of directories on PATH */
+
+static unsigned int
+hash_name(const char *name)
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h % NBUCKETS;
+}
+
+static struct path_entry *
+find_entry(const char *name)
+{
+    struct list *bucket = &buckets[hash_name(name)];
+    for (struct list_elem *e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+        struct path_entry *entry = list_entry(e, struct path_entry, elem);
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void
+free_entry(struct path_entry *entry)
+{
+    list_remove(&entry->elem);
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+static struct path_entry *
+insert_entry(const char *name, const char *path, int error, bool transient)
+{
+    struct path_entry *entry = find_entry(name);
+    if (entry != NULL)
+        free_entry(entry);
+
+    entry = malloc(sizeof *entry);
+    entry->name = strdup(name);
+    entry->path = path ? strdup(path) : NULL;
+    entry->error = error;
+    entry->hits = 0;
+    entry->transient = transient;
+    list_push_back(&buckets[hash_name(name)], &entry->elem);
+    return entry;
+}
+
+/* Return the PATH used for lookups */
+static const char *
+get_path(void)
+{
+    const char *path = getenv("PATH");
+    return path ? path : DEFAULT_PATH;
+}
+
+/* Set up watches for the directories on PATH if it changed */
+static void
+watch_path(void)
+{
+    const char *path = get_path();
+    if (watched_path != NULL && strcmp(watched_path, path) == 0)
+        return;
+
+    path_cache_clear();
+    free(watched_path);
+    watched_path = strdup(path);
+
+    /* Starting over with a new instance drops all old watches */
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    num_path_dirs = 0;
+    num_watched_dirs = 0;
+    bool all_watched = inotify_fd != -1;
+    char *dirs = strdup(path);
+    for (char *dir = dirs, *next; dir != NULL; dir = next) {
+        next = strchr(dir, ':');
+        if (next)
+            *next++ = '\0';
+
+        num_path_dirs++;
+        /* Relative directories depend on the working directory.
+         * Directories that do not exist are treated as watched, since
+         * PATH commonly lists some; creating one later requires 'hash -r'. */
+        if (all_watched && dir[0] == '/'
+            && (inotify_add_watch(inotify_fd, dir,
+                   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                   | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) != -1
+                || errno == ENOENT || errno == ENOTDIR))
+            num_watched_dirs++;
+        else
+            all_watched = false;
+    }
+    free(dirs);
+}
+
+void
+path_cache_init(void)
+{
+    for (int i = 0; i < NBUCKETS; i++)
+        list_init(&buckets[i]);
+    watch_path();
+}
+
+void
+path_cache_clear(void)
+{
+    for (int i = 0; i < NBUCKETS; i++)
+        while (!list_empty(&buckets[i]))
+            free_entry(list_entry(list_front(&buckets[i]), struct path_entry, elem));
+}
+
+void
+path_cache_refresh(void)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while (inotify_fd != -1 && (len = read(inotify_fd, buf, sizeof buf)) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            if (event->len > 0) {
+                struct path_entry *entry = find_entry(event->name);
+                if (entry != NULL)
+                    free_entry(entry);
+            } else {
+                /* A directory itself went away, or events were lost */
+                free(watched_path);
+                watched_path = NULL;
+            }
+            p += sizeof *event + event->len;
+        }
+    }
+    watch_path();
+
+    for (int i = 0; i < NBUCKETS; i++) {
+        struct list_elem *e = list_begin(&buckets[i]);
+        while (e != list_end(&buckets[i])) {
+            struct path_entry *entry = list_entry(e, struct path_entry, elem);
+            e = list_next(e);
+            if (entry->transient)
+                free_entry(entry);
+        }
+    }
+}
+
+/*
+ * Search the directories in 'path' for 'name' the way execvpe does.
+ * A file that exists but cannot be executed is skipped, and makes
+ * the search fail with EACCES rather than ENOENT.
+ * Returns the malloc'd path found, or NULL with *error set.
+ * *dir_index is set to the index of the directory it was found in,
+ * or to the number of directories searched.
+ */
+static char *
+find_in_path(const char *path, const char *name, int *error, int *dir_index)
+{
+    bool got_eacces = false;
+    char *dirs = strdup(path);
+    char *found = NULL;
+
+    *dir_index = 0;
+    for (char *dir = dirs, *next; dir != NULL; dir = next, ++*dir_index) {
+        next = strchr(dir, ':');
+        if (next)
+            *next++ = '\0';
+
+        char *candidate;
+        if (asprintf(&candidate, "%s/%s", *dir ? dir : ".", name) == -1)
+            continue;
+
+        struct stat st;
+        if (stat(candidate, &st) == 0) {
+            if (S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+                found = candidate;
+                break;
+            }
+            got_eacces = true;
+        } else if (errno == EACCES) {
+            got_eacces = true;
+        }
+        free(candidate);
+    }
+    free(dirs);
+
+    *error = found ? 0 : got_eacces ? EACCES : ENOENT;
+    return found;
+}
+
+/* Search PATH for 'name' and record the result. */
+static struct path_entry *
+search_path(const char *name, bool remember)
+{
+    int error, dir_index;
+    char *found = find_in_path(get_path(), name, &error, &dir_index);
+
+    /* The result is only known to stay correct while the directories
+     * searched are watched. */
+    bool cacheable = found ? dir_index < num_watched_dirs
+                           : num_watched_dirs == num_path_dirs;
+    struct path_entry *entry = insert_entry(name, found, error,
+                                            !remember && !cacheable);
+    free(found);
+    return entry;
+}
+
+char *
+path_cache_search(const char *path, const char *name)
+{
+    if (strchr(name, '/') != NULL)
+        return strdup(name);
+    if (*name == '\0')
+        return NULL;
+
+    int error, dir_index;
+    return find_in_path(path ? path : DEFAULT_PATH, name, &error, &dir_index);
+}
+
+const char *
+path_cache_resolve(const char *name, int *error)
+{
+    *error = 0;
+    if (strchr(name, '/') != NULL)
+        return name;
+    if (*name == '\0') {
+        *error = ENOENT;
+        return NULL;
+    }
+
+    struct path_entry *entry = find_entry(name);
+    if (entry != NULL)
+        entry->hits++;
+    else
+        entry = search_path(name, false);
+
+    *error = entry->error;
+    return entry->path;
+}
+
+bool
+path_cache_add(const char *name)
+{
+    if (strchr(name, '/') != NULL)
+        return access(name, X_OK) == 0;
+
+    return search_path(name, true)->path != NULL;
+}
+
+void
+path_cache_print(void)
+{
+    bool empty = true;
+    for (int i = 0; i < NBUCKETS; i++) {
+        for (struct list_elem *e = list_begin(&buckets[i]); e != list_end(&buckets[i]); e = list_next(e)) {
+            struct path_entry *entry = list_entry(e, struct path_entry, elem);
+            if (entry->transient)
+                continue;
+            if (empty)
+                printf("hits\tcommand\n");
+            empty = false;
+            if (entry->path)
+                printf("%4d\t%s\n", entry->hits, entry->path);
+            else
+                printf("%4d\t%s (not found)\n", entry->hits, entry->name);
+        }
+    }
+    if (empty)
+        printf("hash: hash table empty\n");
+}
@@ -0,0 +1,42 @@
+#ifndef __PATH_CACHE_H
+#define __PATH_CACHE_H
+
+#include <stdbool.h>
+
+/* Initialize the cache of PATH lookups. */
+void path_cache_init(void);
+
+/*
+ * Forget the lookups invalidated by changes to the directories on PATH
+ * (or to PATH itself) since the last call.  Paths returned by
+ * path_cache_resolve before this call must not be used afterwards.
+ */
+void path_cache_refresh(void);
+
+/*
+ * Find the executable a PATH search for 'name' would run.
+ * Returns its path, or NULL with *error set to the errno that executing
+ * 'name' would fail with.  Names containing a '/' are returned as is.
+ * The result stays valid until the next call to path_cache_refresh,
+ * path_cache_add or path_cache_clear.
+ */
+const char *path_cache_resolve(const char *name, int *error);
+
+/* Look up 'name' and remember the result.  Returns false if not found. */
+bool path_cache_add(const char *name);
+
+/* Forget all remembered lookups. */
+void path_cache_clear(void);
+
+/*
+ * Search the directories in 'path' (a value of PATH, or NULL for the
+ * default) for 'name' without using or updating the cache, so that it
+ * can be called from any thread.
+ * Returns the malloc'd path of the executable, or NULL if not found.
+ */
+char *path_cache_search(const char *path, const char *name);
+
+/* Print the remembered lookups, as the 'hash' builtin does. */
+void path_cache_print(void);
+
+#endif /* __PATH_CACHE_H */
@@ -0,0 +1,204 @@
+/*
+ * Performance counters for jobs, read through perf_event_open.
+ *
+ * A counter opened on a task with 'inherit' set is copied into every
+ * child the task creates afterwards, and the counts of a child are added
+ * to it when the child exits.  So the pipeline is spawned by a short-lived
+ * helper thread, which first opens the counters on itself, disabled and
+ * with 'enable_on_exec' set: each process of the job then starts counting
+ * when it execs its program, and its descendants are counted as well.
+ * The helper thread itself never execs, so nothing it does is counted,
+ * and since it exits right away, later jobs do not inherit the counters.
+ *
+ * Each counter is opened on its own rather than as a group, since
+ * inherited counters cannot be read as a group.  If the kernel must
+ * multiplex the hardware counters, their counts are scaled up by the
+ * fraction of the time they were actually counting, as perf stat does.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfstat.h"
+#include "utils.h"
+
+enum counter {
+    TASK_CLOCK, CONTEXT_SWITCHES, CPU_MIGRATIONS, PAGE_FAULTS,
+    CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES,
+    NUM_COUNTERS
+};
+
+static const struct counter_def {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_defs[NUM_COUNTERS] = {
+    [TASK_CLOCK] = { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    [CONTEXT_SWITCHES] = { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    [CPU_MIGRATIONS] = { "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    [PAGE_FAULTS] = { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    [CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [CACHE_MISSES] = { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+struct perfstat {
+    int fds[NUM_COUNTERS];      /* -1 if the counter is not supported */
+};
+
+/* What perf_event_open returns on read with the read_format used here */
+struct counter_value {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+/* Open a counter on the calling thread, or return -1. */
+static int
+open_counter(const struct counter_def *def)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = def->type;
+    attr.config = def->config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.enable_on_exec = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+        /* perf_event_paranoid may allow counting user space only */
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+/* Arguments and result of a spawn done by the helper thread */
+struct perfstat_spawn {
+    struct perfstat *counters;
+    pid_t *pids;
+    int *pidfds;
+    const struct posix_spawn_stage *stages;
+    size_t nstages;
+    const posix_spawnattr_t *attr;
+    char *const *envp;
+    int result;
+};
+
+static void *
+spawner_thread(void *arg)
+{
+    struct perfstat_spawn *spawn = arg;
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        spawn->counters->fds[i] = open_counter(&counter_defs[i]);
+
+    spawn->result = posix_spawn_pipeline_np(spawn->pids, spawn->pidfds, spawn->stages,
+                                            spawn->nstages, spawn->attr, spawn->envp);
+    return NULL;
+}
+
+int
+perfstat_spawn_pipeline(struct perfstat **counters, pid_t *pids, int *pidfds,
+                        const struct posix_spawn_stage *stages, size_t nstages,
+                        const posix_spawnattr_t *attr, char *const envp[])
+{
+    struct perfstat_spawn spawn = {
+        .counters = malloc(sizeof (struct perfstat)),
+        .pids = pids, .pidfds = pidfds,
+        .stages = stages, .nstages = nstages,
+        .attr = attr, .envp = envp,
+    };
+    *counters = NULL;
+    if (spawn.counters == NULL)
+        return posix_spawn_pipeline_np(pids, pidfds, stages, nstages, attr, envp);
+
+    /* the helper thread must not take any of the shell's signals */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, spawner_thread, &spawn);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (rc != 0) {
+        errno = rc;
+        utils_error("Cannot start thread to count job: ");
+        free(spawn.counters);
+        return posix_spawn_pipeline_np(pids, pidfds, stages, nstages, attr, envp);
+    }
+    pthread_join(thread, NULL);
+
+    bool any = false;
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        any |= spawn.counters->fds[i] != -1;
+    if (any)
+        *counters = spawn.counters;
+    else
+        free(spawn.counters);
+    return spawn.result;
+}
+
+/* Read a counter, scaled for the time it was not running.
+ * Returns false if it could not be read or has not counted at all. */
+static bool
+read_counter(int fd, double *count)
+{
+    struct counter_value v;
+    if (fd == -1 || read(fd, &v, sizeof v) != sizeof v || v.time_running == 0)
+        return false;
+
+    *count = v.value;
+    if (v.time_running < v.time_enabled)
+        *count *= (double) v.time_enabled / v.time_running;
+    return true;
+}
+
+void
+perfstat_print(struct perfstat *counters, const char *indent, FILE *out)
+{
+    double counts[NUM_COUNTERS];
+    bool counted[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        counted[i] = read_counter(counters->fds[i], &counts[i]);
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        const char *name = counter_defs[i].name;
+
+        if (counters->fds[i] == -1)
+            fprintf(out, "%s%18s  %s\n", indent, "<not supported>", name);
+        else if (!counted[i])
+            fprintf(out, "%s%18s  %s\n", indent, "<not counted>", name);
+        else if (i == TASK_CLOCK)
+            fprintf(out, "%s%13.3f msec  %s\n", indent, counts[i] / 1e6, name);
+        else if (i == INSTRUCTIONS && counted[CYCLES] && counts[CYCLES] > 0)
+            fprintf(out, "%s%18.0f  %-16s # %.2f insn per cycle\n", indent, counts[i], name,
+                    counts[i] / counts[CYCLES]);
+        else
+            fprintf(out, "%s%18.0f  %s\n", indent, counts[i], name);
+    }
+}
+
+void
+perfstat_free(struct perfstat *counters)
+{
+    if (counters == NULL)
+        return;
+    for (int i = 0; i < NUM_COUNTERS; i++)
+        if (counters->fds[i] != -1)
+            close(counters->fds[i]);
+    free(counters);
+}
@@ -0,0 +1,29 @@
+#ifndef __PERFSTAT_H
+#define __PERFSTAT_H
+
+#include <stdio.h>
+#include "../posix_spawn/spawn.h"
+
+/* The performance counters of a job */
+struct perfstat;
+
+/*
+ * Spawn a pipeline as posix_spawn_pipeline_np does, with performance
+ * counters that count every process of the pipeline, and every process
+ * those start, from the first instruction of its program.  The hardware
+ * counters are left out if the PMU cannot be used; *counters is set to
+ * NULL if no counter at all could be opened.
+ * Returns the result of posix_spawn_pipeline_np.
+ */
+int perfstat_spawn_pipeline(struct perfstat **counters, pid_t *pids, int *pidfds,
+                            const struct posix_spawn_stage *stages, size_t nstages,
+                            const posix_spawnattr_t *attr, char *const envp[]);
+
+/* Print the counts so far to 'out', each line starting with 'indent'.
+ * Once all processes of the job have exited, these are final. */
+void perfstat_print(struct perfstat *counters, const char *indent, FILE *out);
+
+/* Close the counters and free them. */
+void perfstat_free(struct perfstat *counters);
+
+#endif /* __PERFSTAT_H */
@@ -0,0 +1,49 @@
+#!/usr/bin/python
+#
+# Tests the perfstat prefix: the software counters are always reported,
+# while hardware counters that cannot be opened, e.g. in a VM without a
+# PMU or when perf_event_paranoid denies them, are shown as not supported
+# instead of keeping the pipeline from running
+#
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a count, or <not supported> where there is no PMU
+hardware = "(<not supported>|<not counted>|[0-9]+)"
+
+sendline("perfstat echo counted | cat")
+expect_exact("counted")
+expect_exact("Performance counter stats for 'echo counted| cat':")
+expect(" +[0-9]+\.[0-9]{3} msec  task-clock\r\n")
+expect(" +[0-9]+  context-switches\r\n")
+expect(" +[0-9]+  cpu-migrations\r\n")
+expect(" +[1-9][0-9]*  page-faults\r\n")
+for name in ["cycles", "instructions", "cache-misses", "branch-misses"]:
+    expect(" +%s  %s" % (hardware, name))
+expect_prompt()
+
+# a command that fails is counted too
+sendline("perfstat false")
+expect_exact("Performance counter stats for 'false':")
+expect(" +[0-9]+\.[0-9]{3} msec  task-clock\r\n")
+expect_prompt()
+
+# jobs -p shows the counts of a running job so far
+sendline("perfstat sleep 10 &")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+sendline("jobs -p")
+expect_exact("[%s]\tRunning\t\t(sleep 10)" % jid)
+expect("\t +[0-9]+\.[0-9]{3} msec  task-clock\r\n")
+expect_prompt()
+sendline("kill " + jid)
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
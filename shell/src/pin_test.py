@@ -0,0 +1,57 @@
+#!/usr/bin/python
+#
+# Tests the pin builtin, which runs jobs on chosen CPUs
+#
+
+import proc_check
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a pinned command may only run on the given CPU
+sendline("pin 0 grep Cpus_allowed_list /proc/self/status")
+expect_exact("Cpus_allowed_list:\t0\r\n")
+expect_prompt()
+
+# pin combines with time
+sendline("pin 0 time grep Cpus_allowed_list /proc/self/status")
+expect_exact("Cpus_allowed_list:\t0\r\n")
+expect("real")
+expect_prompt()
+
+# pin prints the topology, and where jobs are placed
+sendline("sleep 2 &")
+expect("\[1\] [0-9]+")
+expect_prompt()
+sendline("pin -j 1 0")
+expect_prompt()
+sendline("pin")
+expect_exact("pin: automatic placement off")
+expect("cache domain: cpus [-0-9,]+, node -?[0-9]+, load [0-9]+")
+expect_exact("[1]\tcpus 0\t(sleep 2)")
+expect_prompt()
+sendline("pin auto")
+expect_prompt()
+sendline("pin")
+expect_exact("pin: automatic placement on")
+expect_prompt()
+sendline("pin off")
+expect_prompt()
+
+# errors
+sendline("pin -j 9 0")
+expect_exact("pin: no such job")
+expect_prompt()
+sendline("pin -j 1 x")
+expect_exact("pin: expected a list of online CPUs")
+expect_prompt()
+sendline("pin 100000 true")
+expect_exact("usage: pin")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -0,0 +1,392 @@
+/*
+ * Placement of jobs on CPUs and NUMA nodes.
+ *
+ * The topology is read once from /sys/devices/system: the CPUs that
+ * share their last-level cache (L3, or L2 where there is none) form a
+ * cache domain, and the domains belong to packages (sockets).  The load
+ * of a package or domain is not measured but counted: each job placed
+ * there adds its number of commands until it is deleted.  A placed job
+ * is restricted to the CPUs of its domain or package, and prefers to
+ * allocate memory on their NUMA node, through the spawn attributes that
+ * libspawn applies in the child before it execs.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+
+#include "placement.h"
+#include "jobs.h"
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/* CPUs that share a last-level cache */
+struct domain {
+    cpu_set_t cpus;
+    int ncpus;
+    int package;        /* Index in packages */
+    int load;
+};
+
+struct package {
+    int id;             /* physical_package_id */
+    cpu_set_t cpus;
+    int ncpus;
+    int load;
+};
+
+static struct domain *domains;
+static int num_domains;
+static struct package *packages;
+static int num_packages;
+static cpu_set_t online;
+static int node_of_cpu[CPU_SETSIZE];
+static int num_nodes;
+static bool automatic;      /* New jobs are placed by placement_choose */
+
+/* Read the first line of a sysfs file */
+static bool
+read_line(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return false;
+    bool ok = fgets(buf, size, f) != NULL;
+    fclose(f);
+    return ok;
+}
+
+static int
+read_int(const char *path)
+{
+    char text[32];
+    return read_line(path, text, sizeof text) ? atoi(text) : -1;
+}
+
+/* Parse a list of CPUs such as "0-3,8" */
+static bool
+parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || first < 0)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+        }
+        if (last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != '\n')
+            return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+/* Format a set of CPUs as a list such as "0-3,8" */
+static void
+format_cpu_list(const cpu_set_t *set, char *buf, size_t size)
+{
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last == cpu)
+            len += snprintf(buf + len, size - len, "%s%d", len > 0 ? "," : "", cpu);
+        else
+            len += snprintf(buf + len, size - len, "%s%d-%d", len > 0 ? "," : "", cpu, last);
+        cpu = last;
+    }
+}
+
+/* Read the CPUs that share the last-level data cache with 'cpu' */
+static bool
+read_llc(int cpu, cpu_set_t *set)
+{
+    int best = 0;
+    for (int index = 0; ; index++) {
+        char path[128], text[4096];
+        snprintf(path, sizeof path, SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, index);
+        int level = read_int(path);
+        if (level < 0)
+            break;
+        snprintf(path, sizeof path, SYSFS_CPU "/cpu%d/cache/index%d/type", cpu, index);
+        if (!read_line(path, text, sizeof text) || strncmp(text, "Instruction", 11) == 0)
+            continue;
+        snprintf(path, sizeof path, SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        if (level > best && read_line(path, text, sizeof text) && parse_cpu_list(text, set))
+            best = level;
+    }
+    return best > 0;
+}
+
+static void
+read_nodes(void)
+{
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        node_of_cpu[cpu] = -1;
+    DIR *dir = opendir(SYSFS_NODE);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        int node;
+        char path[300], text[4096];
+        cpu_set_t cpus;
+        if (sscanf(entry->d_name, "node%d", &node) != 1)
+            continue;
+        num_nodes++;
+        snprintf(path, sizeof path, SYSFS_NODE "/%s/cpulist", entry->d_name);
+        if (!read_line(path, text, sizeof text) || !parse_cpu_list(text, &cpus))
+            continue;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &cpus))
+                node_of_cpu[cpu] = node;
+    }
+    if (dir != NULL)
+        closedir(dir);
+}
+
+void
+placement_init(void)
+{
+    char text[4096];
+    if (!read_line(SYSFS_CPU "/online", text, sizeof text) || !parse_cpu_list(text, &online))
+        return;
+    read_nodes();
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &online))
+            continue;
+        char path[128];
+        snprintf(path, sizeof path, SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        int id = read_int(path);
+
+        int pkg = 0;
+        while (pkg < num_packages && packages[pkg].id != id)
+            pkg++;
+        if (pkg == num_packages) {
+            packages = realloc(packages, (num_packages + 1) * sizeof *packages);
+            memset(&packages[pkg], 0, sizeof *packages);
+            packages[num_packages++].id = id;
+        }
+        CPU_SET(cpu, &packages[pkg].cpus);
+        packages[pkg].ncpus++;
+
+        cpu_set_t llc;
+        if (!read_llc(cpu, &llc)) {
+            CPU_ZERO(&llc);
+            CPU_SET(cpu, &llc);
+        }
+        CPU_AND(&llc, &llc, &online);
+        int d = 0;
+        while (d < num_domains && !CPU_EQUAL(&domains[d].cpus, &llc))
+            d++;
+        if (d == num_domains) {
+            domains = realloc(domains, (num_domains + 1) * sizeof *domains);
+            domains[d].cpus = llc;
+            domains[d].ncpus = CPU_COUNT(&llc);
+            domains[d].package = pkg;
+            domains[d].load = 0;
+            num_domains++;
+        }
+    }
+}
+
+/* The node of the CPUs in 'set' as a mask, or 0 if they are on
+ * different nodes or there is only one */
+static unsigned long
+node_mask(const cpu_set_t *set)
+{
+    int node = -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        if (node_of_cpu[cpu] < 0 || (node != -1 && node_of_cpu[cpu] != node))
+            return 0;
+        node = node_of_cpu[cpu];
+    }
+    return num_nodes > 1 && node >= 0 && node < 8 * (int) sizeof(unsigned long) ? 1UL << node : 0;
+}
+
+/* Whether load 'a' on 'a_cpus' CPUs is less than 'b' on 'b_cpus' */
+static bool
+less_loaded(int a, int a_cpus, int b, int b_cpus)
+{
+    return (long) a * b_cpus < (long) b * a_cpus;
+}
+
+struct placement *
+placement_choose(int num_stages)
+{
+    if (!automatic || num_domains < 2)
+        return NULL;
+    int pkg = 0;
+    for (int i = 1; i < num_packages; i++)
+        if (less_loaded(packages[i].load, packages[i].ncpus, packages[pkg].load, packages[pkg].ncpus))
+            pkg = i;
+
+    int d = -1;
+    for (int i = 0; i < num_domains; i++)
+        if (domains[i].package == pkg
+            && (d == -1 || less_loaded(domains[i].load, domains[i].ncpus, domains[d].load, domains[d].ncpus)))
+            d = i;
+    /* a single command, or a pipeline with more commands than the
+     * domain has CPUs, gets the whole package */
+    if (num_stages == 1 || domains[d].ncpus < num_stages) {
+        if (num_packages == 1)
+            return NULL;
+        d = -1;
+    }
+
+    struct placement *p = calloc(1, sizeof *p);
+    p->cpus = d != -1 ? domains[d].cpus : packages[pkg].cpus;
+    p->nodes = node_mask(&p->cpus);
+    p->package = pkg;
+    p->domain = d;
+    p->weight = num_stages;
+    packages[pkg].load += num_stages;
+    if (d != -1)
+        domains[d].load += num_stages;
+    return p;
+}
+
+struct placement *
+placement_parse(const char *list)
+{
+    cpu_set_t cpus, online_cpus;
+    if (!parse_cpu_list(list, &cpus))
+        return NULL;
+    CPU_AND(&online_cpus, &cpus, &online);
+    if (!CPU_EQUAL(&online_cpus, &cpus))
+        return NULL;
+
+    struct placement *p = calloc(1, sizeof *p);
+    p->cpus = cpus;
+    p->nodes = node_mask(&cpus);
+    p->package = p->domain = -1;
+    return p;
+}
+
+void
+placement_set_attr(struct placement *p, posix_spawnattr_t *attr, short *flags)
+{
+    posix_spawnattr_setaffinity_np(attr, sizeof p->cpus, &p->cpus);
+    *flags |= POSIX_SPAWN_SETAFFINITY;
+    if (p->nodes != 0) {
+        posix_spawnattr_setmempolicy_np(attr, MPOL_PREFERRED, &p->nodes, 8 * sizeof p->nodes);
+        *flags |= POSIX_SPAWN_SETMEMPOLICY;
+    }
+}
+
+int
+placement_move(pid_t pid, const struct placement *p)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+    int rc = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid > 0 && sched_setaffinity(tid, sizeof p->cpus, &p->cpus) != 0 && errno != ESRCH)
+            rc = -1;
+    }
+    closedir(dir);
+    return rc;
+}
+
+void
+placement_release(struct placement *p)
+{
+    if (p->package != -1)
+        packages[p->package].load -= p->weight;
+    if (p->domain != -1)
+        domains[p->domain].load -= p->weight;
+    free(p);
+}
+
+static void
+print_topology(void)
+{
+    char list[1024];
+    printf("pin: automatic placement %s\n", automatic ? "on" : "off");
+    for (int pkg = 0; pkg < num_packages; pkg++) {
+        format_cpu_list(&packages[pkg].cpus, list, sizeof list);
+        printf("package %d: cpus %s, load %d\n", packages[pkg].id, list, packages[pkg].load);
+        for (int d = 0; d < num_domains; d++) {
+            if (domains[d].package != pkg)
+                continue;
+            format_cpu_list(&domains[d].cpus, list, sizeof list);
+            int node = -1;
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &domains[d].cpus)) {
+                    node = node_of_cpu[cpu];
+                    break;
+                }
+            }
+            printf("\tcache domain: cpus %s, node %d, load %d\n", list, node, domains[d].load);
+        }
+    }
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->placement != NULL) {
+            format_cpu_list(&job->placement->cpus, list, sizeof list);
+            printf("[%d]\tcpus %s\t(%s)\n", job->jid, list, job->cmdline);
+        }
+    }
+}
+
+void
+placement_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        print_topology();
+    } else if (strcmp(argv[1], "auto") == 0) {
+        automatic = true;
+    } else if (strcmp(argv[1], "off") == 0) {
+        automatic = false;
+    } else if (strcmp(argv[1], "-j") == 0 && argv[2] != NULL && argv[3] != NULL) {
+        struct job *job = get_job_from_jid(atoi(argv[2]));
+        struct placement *p = placement_parse(argv[3]);
+        if (job == NULL || p == NULL) {
+            printf("pin: %s\n", job == NULL ? "no such job" : "expected a list of online CPUs");
+            if (p != NULL)
+                placement_release(p);
+            return;
+        }
+        /* the pids of a job on an agent are those of another host */
+        if (job->remote != NULL) {
+            printf("pin: job %d runs on an agent\n", job->jid);
+            placement_release(p);
+            return;
+        }
+        /* the memory policy of a running process cannot be changed */
+        for (int k = 0; k < job->num_processes; k++)
+            if (job->processes[k].alive && placement_move(job->processes[k].pid, p) != 0)
+                printf("pin: cannot move process %d: %s\n", job->processes[k].pid, strerror(errno));
+        if (job->placement != NULL)
+            placement_release(job->placement);
+        job->placement = p;
+    } else {
+        printf("usage: pin [auto | off | -j jid cpus | cpus pipeline]\n");
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef __PLACEMENT_H
+#define __PLACEMENT_H
+
+#include <stdbool.h>
+#include <sched.h>
+#include <sys/types.h>
+#include "../posix_spawn/spawn.h"
+
+/* Where the processes of a job run */
+struct placement {
+    cpu_set_t cpus;     /* The CPUs they may run on */
+    unsigned long nodes;    /* The NUMA node to allocate memory on first,
+                               as a mask, or 0 */
+    int package;        /* The package (socket) whose load includes the
+                           job, or -1 */
+    int domain;         /* Likewise for the cache domain, or -1 */
+    int weight;         /* How much the job adds to their load */
+};
+
+/* Read the CPU topology from /sys/devices/system. */
+void placement_init(void);
+
+/*
+ * Choose where a new job of 'num_stages' commands runs, if automatic
+ * placement is on and there is more than one place to choose from:
+ * the commands of a pipeline share the least loaded cache domain, so
+ * the data passed through their pipes stays in cache; a single command
+ * gets the least loaded package, so independent jobs are spread over
+ * the sockets.  Returns NULL if the job is not placed.
+ */
+struct placement *placement_choose(int num_stages);
+
+/* Parse a list of CPUs such as "0-3,8" into a placement chosen by hand.
+ * Returns NULL if it is not a valid list of online CPUs. */
+struct placement *placement_parse(const char *list);
+
+/* Make the spawn attributes apply a placement, which must remain valid
+ * until the job has been spawned. */
+void placement_set_attr(struct placement *p, posix_spawnattr_t *attr, short *flags);
+
+/* Move all threads of the running process 'pid' to the CPUs of a
+ * placement.  Returns 0 on success, -1 otherwise. */
+int placement_move(pid_t pid, const struct placement *p);
+
+/* The job placed with 'p' has ended; free it. */
+void placement_release(struct placement *p);
+
+/*
+ * The pin builtin:
+ *   pin                    print the topology and the placed jobs
+ *   pin auto | off         turn automatic placement on or off
+ *   pin -j jid cpus        move a running job to the given CPUs
+ * A new job is pinned by hand with "pin cpus pipeline", which the
+ * shell handles like "time pipeline".
+ */
+void placement_builtin(char **argv);
+
+#endif /* __PLACEMENT_H */
@@ -0,0 +1,412 @@
+/*
+ * Speculative prefetching of the programs of upcoming commands.
+ *
+ * The pipelines of a command line such as 'make; ./run; gdb ./run' run
+ * one after another.  While the first one runs, a background thread
+ * looks up the programs the later ones will execute and asks the kernel
+ * to start reading them into the page cache (POSIX_FADV_WILLNEED).  For
+ * ELF programs, this includes their interpreter and the shared libraries
+ * they need, found the way the dynamic linker would find them: DT_RPATH,
+ * LD_LIBRARY_PATH, DT_RUNPATH, /etc/ld.so.cache and the default
+ * directories.  For scripts, it includes the interpreter named on the
+ * #! line.  A cold exec then no longer waits for the disk.
+ *
+ * This is only a hint: anything that cannot be found or parsed is
+ * skipped, and nothing is remembered between command lines.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prefetch.h"
+#include "path_cache.h"
+
+#if __ELF_NATIVE_CLASS == 64
+# define NATIVE_ELFCLASS ELFCLASS64
+#else
+# define NATIVE_ELFCLASS ELFCLASS32
+#endif
+
+#define DEFAULT_LIBRARY_PATH "/lib64:/usr/lib64:/lib:/usr/lib"
+#define MAX_PHDRS 128
+#define MAX_DYNAMIC_SIZE (64 * 1024)
+#define MAX_STRTAB_SIZE (1024 * 1024)
+
+/* The format of /etc/ld.so.cache written by glibc 2.32 and later */
+#define LDCACHE_MAGIC "glibc-ld.so.cache1.1"
+
+struct ldcache_header {
+    char magic[sizeof LDCACHE_MAGIC - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t padding[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+};
+
+struct ldcache_entry {
+    int32_t flags;
+    uint32_t key;           /* Offset of the library name in the file */
+    uint32_t value;         /* Offset of its path in the file */
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+/* The work of one prefetch thread */
+struct prefetch_work {
+    char *path;             /* PATH when the command line was read */
+    char *ld_library_path;  /* LD_LIBRARY_PATH, or NULL */
+    char **names;           /* Command names to prefetch */
+    int num_names;
+    char **seen;            /* Files already prefetched */
+    int num_seen;
+    const char *ldcache;    /* The mapped /etc/ld.so.cache, or NULL */
+    size_t ldcache_size;
+};
+
+static bool prefetch_file(struct prefetch_work *work, const char *path, int machine);
+
+static bool
+already_seen(struct prefetch_work *work, const char *path)
+{
+    for (int i = 0; i < work->num_seen; i++)
+        if (strcmp(work->seen[i], path) == 0)
+            return true;
+    return false;
+}
+
+static void
+add_seen(struct prefetch_work *work, const char *path)
+{
+    work->seen = realloc(work->seen, (work->num_seen + 1) * sizeof *work->seen);
+    work->seen[work->num_seen++] = strdup(path);
+}
+
+/* Read 'size' bytes at 'offset' into a new buffer, or return NULL */
+static void *
+read_at(int fd, off_t offset, size_t size)
+{
+    void *buf = malloc(size + 1);
+    if (buf == NULL || pread(fd, buf, size, offset) != (ssize_t) size) {
+        free(buf);
+        return NULL;
+    }
+    ((char *) buf)[size] = '\0';
+    return buf;
+}
+
+/* Try each directory of the ':'-separated list 'dirs' for library 'name'.
+ * A leading $ORIGIN is replaced by 'origin', the directory of the
+ * object that needs the library. */
+static bool
+prefetch_from_dirs(struct prefetch_work *work, const char *dirs, const char *name,
+                   const char *origin, int machine)
+{
+    if (dirs == NULL)
+        return false;
+
+    char *list = strdup(dirs);
+    bool found = false;
+    for (char *dir = list, *next; dir != NULL && !found; dir = next) {
+        next = strchr(dir, ':');
+        if (next)
+            *next++ = '\0';
+
+        const char *rest = NULL;
+        if (strncmp(dir, "$ORIGIN", 7) == 0)
+            rest = dir + 7;
+        else if (strncmp(dir, "${ORIGIN}", 9) == 0)
+            rest = dir + 9;
+
+        char *candidate;
+        int rc = rest ? asprintf(&candidate, "%s%s/%s", origin, rest, name)
+                      : asprintf(&candidate, "%s/%s", *dir ? dir : ".", name);
+        if (rc == -1)
+            continue;
+        found = prefetch_file(work, candidate, machine);
+        free(candidate);
+    }
+    free(list);
+    return found;
+}
+
+/* Look up library 'name' in /etc/ld.so.cache */
+static bool
+prefetch_from_ldcache(struct prefetch_work *work, const char *name, int machine)
+{
+    const struct ldcache_header *header = (const void *) work->ldcache;
+    if (header == NULL)
+        return false;
+
+    const struct ldcache_entry *entries = (const void *) (header + 1);
+    size_t max_entries = (work->ldcache_size - sizeof *header) / sizeof *entries;
+    for (size_t i = 0; i < header->nlibs && i < max_entries; i++) {
+        if (entries[i].key >= work->ldcache_size || entries[i].value >= work->ldcache_size)
+            continue;
+        /* Entries for other architectures are rejected by prefetch_file */
+        if (strcmp(work->ldcache + entries[i].key, name) == 0
+            && prefetch_file(work, work->ldcache + entries[i].value, machine))
+            return true;
+    }
+    return false;
+}
+
+/* Find and prefetch the library 'name' needed by the object at 'path' */
+static void
+prefetch_library(struct prefetch_work *work, const char *name, const char *path,
+                 const char *rpath, const char *runpath, int machine)
+{
+    if (strchr(name, '/') != NULL) {
+        prefetch_file(work, name, machine);
+        return;
+    }
+
+    char *origin = strdup(path);
+    char *slash = strrchr(origin, '/');
+    if (slash)
+        *slash = '\0';
+    else
+        strcpy(origin, ".");
+
+    /* DT_RPATH is ignored if DT_RUNPATH is present */
+    if (!(runpath == NULL && prefetch_from_dirs(work, rpath, name, origin, machine))
+        && !prefetch_from_dirs(work, work->ld_library_path, name, origin, machine)
+        && !prefetch_from_dirs(work, runpath, name, origin, machine)
+        && !prefetch_from_ldcache(work, name, machine))
+        prefetch_from_dirs(work, DEFAULT_LIBRARY_PATH, name, origin, machine);
+    free(origin);
+}
+
+/* Convert a virtual address in an ELF object to its file offset */
+static bool
+vaddr_to_offset(const ElfW(Phdr) *phdrs, int phnum, ElfW(Addr) vaddr, off_t *offset)
+{
+    for (int i = 0; i < phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD && vaddr >= phdrs[i].p_vaddr
+            && vaddr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
+            *offset = vaddr - phdrs[i].p_vaddr + phdrs[i].p_offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Prefetch the interpreter and the libraries an ELF object depends on */
+static void
+prefetch_elf_dependencies(struct prefetch_work *work, int fd, const char *path,
+                          const ElfW(Ehdr) *ehdr)
+{
+    if (ehdr->e_phentsize != sizeof(ElfW(Phdr)) || ehdr->e_phnum > MAX_PHDRS)
+        return;
+
+    ElfW(Phdr) *phdrs = read_at(fd, ehdr->e_phoff, ehdr->e_phnum * sizeof *phdrs);
+    if (phdrs == NULL)
+        return;
+
+    ElfW(Dyn) *dyn = NULL;
+    size_t ndyn = 0;
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_INTERP && phdrs[i].p_filesz < PATH_MAX) {
+            char *interp = read_at(fd, phdrs[i].p_offset, phdrs[i].p_filesz);
+            if (interp != NULL)
+                prefetch_file(work, interp, ehdr->e_machine);
+            free(interp);
+        } else if (phdrs[i].p_type == PT_DYNAMIC && dyn == NULL
+                   && phdrs[i].p_filesz < MAX_DYNAMIC_SIZE) {
+            dyn = read_at(fd, phdrs[i].p_offset, phdrs[i].p_filesz);
+            ndyn = phdrs[i].p_filesz / sizeof *dyn;
+        }
+    }
+
+    ElfW(Addr) strtab_addr = 0;
+    size_t strtab_size = 0;
+    for (size_t i = 0; dyn != NULL && i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_STRTAB)
+            strtab_addr = dyn[i].d_un.d_ptr;
+        else if (dyn[i].d_tag == DT_STRSZ)
+            strtab_size = dyn[i].d_un.d_val;
+    }
+
+    off_t strtab_offset;
+    char *strtab = NULL;
+    if (strtab_size > 0 && strtab_size < MAX_STRTAB_SIZE
+        && vaddr_to_offset(phdrs, ehdr->e_phnum, strtab_addr, &strtab_offset))
+        strtab = read_at(fd, strtab_offset, strtab_size);
+
+    if (strtab != NULL) {
+        const char *rpath = NULL, *runpath = NULL;
+        for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+            if (dyn[i].d_tag == DT_RPATH && dyn[i].d_un.d_val < strtab_size)
+                rpath = strtab + dyn[i].d_un.d_val;
+            else if (dyn[i].d_tag == DT_RUNPATH && dyn[i].d_un.d_val < strtab_size)
+                runpath = strtab + dyn[i].d_un.d_val;
+        }
+        for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+            if (dyn[i].d_tag == DT_NEEDED && dyn[i].d_un.d_val < strtab_size)
+                prefetch_library(work, strtab + dyn[i].d_un.d_val, path,
+                                 rpath, runpath, ehdr->e_machine);
+        }
+    }
+
+    free(strtab);
+    free(dyn);
+    free(phdrs);
+}
+
+/* Prefetch the interpreter named on the #! line of a script */
+static void
+prefetch_script_interpreter(struct prefetch_work *work, int fd)
+{
+    char line[256];
+    ssize_t len = pread(fd, line, sizeof line - 1, 0);
+    if (len <= 2)
+        return;
+    line[len] = '\0';
+
+    char *interp = line + 2;
+    interp += strspn(interp, " \t");
+    interp[strcspn(interp, " \t\n")] = '\0';
+    if (*interp == '/')
+        prefetch_file(work, interp, EM_NONE);
+}
+
+/*
+ * Prefetch the program or library at 'path' and everything it needs.
+ * An ELF object must be for the native class and, unless 'machine'
+ * is EM_NONE, for that machine.
+ * Returns false if the file does not exist or is not suitable.
+ */
+static bool
+prefetch_file(struct prefetch_work *work, const char *path, int machine)
+{
+    if (already_seen(work, path))
+        return true;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    bool suitable = false;
+    ElfW(Ehdr) ehdr;
+    ssize_t len = pread(fd, &ehdr, sizeof ehdr, 0);
+    if (len >= 2 && memcmp(&ehdr, "#!", 2) == 0) {
+        suitable = machine == EM_NONE;
+        if (suitable) {
+            add_seen(work, path);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            prefetch_script_interpreter(work, fd);
+        }
+    } else if (len == sizeof ehdr && memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0
+               && ehdr.e_ident[EI_CLASS] == NATIVE_ELFCLASS
+               && (machine == EM_NONE || ehdr.e_machine == machine)) {
+        suitable = true;
+        add_seen(work, path);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        prefetch_elf_dependencies(work, fd, path, &ehdr);
+    }
+    close(fd);
+    return suitable;
+}
+
+static void
+map_ldcache(struct prefetch_work *work)
+{
+    int fd = open("/etc/ld.so.cache", O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) == 0 && st.st_size > sizeof(struct ldcache_header)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED && memcmp(map, LDCACHE_MAGIC, sizeof LDCACHE_MAGIC - 1) == 0) {
+            work->ldcache = map;
+            work->ldcache_size = st.st_size;
+        } else if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+static void
+free_work(struct prefetch_work *work)
+{
+    if (work->ldcache != NULL)
+        munmap((void *) work->ldcache, work->ldcache_size);
+    for (int i = 0; i < work->num_seen; i++)
+        free(work->seen[i]);
+    for (int i = 0; i < work->num_names; i++)
+        free(work->names[i]);
+    free(work->seen);
+    free(work->names);
+    free(work->path);
+    free(work->ld_library_path);
+    free(work);
+}
+
+static void *
+prefetch_thread(void *arg)
+{
+    struct prefetch_work *work = arg;
+
+    map_ldcache(work);
+    for (int i = 0; i < work->num_names; i++) {
+        char *file = path_cache_search(work->path, work->names[i]);
+        if (file != NULL)
+            prefetch_file(work, file, EM_NONE);
+        free(file);
+    }
+    free_work(work);
+    return NULL;
+}
+
+void
+prefetch_command_line(struct ast_command_line *cline)
+{
+    if (list_size(&cline->pipes) < 2)
+        return;
+
+    struct prefetch_work *work = calloc(1, sizeof *work);
+    const char *path = getenv("PATH");
+    const char *ld_library_path = getenv("LD_LIBRARY_PATH");
+    work->path = path ? strdup(path) : NULL;
+    work->ld_library_path = ld_library_path ? strdup(ld_library_path) : NULL;
+
+    /* The command names are copied, since the pipelines are freed as
+     * soon as they have run. */
+    struct list_elem *p = list_next(list_begin(&cline->pipes));
+    for (; p != list_end(&cline->pipes); p = list_next(p)) {
+        struct ast_pipeline *pipe = list_entry(p, struct ast_pipeline, elem);
+        for (struct list_elem *c = list_begin(&pipe->commands); c != list_end(&pipe->commands); c = list_next(c)) {
+            struct ast_command *cmd = list_entry(c, struct ast_command, elem);
+            work->names = realloc(work->names, (work->num_names + 1) * sizeof *work->names);
+            work->names[work->num_names++] = strdup(cmd->argv[0]);
+        }
+    }
+
+    /* The thread must not run the shell's signal handlers */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, prefetch_thread, work) != 0)
+        free_work(work);
+    pthread_attr_destroy(&attr);
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
@@ -0,0 +1,13 @@
+#ifndef __PREFETCH_H
+#define __PREFETCH_H
+
+#include "shell-ast.h"
+
+/*
+ * Start warming the page cache, in a background thread, for the programs
+ * that all pipelines of 'cline' but the first one will execute, so that
+ * they are read from disk while the first pipeline runs.
+ */
+void prefetch_command_line(struct ast_command_line *cline);
+
+#endif /* __PREFETCH_H */
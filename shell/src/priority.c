@@ -0,0 +1,224 @@
+/*
+ * Demotion of background jobs.
+ *
+ * While a job runs in the background, its CPU and IO priority is
+ * lowered so that it does not compete with the user's foreground work,
+ * and raised again when it is brought to the foreground.  On the CPU, a
+ * job in a cgroup is made idle through cpu.idle; otherwise, by default,
+ * its own processes are switched to SCHED_IDLE (the processes they start
+ * later inherit it, but are not restored with them), or with cpu=nice its
+ * whole process group gets a nice value of 19.  For IO, its process group
+ * is put in the idle IO class.  Only a process with CAP_SYS_NICE,
+ * or a high enough RLIMIT_NICE, may raise a priority again, so without
+ * them only jobs in cgroups are demoted on the CPU.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "priority.h"
+#include "jobs.h"
+#include "cgroup.h"
+
+/* From linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PGRP 2
+#define IOPRIO_WHO_PROCESS 1
+
+#define CAP_SYS_NICE 23
+
+enum priority_mode { PRIORITY_OFF, PRIORITY_FOREGROUND, PRIORITY_ALWAYS };
+enum cpu_class { CPU_NONE, CPU_NICE, CPU_IDLE };
+
+static enum priority_mode mode = PRIORITY_ALWAYS;
+static enum cpu_class cpu_class = CPU_IDLE;
+static bool io_idle = true;
+static int demoted_nice = 19;
+
+static bool foreground_active;  /* The shell waits for a foreground job */
+static bool can_restore;        /* The CPU priority can be raised again */
+static int shell_nice;
+static int shell_policy;
+static int shell_ioprio;
+
+static bool
+has_sys_nice(void)
+{
+    FILE *f = fopen("/proc/self/status", "re");
+    char line[256];
+    unsigned long long caps = 0;
+    while (f != NULL && fgets(line, sizeof line, f) != NULL)
+        if (sscanf(line, "CapEff: %llx", &caps) == 1)
+            break;
+    if (f != NULL)
+        fclose(f);
+    return (caps >> CAP_SYS_NICE) & 1;
+}
+
+void
+priority_init(void)
+{
+    errno = 0;
+    shell_nice = getpriority(PRIO_PROCESS, 0);
+    if (errno != 0)
+        shell_nice = 0;
+    shell_policy = sched_getscheduler(0);
+    if (shell_policy == -1)
+        shell_policy = SCHED_OTHER;
+    shell_ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+
+    struct rlimit rl;
+    can_restore = has_sys_nice()
+        || (getrlimit(RLIMIT_NICE, &rl) == 0
+            && (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= (rlim_t) (20 - shell_nice)));
+}
+
+/* Set the scheduling policy of all threads of process 'pid' */
+static void
+set_policy(pid_t pid, int policy)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return;
+    struct sched_param param = { .sched_priority = 0 };
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid > 0)
+            sched_setscheduler(tid, policy, &param);
+    }
+    closedir(dir);
+}
+
+static void
+set_demoted(struct job *job, bool demote)
+{
+    bool in_cgroup = job->cgroup != NULL && cgroup_set_idle(job->cgroup, demote);
+    if (!in_cgroup && can_restore && cpu_class == CPU_NICE)
+        setpriority(PRIO_PGRP, job->pgid, demote ? demoted_nice : shell_nice);
+    if (!in_cgroup && can_restore && cpu_class == CPU_IDLE)
+        for (int k = 0; k < job->num_processes; k++)
+            if (job->processes[k].alive)
+                set_policy(job->processes[k].pid, demote ? SCHED_IDLE : shell_policy);
+    if (io_idle && shell_ioprio != -1)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, job->pgid,
+                demote ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT : shell_ioprio);
+    job->demoted = demote;
+}
+
+void
+priority_job_changed(struct job *job)
+{
+    /* a job on an agent has no process group here */
+    if (job->remote != NULL || job->num_processes_alive == 0
+        || job->status == STOPPED || job->status == NEEDSTERMINAL)
+        return;
+    bool demote = job->status == BACKGROUND
+        && (mode == PRIORITY_ALWAYS || (mode == PRIORITY_FOREGROUND && foreground_active));
+    if (demote != job->demoted)
+        set_demoted(job, demote);
+}
+
+/* Demote or restore every job, after the mode or the foreground changed */
+static void
+update_all(void)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+        priority_job_changed(list_entry(e, struct job, elem));
+}
+
+void
+priority_foreground(bool active)
+{
+    foreground_active = active;
+    if (mode == PRIORITY_FOREGROUND)
+        update_all();
+}
+
+/* Restore every job, so that they can be demoted again the new way */
+static void
+restore_all(void)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->demoted && job->num_processes_alive > 0)
+            set_demoted(job, false);
+    }
+}
+
+static void
+print_state(void)
+{
+    static const char *const modes[] = { "never", "while a foreground job runs", "always" };
+    static const char *const classes[] = { "none", "nice", "idle" };
+    printf("priority: background jobs are demoted %s; cpu=%s nice=%d io=%s\n",
+           modes[mode], classes[cpu_class], demoted_nice, io_idle ? "idle" : "none");
+    if (!can_restore && cpu_class != CPU_NONE)
+        printf("priority: without CAP_SYS_NICE, only jobs in cgroups are demoted on the cpu\n");
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e)) {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->demoted)
+            printf("[%d]\tdemoted\t(%s)\n", job->jid, job->cmdline);
+    }
+}
+
+void
+priority_builtin(char **argv)
+{
+    if (argv[1] == NULL) {
+        print_state();
+        return;
+    }
+
+    enum priority_mode new_mode = mode;
+    enum cpu_class new_class = cpu_class;
+    bool new_io_idle = io_idle;
+    int new_nice = demoted_nice;
+    for (int k = 1; argv[k] != NULL; k++) {
+        char *arg = argv[k];
+        char *end;
+        if (strcmp(arg, "always") == 0) {
+            new_mode = PRIORITY_ALWAYS;
+        } else if (strcmp(arg, "fg") == 0) {
+            new_mode = PRIORITY_FOREGROUND;
+        } else if (strcmp(arg, "off") == 0) {
+            new_mode = PRIORITY_OFF;
+        } else if (strcmp(arg, "cpu=idle") == 0) {
+            new_class = CPU_IDLE;
+        } else if (strcmp(arg, "cpu=nice") == 0) {
+            new_class = CPU_NICE;
+        } else if (strcmp(arg, "cpu=none") == 0) {
+            new_class = CPU_NONE;
+        } else if (strcmp(arg, "io=idle") == 0) {
+            new_io_idle = true;
+        } else if (strcmp(arg, "io=none") == 0) {
+            new_io_idle = false;
+        } else if (strncmp(arg, "nice=", 5) == 0) {
+            new_nice = strtol(arg + 5, &end, 10);
+            if (end == arg + 5 || *end != '\0' || new_nice < shell_nice || new_nice > 19) {
+                printf("priority: nice must be between %d and 19\n", shell_nice);
+                return;
+            }
+        } else {
+            printf("usage: priority [always | fg | off] [cpu=idle|nice|none] [io=idle|none] [nice=N]\n");
+            return;
+        }
+    }
+
+    restore_all();
+    mode = new_mode;
+    cpu_class = new_class;
+    io_idle = new_io_idle;
+    demoted_nice = new_nice;
+    update_all();
+}
@@ -0,0 +1,34 @@
+#ifndef __PRIORITY_H
+#define __PRIORITY_H
+
+#include <stdbool.h>
+
+struct job;
+
+/* Remember the shell's own CPU and IO priority, which demoted jobs get
+ * back when they are restored. */
+void priority_init(void);
+
+/*
+ * A job has been started, or its status has changed to FOREGROUND or
+ * BACKGROUND: demote it if it now runs in the background while it should
+ * not compete with the user's work, or restore it.  Stopped jobs are
+ * left as they are.
+ */
+void priority_job_changed(struct job *job);
+
+/* The shell starts or stops waiting for a foreground job. */
+void priority_foreground(bool active);
+
+/*
+ * The priority builtin:
+ *   priority               print how and which jobs are demoted
+ *   priority always        demote background jobs (the default)
+ *   priority fg            only while a foreground job runs
+ *   priority off           never
+ *   priority cpu=idle|nice|none io=idle|none nice=N
+ *                          how they are demoted
+ */
+void priority_builtin(char **argv);
+
+#endif /* __PRIORITY_H */
@@ -0,0 +1,71 @@
+#!/usr/bin/python
+#
+# Tests the priority builtin, which demotes background jobs
+#
+
+import os
+import proc_check
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("priority")
+expect_exact("priority: background jobs are demoted always; cpu=idle nice=19 io=idle")
+expect_prompt()
+
+# a background job runs with SCHED_IDLE and in the idle IO class
+sendline("sleep 10 &")
+expect("\[1\] ([0-9]+)")
+pid = int(console.match.group(1))
+expect_prompt()
+sendline("priority")
+expect_exact("[1]\tdemoted\t(sleep 10)")
+expect_prompt()
+
+# only CAP_SYS_NICE allows raising the priority again
+if os.geteuid() == 0:
+    sendline("cut -d \" \" -f41 /proc/%d/stat" % pid)
+    expect_exact("5\r\n")
+    expect_prompt()
+
+    # when no longer demoted, it is restored
+    sendline("priority off")
+    expect_prompt()
+    sendline("cut -d \" \" -f41 /proc/%d/stat" % pid)
+    expect_exact("0\r\n")
+    expect_prompt()
+
+    # with cpu=nice, it gets nice 19 instead
+    sendline("priority always cpu=nice")
+    expect_prompt()
+    sendline("cut -d \" \" -f19 /proc/%d/stat" % pid)
+    expect_exact("19\r\n")
+    expect_prompt()
+
+    # with fg, only while a foreground job runs, such as cut
+    sendline("priority fg")
+    expect_prompt()
+    sendline("cut -d \" \" -f19 /proc/%d/stat" % pid)
+    expect_exact("19\r\n")
+    expect_prompt()
+    sendline("priority")
+    expect_exact("demoted while a foreground job runs")
+    expect_prompt()
+    assert "demoted\t(sleep" not in console.before, "job is still demoted at the prompt"
+
+sendline("priority nice=50")
+expect_exact("priority: nice must be between")
+expect_prompt()
+sendline("priority sometimes")
+expect_exact("usage: priority")
+expect_prompt()
+
+sendline("kill 1")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -0,0 +1,437 @@
+/*
+ * The socket of a serving shell.
+ *
+ * Clients, and the pipes that carry their jobs' output, are watched by
+ * the shell's event loop like everything else it waits for.  What a job
+ * writes is read as it arrives and queued, framed, for its client; a
+ * client that does not keep up is sent what is queued as its socket
+ * becomes writable, and meanwhile the pipes of its jobs are not read,
+ * so that its jobs block on a full pipe instead of the shell buffering
+ * without bound.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "list.h"
+#include "event_loop.h"
+
+/* Bytes read from a job's pipe at a time */
+#define CHUNK_SIZE 65536
+
+/* Output queued for a client above which its jobs' pipes are no longer
+ * read until all of it has been sent */
+#define HIGH_WATER (1 << 20)
+
+/* Longest request a client may send */
+#define MAX_REQUEST 65536
+
+/* Bytes data[start] to data[len - 1] are pending */
+struct buffer {
+    char *data;
+    size_t start, len, cap;
+};
+
+struct server_client {
+    int fd;
+    int write_fd;       /* A dup of fd, watched while output is pending */
+    bool writing;       /* write_fd is watched */
+    bool broken;        /* Sending failed; it is dropped at EOF on fd */
+    bool paused;        /* Its streams are not read until out is sent */
+    struct buffer in;   /* The request being received */
+    struct buffer out;  /* Messages not sent yet */
+    struct list streams;
+};
+
+struct server_stream {
+    struct list_elem elem;  /* Link element for its client's streams */
+    struct server_client *client;   /* NULL once it has disconnected */
+    int jid;
+    int read_fds[2];    /* stdout and stderr, -1 before opened or at EOF */
+    int write_fds[2];   /* The ends the job writes to, -1 once started */
+    bool ended;         /* The job has ended; exit follows its output */
+    int code;
+    char *text;
+};
+
+static const struct server_ops *ops;
+static int listen_fd = -1;
+static char *socket_path;
+
+static void
+buffer_append(struct buffer *b, const void *data, size_t len)
+{
+    if (b->len + len > b->cap && b->start > 0) {
+        memmove(b->data, b->data + b->start, b->len - b->start);
+        b->len -= b->start;
+        b->start = 0;
+    }
+    if (b->len + len > b->cap) {
+        b->cap = b->len + len > 2 * b->cap ? b->len + len : 2 * b->cap;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void
+buffer_consume(struct buffer *b, size_t len)
+{
+    b->start += len;
+    if (b->start == b->len)
+        b->start = b->len = 0;
+}
+
+static size_t
+buffer_pending(struct buffer *b)
+{
+    return b->len - b->start;
+}
+
+static void stream_ready(int fd, void *arg);
+
+static void
+watch_stream(struct server_stream *s)
+{
+    for (int i = 0; i < 2; i++)
+        if (s->read_fds[i] != -1)
+            event_loop_add(s->read_fds[i], stream_ready, s);
+}
+
+static void
+unwatch_stream(struct server_stream *s)
+{
+    for (int i = 0; i < 2; i++)
+        if (s->read_fds[i] != -1)
+            event_loop_remove(s->read_fds[i]);
+}
+
+static void
+pause_client(struct server_client *c)
+{
+    c->paused = true;
+    for (struct list_elem *e = list_begin(&c->streams); e != list_end(&c->streams); e = list_next(e))
+        unwatch_stream(list_entry(e, struct server_stream, elem));
+}
+
+static void
+resume_client(struct server_client *c)
+{
+    c->paused = false;
+    for (struct list_elem *e = list_begin(&c->streams); e != list_end(&c->streams); e = list_next(e))
+        watch_stream(list_entry(e, struct server_stream, elem));
+}
+
+static void client_writable(int fd, void *arg);
+
+/* Send as much of what is queued for a client as its socket takes */
+static void
+flush_client(struct server_client *c)
+{
+    while (buffer_pending(&c->out) > 0) {
+        ssize_t n = send(c->fd, c->out.data + c->out.start, buffer_pending(&c->out),
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            buffer_consume(&c->out, n);
+        } else if (errno == EAGAIN) {
+            if (!c->writing)
+                c->writing = event_loop_add_writable(c->write_fd, client_writable, c);
+            return;
+        } else if (errno != EINTR) {
+            /* it has gone; the socket reads EOF, and it is dropped then */
+            c->broken = true;
+            c->out.start = c->out.len = 0;
+        }
+    }
+    if (c->writing) {
+        event_loop_remove(c->write_fd);
+        c->writing = false;
+    }
+    if (c->paused)
+        resume_client(c);
+}
+
+static void
+client_writable(int fd, void *arg)
+{
+    flush_client(arg);
+}
+
+static void
+queue_message(struct server_client *c, const char *fmt, va_list ap)
+{
+    char *message;
+    int len = vasprintf(&message, fmt, ap);
+    if (len == -1)
+        return;
+    buffer_append(&c->out, message, len);
+    buffer_append(&c->out, "\n", 1);
+    free(message);
+}
+
+void
+server_send(struct server_client *client, const char *fmt, ...)
+{
+    if (client == NULL || client->broken)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    queue_message(client, fmt, ap);
+    va_end(ap);
+    flush_client(client);
+}
+
+/* Send the exit of a stream's job once all of its output has been read,
+ * and free it */
+static void
+finish_stream(struct server_stream *s)
+{
+    if (!s->ended || s->read_fds[0] != -1 || s->read_fds[1] != -1)
+        return;
+    if (s->client != NULL) {
+        server_send(s->client, "exit %d %d %s", s->jid, s->code, s->text);
+        list_remove(&s->elem);
+    }
+    free(s->text);
+    free(s);
+}
+
+static void
+stream_ready(int fd, void *arg)
+{
+    struct server_stream *s = arg;
+    int which = fd == s->read_fds[0] ? 0 : 1;
+    char data[CHUNK_SIZE];
+    ssize_t n = read(fd, data, sizeof data);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        event_loop_remove(fd);
+        close(fd);
+        s->read_fds[which] = -1;
+        finish_stream(s);
+        return;
+    }
+
+    struct server_client *c = s->client;
+    if (c->broken)
+        return;
+    char header[64];
+    int len = snprintf(header, sizeof header, "%s %d %zd\n", which == 0 ? "out" : "err", s->jid, n);
+    buffer_append(&c->out, header, len);
+    buffer_append(&c->out, data, n);
+    flush_client(c);
+    if (buffer_pending(&c->out) > HIGH_WATER && !c->paused)
+        pause_client(c);
+}
+
+struct server_stream *
+server_stream_create(struct server_client *client, int jid)
+{
+    struct server_stream *s = calloc(1, sizeof *s);
+    s->client = client;
+    s->jid = jid;
+    s->read_fds[0] = s->read_fds[1] = -1;
+    s->write_fds[0] = s->write_fds[1] = -1;
+    list_push_back(&client->streams, &s->elem);
+    server_send(client, "job %d", jid);
+    return s;
+}
+
+bool
+server_stream_open(struct server_stream *s, int *out_fd, int *err_fd)
+{
+    if (s->write_fds[0] == -1) {
+        int out[2], err[2];
+        if (pipe2(out, O_CLOEXEC) == -1)
+            return false;
+        if (pipe2(err, O_CLOEXEC) == -1) {
+            int saved = errno;
+            close(out[0]);
+            close(out[1]);
+            errno = saved;
+            return false;
+        }
+        /* only the shell's ends; the job's stay blocking */
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+        fcntl(err[0], F_SETFL, O_NONBLOCK);
+        s->read_fds[0] = out[0];
+        s->read_fds[1] = err[0];
+        s->write_fds[0] = out[1];
+        s->write_fds[1] = err[1];
+        if (s->client != NULL && !s->client->paused)
+            watch_stream(s);
+    }
+    *out_fd = s->write_fds[0];
+    *err_fd = s->write_fds[1];
+    return true;
+}
+
+void
+server_stream_started(struct server_stream *s)
+{
+    for (int i = 0; i < 2; i++) {
+        if (s->write_fds[i] != -1)
+            close(s->write_fds[i]);
+        s->write_fds[i] = -1;
+    }
+}
+
+void
+server_stream_ended(struct server_stream *s, int code, const char *text)
+{
+    /* a job that never started leaves nothing to read */
+    server_stream_started(s);
+    s->ended = true;
+    s->code = code;
+    s->text = strdup(text);
+    finish_stream(s);
+}
+
+struct server_client *
+server_stream_client(struct server_stream *s)
+{
+    return s->client;
+}
+
+/* Forget a client that has gone, and the output of its jobs */
+static void
+drop_client(struct server_client *c)
+{
+    ops->disconnected(c);
+    while (!list_empty(&c->streams)) {
+        struct server_stream *s = list_entry(list_pop_front(&c->streams), struct server_stream, elem);
+        s->client = NULL;
+        unwatch_stream(s);
+        for (int i = 0; i < 2; i++) {
+            if (s->read_fds[i] != -1)
+                close(s->read_fds[i]);
+            s->read_fds[i] = -1;
+        }
+        finish_stream(s);
+    }
+    event_loop_remove(c->fd);
+    event_loop_remove(c->write_fd);
+    close(c->fd);
+    close(c->write_fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+static void
+handle_request(struct server_client *c, char *line)
+{
+    int jid;
+    char rest;
+    if (strncmp(line, "run ", 4) == 0)
+        ops->run(c, line + 4);
+    else if (strcmp(line, "jobs") == 0)
+        ops->list(c);
+    else if (sscanf(line, "cancel %d%c", &jid, &rest) == 1)
+        ops->cancel(c, jid);
+    else if (line[0] != '\0')
+        server_send(c, "error unknown request");
+}
+
+static void
+client_ready(int fd, void *arg)
+{
+    struct server_client *c = arg;
+    char data[4096];
+    ssize_t n = read(fd, data, sizeof data);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        drop_client(c);
+        return;
+    }
+
+    buffer_append(&c->in, data, n);
+    char *newline;
+    while ((newline = memchr(c->in.data + c->in.start, '\n', buffer_pending(&c->in))) != NULL) {
+        char *line = c->in.data + c->in.start;
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r')
+            newline[-1] = '\0';
+        buffer_consume(&c->in, newline + 1 - line);
+        handle_request(c, line);
+    }
+    if (buffer_pending(&c->in) > MAX_REQUEST) {
+        server_send(c, "error request too long");
+        drop_client(c);
+    }
+}
+
+static void
+accept_ready(int fd, void *arg)
+{
+    int conn;
+    while ((conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        struct server_client *c = calloc(1, sizeof *c);
+        c->fd = conn;
+        c->write_fd = fcntl(conn, F_DUPFD_CLOEXEC, 0);
+        list_init(&c->streams);
+        if (c->write_fd == -1 || !event_loop_add(conn, client_ready, c)) {
+            close(conn);
+            if (c->write_fd != -1)
+                close(c->write_fd);
+            free(c);
+        }
+    }
+}
+
+static void
+remove_socket(void)
+{
+    unlink(socket_path);
+}
+
+/* Whether nothing listens on the socket at 'addr' any more */
+static bool
+is_stale(const struct sockaddr_un *addr)
+{
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool stale = connect(probe, (const struct sockaddr *) addr, sizeof *addr) == -1
+        && errno == ECONNREFUSED;
+    close(probe);
+    return stale;
+}
+
+bool
+server_init(const char *path, const struct server_ops *server_ops)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "cush: %s: socket path too long\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int rc = bind(listen_fd, (struct sockaddr *) &addr, sizeof addr);
+    if (rc == -1 && errno == EADDRINUSE && is_stale(&addr)) {
+        unlink(path);
+        rc = bind(listen_fd, (struct sockaddr *) &addr, sizeof addr);
+    }
+    if (rc == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "cush: %s: %s\n", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    ops = server_ops;
+    socket_path = strdup(path);
+    atexit(remove_socket);
+    event_loop_add(listen_fd, accept_ready, NULL);
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+
+/*
+ * The socket of a shell started with --serve, through which local
+ * clients submit command lines and receive what their jobs output.
+ *
+ * The protocol is line based.  A client sends
+ *   run <command line>     run each pipeline of it as a job
+ *   jobs                   list all jobs
+ *   cancel <jid>           terminate a job, or drop it if still queued
+ * and receives, for each job it ran,
+ *   job <jid>              once the job has been created
+ *   out <jid> <n>          followed by n bytes the job wrote to stdout
+ *   err <jid> <n>          followed by n bytes the job wrote to stderr
+ *   exit <jid> <code> <text>   after the last of its output, where code
+ *                          is its exit status, 128 + the signal that
+ *                          killed it, or 126/127 if it could not be
+ *                          started, and text is as jobs shows it
+ * for jobs "list <jid> <status>\t<command line>" per job and "end",
+ * for cancel "ok", and "error <reason>" for a request that failed.
+ */
+
+#include <stdbool.h>
+
+struct server_client;
+struct server_stream;
+
+/* What the shell does for the requests of a client */
+struct server_ops {
+    void (*run)(struct server_client *client, char *cmdline);
+    void (*list)(struct server_client *client);
+    void (*cancel)(struct server_client *client, int jid);
+    /* The client has gone; the streams of its jobs are discarded */
+    void (*disconnected)(struct server_client *client);
+};
+
+/* Listen on the Unix socket 'path', replacing a stale socket left by a
+ * shell that has died, and accept clients in the event loop.  The
+ * socket is removed when the shell exits.  Returns false after printing
+ * an error if it cannot listen. */
+bool server_init(const char *path, const struct server_ops *ops);
+
+/* Send a message to a client; a newline is appended. */
+void server_send(struct server_client *client, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Create the stream of job 'jid' that 'client' ran, and tell the client
+ * its id. */
+struct server_stream *server_stream_create(struct server_client *client, int jid);
+
+/* Set *out_fd and *err_fd to the pipes the job's stdout and stderr are
+ * to be connected to, creating them when the job is first started.
+ * Returns false with errno set if they cannot be created. */
+bool server_stream_open(struct server_stream *stream, int *out_fd, int *err_fd);
+
+/* Close the shell's copies of the write ends once the job's processes
+ * have been started, so the pipes reach EOF when the job is done. */
+void server_stream_started(struct server_stream *stream);
+
+/* Report that the job has ended, after the rest of its output, and free
+ * the stream. */
+void server_stream_ended(struct server_stream *stream, int code, const char *text);
+
+/* The client a stream goes to, or NULL if it has disconnected */
+struct server_client *server_stream_client(struct server_stream *stream);
+
+#endif /* __SERVER_H */
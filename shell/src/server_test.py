@@ -0,0 +1,129 @@
+#!/usr/bin/python
+#
+# Tests --serve: a shell without a terminal runs the command lines its
+# clients send to a Unix socket, and sends them back their jobs' output
+#
+
+import os, socket, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the server runs as a background job of the shell under test, with at
+# most one job at a time
+path = "/tmp/cush-serve-test-%d.sock" % os.getpid()
+sendline("./cush --serve %s -j 1 > /dev/null &" % path)
+expect("\[1\] ([0-9]+)")
+expect_prompt()
+
+def connect():
+    for attempt in range(50):
+        try:
+            s = socket.socket(socket.AF_UNIX)
+            s.connect(path)
+            return s
+        except socket.error:
+            time.sleep(0.1)
+    assert False, "the server does not accept clients"
+
+client = connect()
+client.settimeout(5)
+reader = client.makefile('rb')
+
+def request(line):
+    client.sendall(line + "\n")
+
+def receive():
+    """Read a message, split into words; out and err bring their data"""
+    words = reader.readline().rstrip("\n").split(" ", 3)
+    if words[0] in ("out", "err"):
+        words[3:] = [reader.read(int(words[2]))]
+    return words
+
+def run(cmdline):
+    """Run a command line of one pipeline, return its jid"""
+    request("run " + cmdline)
+    words = receive()
+    assert words[0] == "job", "expected the job's id, got %s" % words
+    return words[1]
+
+def finish(jid):
+    """Collect the output of a job until it exits"""
+    out, err = "", ""
+    while True:
+        words = receive()
+        assert words[1] == jid, "unexpected message %s" % words
+        if words[0] == "out":
+            out += words[3]
+        elif words[0] == "err":
+            err += words[3]
+        else:
+            assert words[0] == "exit", "unexpected message %s" % words
+            return out, err, " ".join(words[2:])
+
+# stdout and the exit status
+jid = run("echo hello | tr a-z A-Z")
+assert finish(jid) == ("HELLO\n", "", "0 Done")
+
+# stderr, separately
+jid = run("ls /nonexistent-directory")
+out, err, exit = finish(jid)
+assert out == "" and "nonexistent-directory" in err and exit == "2 Exit 2", (out, err, exit)
+
+# a command that does not exist
+jid = run("no-such-command-exists")
+assert finish(jid)[2] == "127 No such file or directory"
+
+# built-in commands belong to the shell
+request("run fg")
+assert receive() == ["error", "fg:", "built-in", "commands cannot be run"]
+
+# prefixes whose reports would go to the server's log are refused, and
+# why a prefix is invalid goes to the client
+request("run time true")
+assert receive() == ["error", "time:", "reports", "are not sent to clients"]
+request("run perfstat true")
+assert receive() == ["error", "perfstat:", "reports", "are not sent to clients"]
+request("run timeout -s NOSUCH 1 true")
+assert receive() == ["error", "timeout:", "NOSUCH:", "unknown signal"]
+
+# the second job waits for the first, which is cancelled
+sleeper = run("sleep 10")
+queued = run("echo queued")
+request("jobs")
+assert receive() == ["list", sleeper, "Running\tsleep", "10"]
+assert receive() == ["list", queued, "Queued\techo", "queued"]
+assert receive() == ["end"]
+request("cancel " + sleeper)
+assert receive() == ["ok"]
+assert finish(sleeper)[2] == "143 Terminated"
+assert finish(queued) == ("queued\n", "", "0 Done")
+
+# the jobs of a client that disconnects are terminated
+other = connect()
+other.sendall("run sleep 10\n")
+other.recv(100)
+other.close()
+for attempt in range(20):
+    time.sleep(0.25)
+    request("jobs")
+    jobs = []
+    while not jobs or jobs[-1] != ["end"]:
+        jobs.append(receive())
+    if len(jobs) == 1:
+        break
+assert jobs == [["end"]], "the job was not terminated: %s" % jobs
+
+# when the server is terminated, it removes its socket
+client.close()
+sendline("kill 1")
+expect_prompt()
+time.sleep(0.5)
+assert not os.path.exists(path), "the socket was not removed"
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -5,15 +5,20 @@
  * Virginia Tech.
  */
 
+#define _GNU_SOURCE    1
 #include <signal.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 #include "signal_support.h"
 #include "utils.h"
+#include "../posix_spawn/spawn.h"
 
 /* Return true if this signal is blocked */
 bool 
@@ -80,6 +85,44 @@ signal_set_handler(int sig, sa_sigaction_t handler)
         .sa_flags = SA_RESTART | SA_SIGINFO
     };
 
-    if (sigaction(sig, &sa, NULL) != 0)
+    /* Go through libspawn's handler registry, so that spawned children
+     * only need to reset the signals the shell actually handles. */
+    if (posix_spawn_sigaction_np(sig, &sa, NULL) != 0)
         utils_fatal_error("sigaction failed for signal %d", sig);
 }
+
+/* Block signal 'sig' and return a signalfd that reports it */
+int
+signal_create_fd(int sig)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    signal_block(sig);
+
+    /* No handler is needed; setting the default action through libspawn's
+     * registry still spares spawned children checking every signal. */
+    struct sigaction sa = { .sa_handler = SIG_DFL };
+    if (posix_spawn_sigaction_np(sig, &sa, NULL) != 0)
+        utils_fatal_error("sigaction failed for signal %d", sig);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        utils_fatal_error("signalfd failed for signal %d", sig);
+    return fd;
+}
+
+/* Close a signalfd made by signal_create_fd and unblock its signal */
+void
+signal_close_fd(int sig, int fd)
+{
+    close(fd);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    struct timespec poll = { 0, 0 };
+    while (sigtimedwait(&mask, NULL, &poll) == sig)
+        continue;
+    signal_unblock(sig);
+}
@@ -19,4 +19,11 @@ bool signal_unblock(int sig);
 /* Install signal handler for signal 'sig' */
 void signal_set_handler(int sig, sa_sigaction_t handler);
 
+/* Block signal 'sig' and return a signalfd that reports it instead */
+int signal_create_fd(int sig);
+
+/* Close a signalfd made by signal_create_fd, discard the instances of
+ * 'sig' it has not reported, and unblock 'sig' again */
+void signal_close_fd(int sig, int fd);
+
 #endif /* __SIGNAL_SUPPORT_H */
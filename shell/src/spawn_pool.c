@@ -0,0 +1,109 @@
+/*
+ * A pool of threads that spawn the stages of a pipeline concurrently.
+ *
+ * libspawn suspends the thread that spawns a child until the child has
+ * called execve (CLONE_VFORK), so spawning the stages of a pipeline one
+ * after another takes the sum of their exec times.  With the pool, the
+ * stages are handed out in order to several threads, each of which is
+ * suspended only for its own stage, and the pipeline is started once its
+ * slowest stage has exec'ed.
+ *
+ * The threads block all signals, so the shell's handlers keep running
+ * only in the main thread.
+ */
+#define _GNU_SOURCE    1
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "spawn_pool.h"
+#include "utils.h"
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+static int num_threads;
+static posix_spawn_pipeline_t *current;    /* Pipeline being spawned, or NULL */
+static size_t current_stages;              /* Its number of stages */
+static size_t next_stage;                  /* Next stage to be handed out */
+static size_t stages_done;                 /* Number of stages spawned */
+
+/* Take the next stage of the current pipeline and spawn it.
+ * Must be called with pool_lock held; returns false if there is none. */
+static bool
+spawn_next_stage(void)
+{
+    if (current == NULL || next_stage == current_stages)
+        return false;
+
+    posix_spawn_pipeline_t *pl = current;
+    size_t stage = next_stage++;
+    pthread_mutex_unlock(&pool_lock);
+
+    posix_spawn_pipeline_stage_np(pl, stage);
+
+    pthread_mutex_lock(&pool_lock);
+    if (++stages_done == current_stages)
+        pthread_cond_signal(&work_done);
+    return true;
+}
+
+static void *
+spawner_thread(void *arg)
+{
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!spawn_next_stage())
+            pthread_cond_wait(&work_available, &pool_lock);
+    }
+    return NULL;
+}
+
+bool
+spawn_pool_init(int nthreads)
+{
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_t thread;
+        int rc = pthread_create(&thread, NULL, spawner_thread, NULL);
+        if (rc != 0) {
+            errno = rc;
+            utils_error("Cannot start spawner thread: ");
+            break;
+        }
+        pthread_detach(thread);
+        num_threads++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return num_threads > 0;
+}
+
+bool
+spawn_pool_enabled(void)
+{
+    return num_threads > 0;
+}
+
+void
+spawn_pool_run(posix_spawn_pipeline_t *pl, size_t nstages)
+{
+    pthread_mutex_lock(&pool_lock);
+    current = pl;
+    current_stages = nstages;
+    next_stage = 0;
+    stages_done = 0;
+    pthread_cond_broadcast(&work_available);
+
+    // the calling thread spawns stages as well rather than sit idle
+    while (spawn_next_stage())
+        ;
+    while (stages_done < nstages)
+        pthread_cond_wait(&work_done, &pool_lock);
+    current = NULL;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,22 @@
+#ifndef __SPAWN_POOL_H
+#define __SPAWN_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "../posix_spawn/spawn.h"
+
+/* Start 'nthreads' threads that spawn pipeline stages concurrently.
+ * Returns false if no thread could be started. */
+bool spawn_pool_init(int nthreads);
+
+/* Return true if the pool has been started. */
+bool spawn_pool_enabled(void);
+
+/*
+ * Spawn the 'nstages' stages of a prepared pipeline, in order of their
+ * index, using the pool's threads and the calling thread.
+ * Returns once every stage has been spawned.
+ */
+void spawn_pool_run(posix_spawn_pipeline_t *pl, size_t nstages);
+
+#endif /* __SPAWN_POOL_H */
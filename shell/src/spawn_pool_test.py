@@ -0,0 +1,33 @@
+#!/usr/bin/python
+#
+# Tests cush -s, which spawns the stages of a pipeline concurrently from
+# a pool of spawner threads
+#
+
+from testutils import *
+
+# the arguments follow the shell's name as they are
+console = setup_tests([" -s", 4])
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# every stage is spawned, and connected to its neighbours, in order
+sendline("seq 1 5 | cat | tac | head -3")
+expect_exact("5\r\n4\r\n3\r\n")
+expect_prompt()
+
+# so are those of a background job
+sendline("sleep 0.5 | cat &")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+sendline("jobs")
+expect_exact("[%s]\tRunning\t\t(sleep 0.5| cat)" % jid)
+expect_prompt()
+sendline("wait " + jid)
+expect_exact("[%s]\tDone\t\t(sleep 0.5| cat)" % jid)
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
@@ -0,0 +1,43 @@
+#!/usr/bin/python
+#
+# Tests that kill and stop survive a missing or unknown job id
+#
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("stop")
+expect_exact("job id missing")
+expect_prompt()
+sendline("stop 99")
+expect_exact("No such job")
+expect_prompt()
+sendline("kill")
+expect_exact("job id missing")
+expect_prompt()
+sendline("kill 99")
+expect_exact("No such job")
+expect_prompt()
+
+# the shell is still there to stop and kill a job
+sendline("sleep 10 &")
+(jid,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+sendline("stop " + jid)
+expect_prompt()
+sendline("jobs")
+expect_exact("[%s]\tStopped\t\t(sleep 10)" % jid)
+expect_prompt()
+sendline("bg " + jid)
+expect_prompt()
+sendline("kill " + jid)
+expect_exact("[%s]\tTerminated\t\t(sleep 10)" % jid)
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
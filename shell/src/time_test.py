@@ -0,0 +1,51 @@
+#!/usr/bin/python
+#
+# Tests the time prefix, which reports what each stage of a pipeline
+# used, and jobs -l, which shows it for the processes of every job
+#
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+usage = "[0-9]+\.[0-9]{3}s +[0-9]+\.[0-9]{3}s +[0-9]+K"
+
+# one line per stage with real, user and sys time and maxrss, and a total
+sendline("time sleep 0.3 | cat")
+expect(" +real +user +sys +maxrss\r\n")
+expect("sleep 0.3 +0\.[3-9][0-9]{2}s +" + usage + "\r\n")
+expect("cat +0\.[3-9][0-9]{2}s +" + usage + "\r\n")
+expect("total +0\.[3-9][0-9]{2}s +" + usage + "\r\n")
+expect_prompt()
+
+# what the processes of a running job have used so far, read from /proc
+live = "user [0-9.]+s sys [0-9.]+s rss [0-9]+K read [0-9]+ write [0-9]+ disk read [0-9]+ disk write [0-9]+"
+sendline("sleep 10 &")
+(running,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+
+# and what those of a job that has ended used, from wait4
+sendline("sleep 0.2 | cat &")
+(ended,) = parse_regular_expression(console, "\[([0-9]+)\] [0-9]+")
+expect_prompt()
+expect_exact("[%s]\tDone\t\t(sleep 0.2| cat)" % ended)
+
+sendline("jobs -l")
+expect_exact("[%s]\tRunning\t\t(sleep 10)" % running)
+expect("\t[0-9]+\trunning\t" + live + "\t\(sleep 10\)\r\n")
+expect("\ttotal\t\t" + live + "\r\n")
+expect_exact("[%s]\t" % ended)
+expect("\t[0-9]+\texited\t" + live + "\t\(sleep 0.2\)\r\n")
+expect("\t[0-9]+\texited\t" + live + "\t\(cat\)\r\n")
+expect("\ttotal\t\t" + live + "\r\n")
+expect_prompt()
+
+sendline("kill " + running)
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
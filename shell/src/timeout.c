@@ -0,0 +1,271 @@
+/*
+ * Time limits of jobs.
+ *
+ * All jobs with a time limit share one timerfd.  Their deadlines are kept
+ * in a binary min-heap, and the timer is armed for the earliest one, so
+ * starting, cancelling and expiring a limit take O(log n) time however
+ * many jobs are timed.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "timeout.h"
+#include "jobs.h"
+#include "usage.h"
+#include "event_loop.h"
+#include "jobshm.h"
+
+static struct job **heap;
+static int heap_size;
+static int heap_capacity;
+static int timer_fd = -1;
+static int (*send_signal)(struct job *job, int sig);
+
+static bool
+earlier(int a, int b)
+{
+    return heap[a]->timeout.deadline < heap[b]->timeout.deadline;
+}
+
+static void
+heap_swap(int a, int b)
+{
+    struct job *job = heap[a];
+    heap[a] = heap[b];
+    heap[b] = job;
+    heap[a]->timeout.heap_index = a;
+    heap[b]->timeout.heap_index = b;
+}
+
+/* Restore the heap order after the deadline at 'i' changed */
+static void
+heap_fix(int i)
+{
+    while (i > 0 && earlier(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int least = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < heap_size; child++)
+            if (earlier(child, least))
+                least = child;
+        if (least == i)
+            return;
+        heap_swap(i, least);
+        i = least;
+    }
+}
+
+static void
+heap_push(struct job *job)
+{
+    if (heap_size == heap_capacity) {
+        heap_capacity = heap_capacity ? 2 * heap_capacity : 16;
+        heap = realloc(heap, heap_capacity * sizeof *heap);
+    }
+    heap[heap_size] = job;
+    job->timeout.heap_index = heap_size++;
+    heap_fix(heap_size - 1);
+}
+
+static void
+heap_remove(struct job *job)
+{
+    int i = job->timeout.heap_index;
+    job->timeout.heap_index = -1;
+    if (i != --heap_size) {
+        heap[i] = heap[heap_size];
+        heap[i]->timeout.heap_index = i;
+        heap_fix(i);
+    }
+}
+
+/* Arm the timer for the earliest deadline, or disarm it */
+static void
+arm_timer(void)
+{
+    struct itimerspec when = { .it_value = { 0, 0 } };
+    if (heap_size > 0) {
+        double deadline = heap[0]->timeout.deadline;
+        when.it_value.tv_sec = deadline;
+        when.it_value.tv_nsec = (deadline - when.it_value.tv_sec) * 1e9;
+        /* a zero it_value would disarm it */
+        if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0)
+            when.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+/* Send a job whose time is up its signal, or SIGKILL if it has already
+ * been sent that and is still running */
+static void
+expire(struct job *job)
+{
+    if (job->num_processes_alive == 0)
+        return;
+    if (job->timeout.expired) {
+        send_signal(job, SIGKILL);
+        return;
+    }
+    job->timeout.expired = true;
+    jobshm_update(job);
+    send_signal(job, job->timeout.signal);
+    if (job->timeout.signal != SIGKILL)
+        send_signal(job, SIGCONT);
+    if (job->timeout.kill_after > 0) {
+        job->timeout.deadline += job->timeout.kill_after;
+        heap_push(job);
+    }
+}
+
+static void
+timer_ready(int fd, void *arg)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof expirations) != sizeof expirations)
+        return;
+    double now = usage_now();
+    while (heap_size > 0 && heap[0]->timeout.deadline <= now) {
+        struct job *job = heap[0];
+        heap_remove(job);
+        expire(job);
+    }
+    arm_timer();
+}
+
+void
+timeout_init(int (*signal_job)(struct job *job, int sig))
+{
+    send_signal = signal_job;
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd != -1)
+        event_loop_add(timer_fd, timer_ready, NULL);
+}
+
+/* Parse a duration such as "1.5", "30s", "2m", "1h" or "1d" */
+static bool
+parse_duration(const char *text, double *seconds)
+{
+    char *end;
+    *seconds = strtod(text, &end);
+    if (end == text || *seconds < 0)
+        return false;
+    switch (*end) {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        *seconds *= 60;
+        break;
+    case 'h':
+        *seconds *= 60 * 60;
+        break;
+    case 'd':
+        *seconds *= 24 * 60 * 60;
+        break;
+    default:
+        return false;
+    }
+    return *end == '\0' || end[1] == '\0';
+}
+
+/* Parse a signal such as "9", "KILL" or "SIGKILL" */
+static int
+parse_signal(const char *text)
+{
+    char *end;
+    long number = strtol(text, &end, 10);
+    if (end != text && *end == '\0')
+        return number > 0 && number < NSIG ? number : -1;
+    if (strncmp(text, "SIG", 3) == 0)
+        text += 3;
+    for (int sig = 1; sig < NSIG; sig++) {
+        const char *name = sigabbrev_np(sig);
+        if (name != NULL && strcmp(name, text) == 0)
+            return sig;
+    }
+    return -1;
+}
+
+/* Whether 'option' is the short or long option, as "--long" or "--long=value" */
+static bool
+is_option(const char *option, const char *short_name, const char *long_name)
+{
+    size_t len = strlen(long_name);
+    return strcmp(option, short_name) == 0
+        || (strncmp(option, long_name, len) == 0 && (option[len] == '\0' || option[len] == '='));
+}
+
+int
+timeout_parse(char **argv, struct job_timeout *t, FILE *errors)
+{
+    memset(t, 0, sizeof *t);
+    t->signal = SIGTERM;
+    t->heap_index = -1;
+
+    int k = 1;
+    while (argv[k] != NULL && argv[k][0] == '-' && argv[k][1] != '\0') {
+        const char *option = argv[k++];
+        bool is_signal = is_option(option, "-s", "--signal");
+        if (!is_signal && !is_option(option, "-k", "--kill-after")) {
+            fprintf(errors, "timeout: unknown option %s\n", option);
+            return -1;
+        }
+        const char *value = strchr(option, '=');
+        if (value != NULL) {
+            value++;
+        } else if ((value = argv[k]) != NULL) {
+            k++;
+        } else {
+            fprintf(errors, "timeout: %s needs a value\n", option);
+            return -1;
+        }
+        if (is_signal && (t->signal = parse_signal(value)) == -1) {
+            fprintf(errors, "timeout: %s: unknown signal\n", value);
+            return -1;
+        }
+        if (!is_signal && (!parse_duration(value, &t->kill_after) || t->kill_after == 0)) {
+            fprintf(errors, "timeout: %s: invalid duration\n", value);
+            return -1;
+        }
+    }
+    if (argv[k] == NULL || !parse_duration(argv[k], &t->duration)) {
+        fprintf(errors, "usage: timeout [-s SIG] [-k DURATION] DURATION pipeline\n");
+        return -1;
+    }
+    if (argv[k + 1] == NULL) {
+        fprintf(errors, "timeout: missing command\n");
+        return -1;
+    }
+    return k + 1;
+}
+
+void
+timeout_start(struct job *job)
+{
+    if (job->timeout.duration <= 0 || timer_fd == -1)
+        return;
+    job->timeout.deadline = usage_now() + job->timeout.duration;
+    job->timeout.expired = false;
+    heap_push(job);
+    if (job->timeout.heap_index == 0)
+        arm_timer();
+}
+
+void
+timeout_cancel(struct job *job)
+{
+    if (job->timeout.heap_index == -1)
+        return;
+    bool first = job->timeout.heap_index == 0;
+    heap_remove(job);
+    if (first)
+        arm_timer();
+}
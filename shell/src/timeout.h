@@ -0,0 +1,41 @@
+#ifndef __TIMEOUT_H
+#define __TIMEOUT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+struct job;
+
+/* The time limit of a job, set with "timeout duration pipeline" */
+struct job_timeout {
+    double duration;    /* Seconds the job may run, or 0 for no limit */
+    int signal;         /* Sent when they are up, SIGTERM by default */
+    double kill_after;  /* Seconds until SIGKILL follows, or 0 for never */
+    double deadline;    /* usage_now() when the next signal is due */
+    int heap_index;     /* Its place in the shell's timer heap, or -1 */
+    bool expired;       /* The job ran out of time */
+};
+
+/* Create the timerfd that all time limits share.  'signal_job' sends a
+ * signal to all processes of a job. */
+void timeout_init(int (*signal_job)(struct job *job, int sig));
+
+/*
+ * Parse the prefix "timeout [-s SIG] [-k DURATION] DURATION" of a
+ * command's arguments into 't'; a duration is a number of seconds,
+ * optionally followed by s, m, h or d.  Returns the number of words it
+ * takes up, or -1 after printing an error to 'errors' if it is not
+ * valid or no command follows.
+ */
+int timeout_parse(char **argv, struct job_timeout *t, FILE *errors);
+
+/* Start the clock of a job that has just been started, if it has a time
+ * limit.  When it runs out, the job is sent its signal (and SIGCONT, in
+ * case it is stopped), and if it is still running 'kill_after' seconds
+ * later, SIGKILL. */
+void timeout_start(struct job *job);
+
+/* Stop the clock of a job that is deleted. */
+void timeout_cancel(struct job *job);
+
+#endif /* __TIMEOUT_H */
@@ -0,0 +1,63 @@
+#!/usr/bin/python
+#
+# Tests the timeout builtin, which limits how long a job runs
+#
+
+import proc_check
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a foreground job is terminated once its time is up
+sendline("timeout 0.5 sleep 10")
+expect_exact("[1]\tTimed out\t\t(sleep 10)")
+expect_prompt()
+
+# a job that finishes in time is not affected
+sendline("timeout 10 echo in time")
+expect_exact("in time")
+expect_prompt()
+
+# so is a background job, which is listed as timed out
+sendline("timeout 1 sleep 10 &")
+expect("\[1\] [0-9]+")
+expect_prompt()
+sendline("jobs")
+expect_exact("[1]\tRunning\t\t(sleep 10)")
+expect_prompt()
+expect_exact("[1]\tTimed out\t\t(sleep 10)")
+
+# many background jobs, each with its own limit
+sendline("timeout 0.5 sleep 10 &")
+expect_prompt()
+sendline("timeout 1.5 sleep 10 &")
+expect_prompt()
+sendline("timeout 1 sleep 10 &")
+expect_prompt()
+sendline("wait")
+for i in range(3):
+    expect("\[[0-9]+\]\tTimed out\t\t\(sleep 10\)")
+expect_prompt()
+
+# a job that ignores the signal is killed after --kill-after
+sendline("timeout -s INT -k 0.5 0.2 sh -c \"trap \\\"\\\" INT; sleep 10\"")
+expect_exact("Timed out")
+expect_prompt()
+
+# errors
+sendline("timeout -s NOSUCH 1 true")
+expect_exact("timeout: NOSUCH: unknown signal")
+expect_prompt()
+sendline("timeout 1")
+expect_exact("timeout: missing command")
+expect_prompt()
+sendline("timeout soon true")
+expect_exact("usage: timeout")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit")
+test_success()
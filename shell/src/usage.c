@@ -0,0 +1,100 @@
+/*
+ * Resource usage of the processes of jobs.
+ *
+ * When a process is reaped, wait4 reports its CPU time and peak RSS,
+ * and its I/O counters are read from /proc/<pid>/io just before, while
+ * it is still a zombie.  While it runs, the same figures are sampled
+ * from /proc/<pid>/stat and /proc/<pid>/io.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usage.h"
+
+double
+usage_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+usage_from_rusage(struct usage *u, const struct rusage *ru)
+{
+    u->utime = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    u->stime = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    u->rss_kb = ru->ru_maxrss;
+}
+
+bool
+usage_read_io(pid_t pid, struct usage *u)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/io", pid);
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return false;
+
+    char name[32];
+    unsigned long long value;
+    int found = 0;
+    while (fscanf(f, "%31[^:]: %llu\n", name, &value) == 2) {
+        if (strcmp(name, "rchar") == 0)
+            u->rchar = value, found++;
+        else if (strcmp(name, "wchar") == 0)
+            u->wchar = value, found++;
+        else if (strcmp(name, "read_bytes") == 0)
+            u->read_bytes = value, found++;
+        else if (strcmp(name, "write_bytes") == 0)
+            u->write_bytes = value, found++;
+    }
+    fclose(f);
+    return found == 4;
+}
+
+bool
+usage_read_live(pid_t pid, struct usage *u)
+{
+    char path[64], buf[1024];
+    snprintf(path, sizeof path, "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return false;
+    size_t len = fread(buf, 1, sizeof buf - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    /* the command name may contain spaces and parentheses */
+    char *fields = strrchr(buf, ')');
+    unsigned long utime, stime;
+    long rss;
+    if (fields == NULL
+        || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+                  "%*d %*d %*d %*d %*d %*d %*u %*u %ld", &utime, &stime, &rss) != 3)
+        return false;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    u->utime = (double) utime / ticks;
+    u->stime = (double) stime / ticks;
+    u->rss_kb = rss * (sysconf(_SC_PAGESIZE) / 1024);
+    /* without access to /proc/<pid>/io, the I/O counters are left alone */
+    usage_read_io(pid, u);
+    return true;
+}
+
+void
+usage_add(struct usage *total, const struct usage *u)
+{
+    total->utime += u->utime;
+    total->stime += u->stime;
+    if (u->rss_kb > total->rss_kb)
+        total->rss_kb = u->rss_kb;
+    total->rchar += u->rchar;
+    total->wchar += u->wchar;
+    total->read_bytes += u->read_bytes;
+    total->write_bytes += u->write_bytes;
+}
@@ -0,0 +1,39 @@
+#ifndef __USAGE_H
+#define __USAGE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* Resources used by a process */
+struct usage {
+    double utime;       /* User CPU time, in seconds */
+    double stime;       /* System CPU time, in seconds */
+    long rss_kb;        /* Peak resident set size once the process has
+                           exited, its current one while it runs */
+    unsigned long long rchar, wchar;    /* Bytes passed to read and write */
+    unsigned long long read_bytes, write_bytes;     /* Bytes read from and
+                                                       written to storage */
+};
+
+/* Current time in seconds, for measuring how long a job ran */
+double usage_now(void);
+
+/* Fill in the CPU time and peak RSS from the rusage returned by wait4. */
+void usage_from_rusage(struct usage *u, const struct rusage *ru);
+
+/*
+ * Read the I/O counters of process 'pid' from /proc/<pid>/io.
+ * This still works after the process has exited, as long as it has
+ * not been reaped.  Returns false if they cannot be read.
+ */
+bool usage_read_io(pid_t pid, struct usage *u);
+
+/* Read the CPU time, current RSS and I/O counters of a running process
+ * from /proc.  Returns false if it is gone. */
+bool usage_read_live(pid_t pid, struct usage *u);
+
+/* Add 'u' to 'total'; the RSS of the total is the largest one. */
+void usage_add(struct usage *total, const struct usage *u);
+
+#endif /* __USAGE_H */
@@ -0,0 +1,56 @@
+#!/usr/bin/python
+#
+# Tests the wait builtin
+#
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# wait for one job
+sendline("sleep 0.5 &")
+expect(r"\[1\] \d+")
+expect_prompt()
+sendline("wait 1")
+expect_exact("[1]\tDone\t\t(sleep 0.5)")
+expect_prompt()
+
+# a job that has already ended reports its exit status
+sendline("false &")
+expect(r"\[1\] \d+")
+expect_exact("[1]\tExit 1\t\t(false)")
+expect_prompt()
+sendline("wait 1")
+expect_exact("[1]\tExit 1\t\t(false)")
+expect_prompt()
+sendline("wait 1")
+expect_exact("wait: 1: no such job")
+expect_prompt()
+
+# wait -n returns once the first job has ended
+sendline("sleep 2 &")
+expect(r"\[1\] \d+")
+expect_prompt()
+sendline("sleep 0.3 &")
+expect(r"\[2\] \d+")
+expect_prompt()
+sendline("wait -n")
+expect_exact("[2]\tDone\t\t(sleep 0.3)")
+expect_prompt()
+sendline("jobs")
+expect_exact("[1]\tRunning\t\t(sleep 2)")
+expect_prompt()
+
+# wait without arguments waits for all jobs
+sendline("wait")
+expect_exact("[1]\tDone\t\t(sleep 2)")
+expect_prompt()
+
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,54 @@
+/*
+ * Helpers shared by the benchmarks.
+ *
+ * Every benchmark prints its results as one JSON object per line, with a
+ * "bench" member naming the benchmark, so the output of 'make bench' can
+ * be collected and compared between versions.
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdlib.h>
+#include <time.h>
+
+/* Current time in seconds */
+static inline double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Summary of a set of samples */
+struct bench_stats {
+    double mean;
+    double p50;
+    double p99;
+};
+
+/* Compute the statistics of 'n' samples; sorts them. */
+static inline struct bench_stats
+bench_stats(double *samples, int n)
+{
+    struct bench_stats stats = { 0, 0, 0 };
+    if (n == 0)
+        return stats;
+
+    qsort(samples, n, sizeof *samples, compare_doubles);
+    for (int i = 0; i < n; i++)
+        stats.mean += samples[i];
+    stats.mean /= n;
+    stats.p50 = samples[n / 2];
+    stats.p99 = samples[(n * 99) / 100];
+    return stats;
+}
+
+#endif /* __BENCH_H */
@@ -0,0 +1,114 @@
+/*
+ * Time the operations on cush's job table (src/jobs.c) with 10, 1000
+ * and 60000 jobs of one process each:
+ *
+ *  add         add_job, which assigns the job id
+ *  find_jid    get_job_from_jid, as used by fg, bg, kill and stop
+ *  find_pid    get_job_from_pid, as used for every reaped child
+ *  find_pgid   get_job_from_pgid
+ *  delete      removing the job from the list and delete_job
+ *
+ * The times are the average per operation, in nanoseconds.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jobs.h"
+#include "bench.h"
+
+/* Pids given to the fake processes of the jobs */
+#define FIRST_PID 100000
+
+/* Lookups made per measurement */
+#define LOOKUPS 1000
+
+static struct ast_pipeline *
+make_pipeline(void)
+{
+    char **argv = malloc(2 * sizeof *argv);
+    argv[0] = strdup("true");
+    argv[1] = NULL;
+    struct ast_pipeline *pipe = ast_pipeline_create(NULL, NULL, false);
+    ast_pipeline_add_command(pipe, ast_command_create(argv, false));
+    return pipe;
+}
+
+static void
+report(int njobs, const char *op, double seconds, int count)
+{
+    printf("{\"bench\": \"job_table\", \"jobs\": %d, \"op\": \"%s\", \"nsec\": %.1f}\n",
+        njobs, op, seconds / count * 1e9);
+    fflush(stdout);
+}
+
+static void
+bench_jobs(int njobs)
+{
+    struct job **jobs = malloc(njobs * sizeof *jobs);
+    struct ast_pipeline **pipes = malloc(njobs * sizeof *pipes);
+    for (int i = 0; i < njobs; i++)
+        pipes[i] = make_pipeline();
+
+    double start = now();
+    for (int i = 0; i < njobs; i++) {
+        struct job *job = add_job(pipes[i], 1);
+        job_set_pgid(job, FIRST_PID + i);
+        job_add_process(job, 0, FIRST_PID + i, -1);
+        jobs[i] = job;
+    }
+    report(njobs, "add", now() - start, njobs);
+
+    /* the same pseudo-random order for every run */
+    srand(42);
+    int *targets = malloc(LOOKUPS * sizeof *targets);
+    for (int i = 0; i < LOOKUPS; i++)
+        targets[i] = rand() % njobs;
+
+    int found = 0;
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+        found += get_job_from_jid(jobs[targets[i]]->jid) != NULL;
+    report(njobs, "find_jid", now() - start, LOOKUPS);
+
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++) {
+        struct job_process *proc;
+        found += get_job_from_pid(FIRST_PID + targets[i], &proc) != NULL;
+    }
+    report(njobs, "find_pid", now() - start, LOOKUPS);
+
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+        found += get_job_from_pgid(FIRST_PID + targets[i]) != NULL;
+    report(njobs, "find_pgid", now() - start, LOOKUPS);
+
+    if (found != 3 * LOOKUPS) {
+        fprintf(stderr, "job table lookup failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now();
+    for (int i = 0; i < njobs; i++) {
+        list_remove(&jobs[i]->elem);
+        delete_job(jobs[i]);
+    }
+    report(njobs, "delete", now() - start, njobs);
+
+    for (int i = 0; i < njobs; i++)
+        ast_pipeline_free(pipes[i]);
+    free(targets);
+    free(pipes);
+    free(jobs);
+}
+
+int
+main(int ac, char *av[])
+{
+    static const int job_counts[] = { 10, 1000, 60000 };
+
+    jobs_init();
+    for (size_t i = 0; i < sizeof job_counts / sizeof job_counts[0]; i++)
+        bench_jobs(job_counts[i]);
+    return 0;
+}
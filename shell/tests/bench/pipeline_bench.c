@@ -0,0 +1,322 @@
+/*
+ * Compare starting an N-stage pipeline one stage at a time, the way
+ * cush used to (pipe2 + posix_spawnp + close per stage), against
+ * starting it with a single posix_spawn_pipeline_np call.  The "cush"
+ * methods set up the pipeline as cush's spawn_job does for a background
+ * job: PATH lookups through the path cache, a closefrom action per
+ * stage and pidfds for every process, serially or from the spawn pool.
+ *
+ * For every stage count, the number of system calls made by the shell
+ * and by the children up to their final execve is counted by tracing
+ * one run with ptrace, and the wall-clock time is averaged over many runs.
+ * Results are printed as one JSON object per line.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "path_cache.h"
+#include "spawn_pool.h"
+#include "bench.h"
+
+/* Threads used by the spawn pool */
+#define POOL_THREADS 4
+
+#define MAXSTAGES 64
+
+extern char **environ;
+
+static char *stage_argv[] = { "true", NULL };
+
+/* Start an n-stage pipeline one posix_spawnp call at a time */
+static void
+spawn_per_stage(pid_t *pids, int n)
+{
+    int pipeinput[2] = { -1, -1 };
+    int pipeoutput[2] = { -1, -1 };
+
+    for (int i = 0; i < n; i++) {
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_init(&attr);
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, i == 0 ? 0 : pids[0]);
+
+        if (i < n - 1) {
+            if (pipe2(pipeoutput, O_CLOEXEC) != 0) {
+                perror("pipe2");
+                exit(EXIT_FAILURE);
+            }
+            posix_spawn_file_actions_adddup2(&actions, pipeoutput[1], STDOUT_FILENO);
+        }
+        if (i > 0)
+            posix_spawn_file_actions_adddup2(&actions, pipeinput[0], STDIN_FILENO);
+
+        if (posix_spawnp(&pids[i], stage_argv[0], &actions, &attr, stage_argv, environ) != 0)
+            pids[i] = -1;
+
+        if (i > 0) {
+            close(pipeinput[0]);
+            close(pipeinput[1]);
+        }
+        pipeinput[0] = pipeoutput[0];
+        pipeinput[1] = pipeoutput[1];
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+    }
+}
+
+/* Start an n-stage pipeline with one posix_spawn_pipeline_np call */
+static void
+spawn_batched(pid_t *pids, int n)
+{
+    struct posix_spawn_stage stages[n];
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    for (int i = 0; i < n; i++)
+        stages[i] = (struct posix_spawn_stage) { .argv = stage_argv };
+
+    posix_spawn_pipeline_np(pids, NULL, stages, n, &attr, environ);
+    posix_spawnattr_destroy(&attr);
+}
+
+/* The pidfds of the last pipeline started by spawn_cush, or -1 */
+static int pidfds[MAXSTAGES];
+
+/* Start an n-stage pipeline the way spawn_job does */
+static void
+spawn_cush(pid_t *pids, int n)
+{
+    struct posix_spawn_stage stages[n];
+    posix_spawn_file_actions_t actions[n];
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+
+    path_cache_refresh();
+    for (int i = 0; i < n; i++) {
+        posix_spawn_file_actions_init(&actions[i]);
+        posix_spawn_file_actions_addclosefrom_np(&actions[i], STDERR_FILENO + 1);
+
+        int error;
+        const char *file = path_cache_resolve(stage_argv[0], &error);
+        stages[i] = (struct posix_spawn_stage) {
+            .file = file,
+            .argv = stage_argv,
+            .file_actions = &actions[i],
+            .error = error,
+        };
+    }
+
+    if (spawn_pool_enabled() && n > 1) {
+        posix_spawn_pipeline_t *pl;
+        if (posix_spawn_pipeline_init_np(&pl, pids, pidfds, stages, n, &attr, environ) == 0) {
+            spawn_pool_run(pl, n);
+            posix_spawn_pipeline_finish_np(pl);
+        }
+    } else {
+        posix_spawn_pipeline_np(pids, pidfds, stages, n, &attr, environ);
+    }
+
+    for (int i = 0; i < n; i++)
+        posix_spawn_file_actions_destroy(&actions[i]);
+    posix_spawnattr_destroy(&attr);
+}
+
+static void
+setup_cush(void)
+{
+    path_cache_init();
+}
+
+static void
+setup_cush_pool(void)
+{
+    setup_cush();
+    if (!spawn_pool_init(POOL_THREADS))
+        exit(EXIT_FAILURE);
+}
+
+static void
+reap(pid_t *pids, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (pids[i] > 0)
+            waitpid(pids[i], NULL, 0);
+        if (pidfds[i] != -1) {
+            close(pidfds[i]);
+            pidfds[i] = -1;
+        }
+    }
+}
+
+/* Tracees we know about, and whether each is inside a system call. */
+#define MAXTRACEES 512
+static struct { pid_t pid; int in_syscall; } tracees[MAXTRACEES];
+
+static int *
+in_syscall_flag(pid_t pid)
+{
+    int free_slot = -1;
+    for (int i = 0; i < MAXTRACEES; i++) {
+        if (tracees[i].pid == pid)
+            return &tracees[i].in_syscall;
+        if (tracees[i].pid == 0 && free_slot == -1)
+            free_slot = i;
+    }
+    if (free_slot == -1) {
+        fprintf(stderr, "too many tracees\n");
+        exit(EXIT_FAILURE);
+    }
+    tracees[free_slot].pid = pid;
+    tracees[free_slot].in_syscall = 0;
+    return &tracees[free_slot].in_syscall;
+}
+
+/*
+ * Count the system calls made while starting one n-stage pipeline.
+ * Children are followed until they execve the stage program; the
+ * setup, the program itself and the final reaping are not counted.
+ */
+static long
+count_syscalls(void (*setup)(void), void (*spawn)(pid_t *, int), int n)
+{
+    pid_t tracee = fork();
+    if (tracee == 0) {
+        pid_t pids[n];
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        /* threads started here are traced, but their calls not counted */
+        if (setup)
+            setup();
+        /* marks the start of the measured region */
+        kill(getpid(), SIGUSR2);
+        spawn(pids, n);
+        /* marks the end of the measured region */
+        kill(getpid(), SIGUSR1);
+        reap(pids, n);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(tracee, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, tracee, NULL,
+        PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK
+        | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+    memset(tracees, 0, sizeof tracees);
+    ptrace(PTRACE_SYSCALL, tracee, NULL, NULL);
+
+    long count = 0;
+    bool started = false, done = false;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, __WALL)) > 0) {
+        if (!WIFSTOPPED(status))
+            continue;
+
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int deliver = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            int *flag = in_syscall_flag(pid);
+            if (!*flag && started && !done)
+                count++;
+            *flag = !*flag;
+        } else if (event == PTRACE_EVENT_EXEC) {
+            /* the stage is running its program now */
+            ptrace(PTRACE_DETACH, pid, NULL, NULL);
+            continue;
+        } else if (pid == tracee && sig == SIGUSR2) {
+            started = true;
+        } else if (pid == tracee && sig == SIGUSR1) {
+            done = true;
+        } else if (sig != SIGTRAP && sig != SIGSTOP) {
+            deliver = sig;
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) deliver);
+    }
+    return count;
+}
+
+/* Average wall-clock time in microseconds to start an n-stage pipeline */
+static double
+time_spawn(void (*spawn)(pid_t *, int), int n, int reps)
+{
+    pid_t pids[n];
+    double total = 0;
+    for (int r = 0; r < reps; r++) {
+        double start = now();
+        spawn(pids, n);
+        total += now() - start;
+        reap(pids, n);
+    }
+    return total / reps * 1e6;
+}
+
+static void
+sigchld_handler(int sig)
+{
+}
+
+int
+main(int ac, char *av[])
+{
+    int reps = ac > 1 ? atoi(av[1]) : 200;
+    static const int stage_counts[] = { 1, 4, 16, 64 };
+    static const struct {
+        const char *name;
+        void (*spawn)(pid_t *, int);
+        bool sigtrack;      /* install handlers via posix_spawn_sigaction_np */
+        void (*setup)(void);
+    } methods[] = {
+        { "per_stage", spawn_per_stage, false, NULL },
+        { "per_stage_sigtrack", spawn_per_stage, true, NULL },
+        { "pipeline_np", spawn_batched, false, NULL },
+        { "pipeline_np_sigtrack", spawn_batched, true, NULL },
+        { "cush", spawn_cush, true, setup_cush },
+        { "cush_pool", spawn_cush, true, setup_cush_pool },
+    };
+
+    for (int i = 0; i < MAXSTAGES; i++)
+        pidfds[i] = -1;
+
+    for (size_t i = 0; i < sizeof stage_counts / sizeof stage_counts[0]; i++) {
+        int n = stage_counts[i];
+        for (size_t m = 0; m < sizeof methods / sizeof methods[0]; m++) {
+            /* The handler registry cannot be turned off again once used,
+             * so every measurement runs in a fresh process that installs
+             * a SIGCHLD handler like cush does. */
+            pid_t child = fork();
+            if (child == 0) {
+                struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART };
+                if (methods[m].sigtrack)
+                    posix_spawn_sigaction_np(SIGCHLD, &sa, NULL);
+                else
+                    sigaction(SIGCHLD, &sa, NULL);
+
+                long syscalls = count_syscalls(methods[m].setup, methods[m].spawn, n);
+                if (methods[m].setup)
+                    methods[m].setup();
+                double usec = time_spawn(methods[m].spawn, n, reps);
+                printf("{\"bench\": \"pipeline_spawn\", \"method\": \"%s\", "
+                    "\"stages\": %d, \"syscalls\": %ld, \"usec\": %.1f}\n",
+                    methods[m].name, n, syscalls, usec);
+                fflush(stdout);
+                _exit(0);
+            }
+            waitpid(child, NULL, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Measure the latency from a child's exit until the shell has reaped it.
+ *
+ * The child writes the time into shared memory right before calling
+ * _exit, and the parent notes the time once waitpid or waitid has
+ * returned the child.  These ways of learning about the exit are compared:
+ *
+ *  sigchld_handler      the parent sleeps in sigsuspend and a SIGCHLD
+ *                       handler reaps with waitpid(-1, WNOHANG)
+ *  sigwaitinfo_pidfd    SIGCHLD is blocked, the parent sleeps in
+ *                       sigwaitinfo and reaps with waitid(P_PIDFD)
+ *  signalfd_epoll       SIGCHLD is blocked, the parent sleeps in
+ *                       epoll_wait on a signalfd, drains it and reaps
+ *                       with waitid(P_ALL, WNOHANG), as cush does
+ *
+ * Each method is also measured with a burst of children exiting at the
+ * same time, where the latency is that of the last child to be reaped.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/pidfd.h>
+#include "bench.h"
+
+#define MAXBURST 64
+
+/* Exit times written by the children */
+static volatile double *exit_times;
+
+static volatile int num_reaped;
+static double last_reap_time;
+
+static void
+sigchld_handler(int sig)
+{
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        num_reaped++;
+        last_reap_time = now();
+    }
+}
+
+/* Fork 'n' children that exit at the same time once 'go' is closed */
+static void
+start_children(int n, pid_t *pids, int *pidfds)
+{
+    int go[2];
+    if (pipe(go) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            char c;
+            close(go[1]);
+            if (read(go[0], &c, 1) < 0)
+                _exit(1);
+            exit_times[i] = now();
+            _exit(0);
+        }
+        pidfds[i] = pidfd_open(pids[i], 0);
+    }
+    close(go[0]);
+    /* make sure all children are waiting */
+    usleep(1000);
+    close(go[1]);
+}
+
+/* Latency in microseconds until the last of 'n' children was reaped */
+static double
+latest_exit_latency(int n, double reap_time)
+{
+    double latest = 0;
+    for (int i = 0; i < n; i++)
+        if (exit_times[i] > latest)
+            latest = exit_times[i];
+    return (reap_time - latest) * 1e6;
+}
+
+static double
+reap_with_handler(int n)
+{
+    pid_t pids[MAXBURST];
+    int pidfds[MAXBURST];
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    num_reaped = 0;
+    start_children(n, pids, pidfds);
+    while (num_reaped < n)
+        sigsuspend(&old);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    for (int i = 0; i < n; i++)
+        close(pidfds[i]);
+    return latest_exit_latency(n, last_reap_time);
+}
+
+static double
+reap_with_pidfds(int n)
+{
+    pid_t pids[MAXBURST];
+    int pidfds[MAXBURST];
+    bool alive[MAXBURST];
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    start_children(n, pids, pidfds);
+    int remaining = n;
+    double reap_time = 0;
+    memset(alive, true, sizeof alive);
+    while (remaining > 0) {
+        bool changed = false;
+        for (int i = 0; i < n; i++) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (alive[i] && waitid(P_PIDFD, pidfds[i], &info, WEXITED | WNOHANG) == 0
+                && info.si_pid != 0) {
+                alive[i] = false;
+                remaining--;
+                changed = true;
+                reap_time = now();
+            }
+        }
+        if (!changed)
+            sigwaitinfo(&chld, NULL);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    for (int i = 0; i < n; i++)
+        close(pidfds[i]);
+    return latest_exit_latency(n, reap_time);
+}
+
+static double
+reap_with_signalfd(int n)
+{
+    pid_t pids[MAXBURST];
+    int pidfds[MAXBURST];
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    int sfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sfd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+
+    start_children(n, pids, pidfds);
+    int remaining = n;
+    double reap_time = 0;
+    while (remaining > 0) {
+        struct signalfd_siginfo infos[16];
+        if (epoll_wait(epfd, &ev, 1, -1) != 1)
+            continue;
+        while (read(sfd, infos, sizeof infos) == sizeof infos)
+            continue;
+        for (;;) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) != 0 || info.si_pid == 0)
+                break;
+            remaining--;
+            reap_time = now();
+        }
+    }
+    close(epfd);
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    for (int i = 0; i < n; i++)
+        close(pidfds[i]);
+    return latest_exit_latency(n, reap_time);
+}
+
+int
+main(int ac, char *av[])
+{
+    int reps = ac > 1 ? atoi(av[1]) : 200;
+    static const int burst_sizes[] = { 1, 16, MAXBURST };
+    static const struct {
+        const char *name;
+        double (*reap)(int);
+    } methods[] = {
+        { "sigchld_handler", reap_with_handler },
+        { "sigwaitinfo_pidfd", reap_with_pidfds },
+        { "signalfd_epoll", reap_with_signalfd },
+    };
+
+    exit_times = mmap(NULL, MAXBURST * sizeof *exit_times, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (exit_times == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART };
+    double *samples = malloc(reps * sizeof *samples);
+    for (size_t m = 0; m < sizeof methods / sizeof methods[0]; m++) {
+        /* only the handler method reaps in the handler */
+        sa.sa_handler = methods[m].reap == reap_with_handler ? sigchld_handler : SIG_DFL;
+        sigaction(SIGCHLD, &sa, NULL);
+
+        for (size_t b = 0; b < sizeof burst_sizes / sizeof burst_sizes[0]; b++) {
+            for (int r = 0; r < reps; r++)
+                samples[r] = methods[m].reap(burst_sizes[b]);
+
+            struct bench_stats stats = bench_stats(samples, reps);
+            printf("{\"bench\": \"sigchld_reap\", \"method\": \"%s\", \"children\": %d, "
+                "\"reps\": %d, \"usec\": %.1f, \"usec_p50\": %.1f, \"usec_p99\": %.1f}\n",
+                methods[m].name, burst_sizes[b], reps, stats.mean, stats.p50, stats.p99);
+            fflush(stdout);
+        }
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Compare the ways of starting a single process:
+ *
+ *  libspawn_posix_spawnp  libspawn's posix_spawnp, which cush uses
+ *  glibc_posix_spawnp     the C library's posix_spawnp
+ *  glibc_posix_spawn      the C library's posix_spawn, given the full path
+ *  fork_exec              fork, then execv in the child
+ *  vfork_exec             vfork, then execv in the child
+ *
+ * Each method starts /bin/true repeatedly.  "usec" is the time until the
+ * call returns in the parent, "usec_roundtrip" the time until the child
+ * has also exited and been reaped.  Since fork returns before the child
+ * has called exec, only the round trip compares all methods fairly.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "bench.h"
+
+extern char **environ;
+
+#define PROGRAM "/bin/true"
+
+static char *child_argv[] = { "true", NULL };
+
+typedef int (*posix_spawnp_fun_t) (pid_t *pid, const char *file,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attrp,
+                char *const argv[], char *const envp[]);
+
+static posix_spawnp_fun_t glibc_posix_spawnp;
+
+static pid_t
+spawn_libspawn(void)
+{
+    pid_t pid;
+    return posix_spawnp(&pid, child_argv[0], NULL, NULL, child_argv, environ) == 0 ? pid : -1;
+}
+
+static pid_t
+spawn_glibc_spawnp(void)
+{
+    pid_t pid;
+    return glibc_posix_spawnp(&pid, child_argv[0], NULL, NULL, child_argv, environ) == 0 ? pid : -1;
+}
+
+static pid_t
+spawn_glibc_spawn(void)
+{
+    pid_t pid;
+    return posix_spawn(&pid, PROGRAM, NULL, NULL, child_argv, environ) == 0 ? pid : -1;
+}
+
+static pid_t
+spawn_fork(void)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(PROGRAM, child_argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t
+spawn_vfork(void)
+{
+    pid_t pid = vfork();
+    if (pid == 0) {
+        execv(PROGRAM, child_argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+int
+main(int ac, char *av[])
+{
+    int reps = ac > 1 ? atoi(av[1]) : 1000;
+    static const struct {
+        const char *name;
+        pid_t (*spawn)(void);
+    } methods[] = {
+        { "libspawn_posix_spawnp", spawn_libspawn },
+        { "glibc_posix_spawnp", spawn_glibc_spawnp },
+        { "glibc_posix_spawn", spawn_glibc_spawn },
+        { "fork_exec", spawn_fork },
+        { "vfork_exec", spawn_vfork },
+    };
+
+    /* libspawn's posix_spawnp takes the place of the C library's */
+    glibc_posix_spawnp = (posix_spawnp_fun_t) dlsym(RTLD_NEXT, "posix_spawnp");
+    if (glibc_posix_spawnp == NULL) {
+        fprintf(stderr, "cannot find the C library's posix_spawnp\n");
+        return EXIT_FAILURE;
+    }
+
+    double *call = malloc(reps * sizeof *call);
+    double *roundtrip = malloc(reps * sizeof *roundtrip);
+    for (size_t m = 0; m < sizeof methods / sizeof methods[0]; m++) {
+        int n = 0;
+        for (int r = 0; r < reps; r++) {
+            double start = now();
+            pid_t pid = methods[m].spawn();
+            double returned = now();
+            if (pid == -1 || waitpid(pid, NULL, 0) != pid)
+                continue;
+            call[n] = (returned - start) * 1e6;
+            roundtrip[n++] = (now() - start) * 1e6;
+        }
+
+        struct bench_stats c = bench_stats(call, n);
+        struct bench_stats rt = bench_stats(roundtrip, n);
+        printf("{\"bench\": \"spawn\", \"method\": \"%s\", \"reps\": %d, "
+            "\"usec\": %.1f, \"usec_p50\": %.1f, \"usec_p99\": %.1f, "
+            "\"usec_roundtrip\": %.1f, \"usec_roundtrip_p50\": %.1f, \"usec_roundtrip_p99\": %.1f}\n",
+            methods[m].name, n, c.mean, c.p50, c.p99, rt.mean, rt.p50, rt.p99);
+        fflush(stdout);
+    }
+    free(call);
+    free(roundtrip);
+    return 0;
+}